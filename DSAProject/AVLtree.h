@@ -0,0 +1,661 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include "Hash.h"
+#include "PackFile.h"
+#include "NodeArena.h"
+#include "KeyRange.h"
+#include "Instrumentation.h"
+using namespace std;
+
+//AVL CLASS with additional member: hash value per node
+struct AVLNode
+{
+    string key;           // Key for this node
+    HashDigest hashValue; // Hash value for this node (32 bytes, filled by the tree's hasher)
+    AVLNode* left;
+    AVLNode* right;
+    int height;
+    bool dirty;           // hashValue is stale (deferred hashing); if set, so is every ancestor's
+
+    // Constructor
+    AVLNode(string k) : key(move(k)), hashValue(), left(nullptr), right(nullptr), height(1), dirty(false) {}
+};
+
+
+// Hasher is the Merkle hash strategy: InstructorHash or Sha256Hasher (see Hash.h).
+// Allocator hands out the nodes: NodeArena or HeapNodeAllocator (see NodeArena.h).
+template <typename Hasher = InstructorHash, typename Allocator = NodeArena<AVLNode>>
+class AVLTree
+{
+public:
+    typedef Hasher HasherType;
+
+private:
+    AVLNode* root; // Root of the tree
+    Hasher hasher; // Hashing utility
+    Allocator nodes; // Owns every node of the tree
+    uint64_t insertCount = 0; // insert() calls, so hash statistics can be read per insert
+    uint64_t rotationCount = 0;
+    bool deferredHashing = false; // mark nodes dirty on insert and rehash them all in flushHashes()
+    vector<AVLNode**> insertPath; // reused by insertNode
+
+    int height(AVLNode* node)
+    {
+        return node ? node->height : 0;
+    }
+
+    // Helper function to update the hash for a node; the hasher decides how a leaf
+    // (key only) and an internal node (key + child hashes) are combined
+    void updateHash(AVLNode* node)
+    {
+        if (!node) return;
+
+        // Deferred mode only records that the hash is stale; every ancestor of a changed
+        // node passes through here too, so the dirty nodes always form a subtree at the root
+        if (deferredHashing) {
+            node->dirty = true;
+            return;
+        }
+
+        hasher.hashNode(node->key,
+            node->left ? &node->left->hashValue : nullptr,
+            node->right ? &node->right->hashValue : nullptr,
+            node->hashValue);
+    }
+
+    // Returns every node of a subtree to the allocator
+    void destroySubtree(AVLNode* node)
+    {
+        vector<AVLNode*> stack;
+        if (node) stack.push_back(node);
+        while (!stack.empty()) {
+            node = stack.back();
+            stack.pop_back();
+            if (node->left) stack.push_back(node->left);
+            if (node->right) stack.push_back(node->right);
+            nodes.destroy(node);
+        }
+    }
+
+    // Post-order rehash of the dirty nodes only; clean subtrees are skipped whole
+    void rehashDirty(AVLNode* node)
+    {
+        if (!node || !node->dirty) return;
+
+        rehashDirty(node->left);
+        rehashDirty(node->right);
+        hasher.hashNode(node->key,
+            node->left ? &node->left->hashValue : nullptr,
+            node->right ? &node->right->hashValue : nullptr,
+            node->hashValue);
+        node->dirty = false;
+    }
+
+    int getBalance(AVLNode* node)
+    {
+        return node ? height(node->left) - height(node->right) : 0;
+    }
+
+    void updateHeight(AVLNode* node)
+    {
+        node->height = 1 + max(height(node->left), height(node->right));
+    }
+
+    // rotations; EVERYTIME U DO A ROTATION, YOU WILL ALSO UPDATE THE HASH. HENCE update Hash called for the new subtrees
+    AVLNode* rightRotate(AVLNode* y)
+    {
+        AVLNode* x = y->left;
+        AVLNode* T2 = x->right;
+        rotationCount++;
+
+        // perform rotation
+        x->right = y;
+        y->left = T2;
+
+        updateHeight(y);
+        updateHeight(x);
+        updateHash(y);
+        updateHash(x);
+
+        return x;
+    }
+
+    AVLNode* leftRotate(AVLNode* x) {
+        AVLNode* y = x->right;
+        AVLNode* T2 = y->left;
+        rotationCount++;
+
+        // perform rotation
+        y->left = x;
+        x->right = T2;
+
+        updateHeight(x);
+        updateHeight(y);
+        updateHash(x);
+        updateHash(y);
+
+        return y;
+    }
+
+    // Height, hash and balance of an ancestor of a newly inserted key; returns the subtree root
+    AVLNode* rebalanceAfterInsert(AVLNode* node, string_view key)
+    {
+        // Update height and hash of this ancestor node
+        updateHeight(node);
+        updateHash(node);
+
+        // Get balance factor
+        int balance = getBalance(node);
+
+        // If the node becomes unbalanced, perform rotations
+
+        // Left-Left Case
+        if (balance > 1 && key < node->left->key) {
+            return rightRotate(node);
+        }
+
+        // Right-Right Case
+        if (balance < -1 && key > node->right->key) {
+            return leftRotate(node);
+        }
+
+        // Left-Right Case
+        if (balance > 1 && key > node->left->key) {
+            node->left = leftRotate(node->left);
+            return rightRotate(node);
+        }
+
+        // Right-Left Case
+        if (balance < -1 && key < node->right->key) {
+            node->right = rightRotate(node->right);
+            return leftRotate(node);
+        }
+
+        return node;
+    }
+
+    // Insert without recursion: the child links followed on the way down are kept in
+    // insertPath, then every ancestor is rebalanced bottom-up and relinked through its link
+    void insertNode(string_view key)
+    {
+        insertPath.clear();
+        AVLNode** link = &root;
+        while (*link != nullptr) {
+            AVLNode* node = *link;
+            if (key < node->key) {
+                insertPath.push_back(link);
+                link = &node->left;
+            }
+            else if (key > node->key) {
+                insertPath.push_back(link);
+                link = &node->right;
+            }
+            else {
+                return; // Duplicate keys are not allowed in the AVL tree; nothing to rehash
+            }
+        }
+
+        AVLNode* created = nodes.create(string(key)); // the only copy of the key the tree makes
+        updateHash(created);
+        if (verboseLogging) {
+            cout << "Creating node for key: " << created->key;
+            if (!deferredHashing) cout << ", Hash: " << Hasher::toString(created->hashValue);
+            cout << '\n';
+        }
+        *link = created;
+
+        while (!insertPath.empty()) {
+            AVLNode** ancestor = insertPath.back();
+            insertPath.pop_back();
+            *ancestor = rebalanceAfterInsert(*ancestor, key);
+        }
+    }
+
+    // Restores the balance of node after a delete below it and returns the subtree root;
+    // unlike insert, the child's balance decides between a single and a double rotation
+    AVLNode* rebalance(AVLNode* node)
+    {
+        updateHeight(node);
+        updateHash(node);
+
+        int balance = getBalance(node);
+        if (balance > 1) {
+            if (getBalance(node->left) < 0) {
+                node->left = leftRotate(node->left);
+            }
+            return rightRotate(node);
+        }
+        if (balance < -1) {
+            if (getBalance(node->right) > 0) {
+                node->right = rightRotate(node->right);
+            }
+            return leftRotate(node);
+        }
+        return node;
+    }
+
+    // Unlinks the smallest node of a subtree, returned through minNode
+    AVLNode* detachMin(AVLNode* node, AVLNode*& minNode)
+    {
+        if (node->left == nullptr) {
+            minNode = node;
+            return node->right;
+        }
+        node->left = detachMin(node->left, minNode);
+        return rebalance(node);
+    }
+
+    AVLNode* removeNode(AVLNode* node, string_view key, bool& removed)
+    {
+        if (node == nullptr) return nullptr;
+
+        if (key < node->key) {
+            node->left = removeNode(node->left, key, removed);
+        }
+        else if (key > node->key) {
+            node->right = removeNode(node->right, key, removed);
+        }
+        else {
+            removed = true;
+            AVLNode* replacement;
+            if (node->left == nullptr || node->right == nullptr) {
+                replacement = node->left ? node->left : node->right;
+                nodes.destroy(node);
+                return replacement;
+            }
+            // Two children: the in-order successor takes the node's place
+            node->right = detachMin(node->right, replacement);
+            replacement->left = node->left;
+            replacement->right = node->right;
+            nodes.destroy(node);
+            node = replacement;
+        }
+        return removed ? rebalance(node) : node;
+    }
+
+    // Builds a perfectly balanced subtree from keys[lo, hi): the middle key becomes the root.
+    // Hashes are left for hashLevels; nodes are collected by height instead.
+    AVLNode* buildBalanced(vector<string>& keys, size_t lo, size_t hi, vector<vector<AVLNode*>>& levels)
+    {
+        if (lo >= hi) return nullptr;
+
+        size_t mid = lo + (hi - lo) / 2;
+        AVLNode* node = nodes.create(move(keys[mid]));
+        node->left = buildBalanced(keys, lo, mid, levels);
+        node->right = buildBalanced(keys, mid + 1, hi, levels);
+
+        updateHeight(node);
+        if (levels.size() < static_cast<size_t>(node->height)) {
+            levels.resize(node->height);
+        }
+        levels[node->height - 1].push_back(node);
+        return node;
+    }
+
+    // Hashes a bulk-built tree bottom-up one level at a time, so every node is hashed exactly
+    // once and each level goes to the hasher as one batch (multi-buffer SHA-256 uses that)
+    void hashLevels(const vector<vector<AVLNode*>>& levels)
+    {
+        Stopwatch timer;
+        vector<HashInput> batch;
+        for (const vector<AVLNode*>& level : levels) {
+            batch.clear();
+            for (AVLNode* node : level) {
+                batch.push_back({ node->key,
+                    node->left ? &node->left->hashValue : nullptr,
+                    node->right ? &node->right->hashValue : nullptr,
+                    &node->hashValue });
+            }
+            hasher.hashNodes(batch.data(), batch.size());
+        }
+        hasher.addBatchTime(timer.nanoseconds());
+    }
+
+    // makes every node a txt file w key hash left right data in it (pre-order, with an
+    // explicit stack instead of recursion)
+    void saveNodeToFile(AVLNode* start)
+    {
+        vector<AVLNode*> stack;
+        if (start) stack.push_back(start);
+        while (!stack.empty()) {
+            AVLNode* node = stack.back();
+            stack.pop_back();
+
+            string fileName = node->key + ".txt";
+            ofstream file(fileName);
+            if (file) {
+                file << "Key: " << node->key << endl;
+                file << "Hash: " << Hasher::toString(node->hashValue) << endl;
+                file << "Left: " << (node->left ? node->left->key : "NULL") << endl;
+                file << "Right: " << (node->right ? node->right->key : "NULL") << endl;
+                file.close();
+                if (verboseLogging) cout << "Node saved to file: " << fileName << '\n';
+            }
+
+            //saving left n right subtrees (right pushed first so left is saved first)
+            if (node->right) stack.push_back(node->right);
+            if (node->left) stack.push_back(node->left);
+        }
+    }
+
+    // Writes a subtree in post-order and returns its record index
+    uint32_t writePackNode(PackWriter& pack, AVLNode* node)
+    {
+        if (node == nullptr) return PACK_NO_NODE;
+
+        uint32_t left = writePackNode(pack, node->left);
+        size_t slot = pack.reserveIndexSlot();
+        uint32_t right = writePackNode(pack, node->right);
+        uint32_t index = pack.addNode(node->key, node->hashValue, left, right, node->height);
+        pack.fillIndexSlot(slot, index);
+        return index;
+    }
+
+public:
+    AVLTree() : root(nullptr) {}
+
+    ~AVLTree() {
+        clear();
+    }
+
+    // The tree owns its nodes
+    AVLTree(const AVLTree&) = delete;
+    AVLTree& operator=(const AVLTree&) = delete;
+
+    // Removes every node; keys own heap memory, so each node's destructor still runs
+    void clear() {
+        destroySubtree(root);
+        nodes.release();
+        root = nullptr;
+    }
+
+    // Insert a key into the AVL tree (the key is only copied if a new node is created)
+    void insert(string_view key) {
+        insertCount++;
+        insertNode(key);
+    }
+
+    // Remove a key; returns false if it wasn't in the tree
+    bool remove(string_view key) {
+        bool removed = false;
+        root = removeNode(root, key, removed);
+        return removed;
+    }
+
+    // Bulk load: replaces the tree with one built bottom-up from sorted, duplicate-free keys
+    // in O(n). The keys are moved into the nodes.
+    void buildFromSorted(vector<string>&& keys) {
+        clear();
+        vector<vector<AVLNode*>> levels;
+        root = buildBalanced(keys, 0, keys.size(), levels);
+        hashLevels(levels);
+        keys.clear();
+    }
+
+    // Deferred hashing: inserts only mark the touched nodes dirty, and the Merkle hashes are
+    // brought up to date in one pass when the root hash or a save needs them, so a batch of
+    // inserts costs one hash per touched node instead of one per insert per level
+    void setDeferredHashing(bool enabled) {
+        if (!enabled) flushHashes();
+        deferredHashing = enabled;
+    }
+
+    bool isDeferredHashing() const {
+        return deferredHashing;
+    }
+
+    // Recomputes every stale hash (no-op when nothing is dirty)
+    void flushHashes() {
+        if (!root || !root->dirty) return;
+        Stopwatch timer;
+        rehashDirty(root);
+        hasher.addBatchTime(timer.nanoseconds());
+    }
+
+    // Save the entire tree to .txt files
+    void saveToFiles() {
+        flushHashes();
+        saveNodeToFile(root);
+    }
+
+    // Pre-order walk over the nodes and their Merkle hashes: fn(key, hash, leftHash, rightHash),
+    // with null for a missing child, returns false to skip the node's subtree
+    template <typename Fn>
+    void visitNodes(Fn fn) {
+        flushHashes();
+        vector<const AVLNode*> stack;
+        if (root) stack.push_back(root);
+        while (!stack.empty()) {
+            const AVLNode* node = stack.back();
+            stack.pop_back();
+            if (!fn(string_view(node->key), node->hashValue,
+                node->left ? &node->left->hashValue : nullptr,
+                node->right ? &node->right->hashValue : nullptr)) {
+                continue;
+            }
+            if (node->right) stack.push_back(node->right);
+            if (node->left) stack.push_back(node->left);
+        }
+    }
+
+    // Save the entire tree to one packed binary file (see PackFile.h)
+    bool savePack(const string& path) {
+        flushHashes();
+        PackWriter pack;
+        if (!pack.open(path, Hasher::name())) {
+            cerr << "Error: Unable to create pack file " << path << endl;
+            return false;
+        }
+        uint32_t rootIndex = writePackNode(pack, root);
+        if (!pack.finish(rootIndex)) {
+            cerr << "Error: Failed writing pack file " << path << endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Replaces the tree with the one stored in a pack file. Hashes are taken from the file,
+    // not recomputed; records come children-first, so every child exists before its parent.
+    bool loadPack(const string& path) {
+        PackReader pack;
+        if (!pack.open(path)) return false;
+        if (pack.hashMethod() != Hasher::name()) {
+            cerr << "Error: " << path << " was written with " << pack.hashMethod() << ", not " << Hasher::name() << endl;
+            return false;
+        }
+
+        // Every record but the root must be the child of exactly one later record, the stored
+        // heights must match and be AVL-balanced, and the keys must strictly increase in order.
+        // That makes the file a real AVL tree, so every walk over it stays O(log n) deep and
+        // later inserts and removes find their keys whatever the file contains.
+        vector<AVLNode*> loaded(pack.nodeCount());
+        vector<bool> hasParent(pack.nodeCount(), false);
+        auto validChild = [&](uint32_t child, uint64_t parent) {
+            return child == PACK_NO_NODE || (child < parent && !hasParent[child]);
+        };
+        string error;
+        for (uint64_t i = 0; i < pack.nodeCount() && error.empty(); i++) {
+            PackRecord record = pack.record(i);
+            if (!validChild(record.left, i) || !validChild(record.right, i) || (record.left == record.right && record.left != PACK_NO_NODE) ||
+                !pack.keyInBounds(record)) {
+                error = "a corrupt node " + to_string(i);
+                break;
+            }
+            AVLNode* node = nodes.create(string(pack.key(record)));
+            node->hashValue = record.hash;
+            node->left = record.left == PACK_NO_NODE ? nullptr : loaded[record.left];
+            node->right = record.right == PACK_NO_NODE ? nullptr : loaded[record.right];
+            if (record.left != PACK_NO_NODE) hasParent[record.left] = true;
+            if (record.right != PACK_NO_NODE) hasParent[record.right] = true;
+            updateHeight(node);
+            loaded[i] = node;
+            if (node->height != record.height || getBalance(node) > 1 || getBalance(node) < -1) {
+                error = "an unbalanced node " + to_string(i);
+            }
+        }
+        for (uint64_t i = 0; i < pack.nodeCount() && error.empty(); i++) {
+            if (hasParent[i] == (i == pack.rootIndex())) {
+                error = "a node outside the tree " + to_string(i);
+            }
+        }
+        if (error.empty() && !pack.keysInOrder()) {
+            error = "keys out of order";
+        }
+        if (!error.empty()) {
+            cerr << "Error: " << path << " has " << error << endl;
+            for (AVLNode* node : loaded) {
+                if (node) nodes.destroy(node);
+            }
+            return false;
+        }
+        destroySubtree(root);
+        root = loaded.empty() ? nullptr : loaded[pack.rootIndex()];
+        return true;
+    }
+
+    // Search for a key
+    bool contains(string_view key) const {
+        AVLNode* node = root;
+        while (node) {
+            if (key == node->key) return true;
+            node = key < node->key ? node->left : node->right;
+        }
+        return false;
+    }
+
+    // Forward in-order iterator. It holds the path to the current node instead of using
+    // recursion, so a scan can be stopped and resumed; any insert or remove invalidates it.
+    class Iterator {
+    private:
+        friend class AVLTree;
+        vector<const AVLNode*> stack; // current node on top, then the ancestors still to visit
+
+        void pushLeftSpine(const AVLNode* node) {
+            while (node) {
+                stack.push_back(node);
+                node = node->left;
+            }
+        }
+
+        // Positions on the first key >= key. Only the nodes where the search turns left are
+        // still to be visited, so they are exactly the stack an in-order walk would hold.
+        void seek(const AVLNode* node, string_view key) {
+            while (node) {
+                if (key <= node->key) {
+                    stack.push_back(node);
+                    node = node->left;
+                }
+                else {
+                    node = node->right;
+                }
+            }
+        }
+
+    public:
+        Iterator() {}
+
+        explicit Iterator(const AVLNode* root) {
+            pushLeftSpine(root);
+        }
+
+        const string& operator*() const {
+            return stack.back()->key;
+        }
+
+        const string* operator->() const {
+            return &stack.back()->key;
+        }
+
+        // Merkle hash of the current node's subtree
+        const HashDigest& hash() const {
+            return stack.back()->hashValue;
+        }
+
+        Iterator& operator++() {
+            const AVLNode* node = stack.back();
+            stack.pop_back();
+            pushLeftSpine(node->right);
+            return *this;
+        }
+
+        bool operator==(const Iterator& other) const {
+            if (stack.empty() || other.stack.empty()) return stack.empty() == other.stack.empty();
+            return stack.back() == other.stack.back();
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return !(*this == other);
+        }
+    };
+
+    Iterator begin() const {
+        return Iterator(root);
+    }
+
+    Iterator end() const {
+        return Iterator();
+    }
+
+    // Calls fn(key) for every key in order
+    template <typename Fn>
+    void forEachKey(Fn fn) const {
+        for (Iterator it = begin(); it != end(); ++it) {
+            fn(string_view(*it));
+        }
+    }
+
+    // Iterator at the first key >= key, or end()
+    Iterator lowerBound(string_view key) const {
+        Iterator it;
+        it.seek(root, key);
+        return it;
+    }
+
+    // Keys in [low, high), streamed in order
+    KeyRange<Iterator, string> range(string_view low, string_view high) const {
+        return KeyRange<Iterator, string>(lowerBound(low), end(), string(high), true);
+    }
+
+    // Keys beginning with start, streamed in order
+    KeyRange<Iterator, string> prefix(string_view start) const {
+        string upper;
+        bool bounded = prefixUpperBound(start, upper);
+        return KeyRange<Iterator, string>(lowerBound(start), end(), move(upper), bounded);
+    }
+
+    // Get the hash of the root node (Merkle Root Hash), formatted by the hasher
+    string getRootHash() {
+        return Hasher::toString(getRootDigest());
+    }
+
+    HashDigest getRootDigest() {
+        flushHashes();
+        return root ? root->hashValue : HashDigest();
+    }
+
+    Hasher& getHasher() {
+        return hasher;
+    }
+
+    // Hashes computed and bytes hashed so far; divide by getInsertCount() for per-insert cost
+    const HashStats& getHashStats() const {
+        return hasher.getStats();
+    }
+
+    uint64_t getInsertCount() const {
+        return insertCount;
+    }
+
+    uint64_t getRotationCount() const {
+        return rotationCount;
+    }
+
+    size_t getNodeCount() const {
+        return nodes.size();
+    }
+};
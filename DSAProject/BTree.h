@@ -0,0 +1,576 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "Hash.h"
+#include "Instrumentation.h"
+#include "PackFile.h"
+#include "NodeArena.h"
+using namespace std;
+
+// B+-tree node. Keys and their 8-byte prefixes are kept in parallel arrays: a search inside
+// the node binary-searches the dense prefix array (8 per cache line) and only reads a full
+// key when two prefixes are equal.
+struct BTreeNode {
+    bool leaf;
+    bool dirty;                  // hashValue is stale; if set, so is every ancestor's
+    uint32_t page;               // page number, only meaningful while saving
+    vector<uint64_t> prefixes;   // first 8 bytes of each key, big-endian
+    vector<string> keys;         // leaves: the keys; internal nodes: separators
+    vector<BTreeNode*> children; // internal nodes: keys.size() + 1 children
+    BTreeNode* next;             // leaves: the next leaf in key order
+    HashDigest hashValue;
+
+    BTreeNode(bool isLeaf) : leaf(isLeaf), dirty(true), page(0), next(nullptr), hashValue() {}
+};
+
+// On-disk layout: page 0 holds the file header, then one node per 4 KiB page in post-order
+// (children before parents). A node too big for one page spans several consecutive pages.
+const uint32_t BTREE_PAGE_SIZE = 4096;
+const int BTREE_DEFAULT_ORDER = 64;
+
+struct BTreeFileHeader {
+    char magic[8];        // "GLBTREE"
+    uint32_t version;
+    uint32_t pageSize;
+    uint32_t order;
+    uint32_t rootPage;    // 0 if the tree is empty
+    uint32_t firstLeaf;
+    uint32_t pageCount;
+    uint64_t keyCount;
+    uint32_t height;
+    uint32_t reserved;
+    char hashMethod[16];
+    HashDigest rootHash;
+};
+static_assert(sizeof(BTreeFileHeader) == 96, "B-tree file header must stay 96 bytes");
+
+// Followed by, for internal nodes, count + 1 child page numbers (uint32), then count keys,
+// each as a uint16 length and its bytes
+struct BTreePageHeader {
+    uint8_t type;      // BTREE_LEAF_PAGE or BTREE_INTERNAL_PAGE
+    uint8_t reserved;
+    uint16_t count;    // keys in the node
+    uint32_t span;     // pages used by the node
+    uint32_t next;     // leaves: page of the next leaf, 0 for the last one
+    uint32_t reserved2;
+    HashDigest hash;
+};
+static_assert(sizeof(BTreePageHeader) == 48, "B-tree page header must stay 48 bytes");
+
+const uint8_t BTREE_LEAF_PAGE = 1;
+const uint8_t BTREE_INTERNAL_PAGE = 2;
+
+inline uint64_t btreeKeyPrefix(string_view key) {
+    uint64_t prefix = 0;
+    size_t length = key.size() < 8 ? key.size() : 8;
+    for (size_t i = 0; i < length; i++) {
+        prefix |= static_cast<uint64_t>(static_cast<unsigned char>(key[i])) << (56 - 8 * i);
+    }
+    return prefix;
+}
+
+// B+-tree of unique string keys. Every key lives in a leaf and the leaves are linked in key
+// order; internal nodes only hold separators (the smallest key of the child to the right).
+// order is the most children an internal node may have and the most keys a leaf may hold
+// is order - 1.
+//
+// Each node has a Merkle hash over its keys and, for internal nodes, its children's hashes.
+// Inserts only mark the touched path dirty; hashes are brought up to date in flushHashes(),
+// which getRootHash and savePages call, since rehashing nodes of up to order keys on every
+// insert would cost far more than for a binary tree.
+template <typename Hasher = InstructorHash, typename Allocator = NodeArena<BTreeNode>>
+class BTree {
+public:
+    typedef Hasher HasherType;
+
+private:
+    BTreeNode* root = nullptr;
+    Allocator nodes;
+    Hasher hasher;
+    int order;
+    uint64_t keyCount = 0;
+    string message; // reused buffer for serializing a node before hashing it
+
+    // Leaves hash 0x02 || keys; internal nodes hash 0x03 || child hashes and separators.
+    // Keys are length-prefixed so different key lists never give the same message.
+    static void appendKey(string& out, string_view key) {
+        uint32_t length = static_cast<uint32_t>(key.size());
+        out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        out.append(key.data(), key.size());
+    }
+
+    int compareAt(const BTreeNode* node, size_t i, string_view key, uint64_t prefix) const {
+        if (prefix != node->prefixes[i]) {
+            return prefix < node->prefixes[i] ? -1 : 1;
+        }
+        return key.compare(node->keys[i]);
+    }
+
+    // Number of keys in node that are <= key; for internal nodes, the child to descend into
+    size_t upperBound(const BTreeNode* node, string_view key, uint64_t prefix) const {
+        size_t lo = 0, hi = node->keys.size();
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (compareAt(node, mid, key, prefix) < 0) hi = mid;
+            else lo = mid + 1;
+        }
+        return lo;
+    }
+
+    // Moves keys [from, end) of node to the end of target
+    static void moveKeys(BTreeNode* node, size_t from, BTreeNode* target) {
+        for (size_t i = from; i < node->keys.size(); i++) {
+            target->keys.push_back(move(node->keys[i]));
+            target->prefixes.push_back(node->prefixes[i]);
+        }
+        node->keys.resize(from);
+        node->prefixes.resize(from);
+    }
+
+    // Returns false for a duplicate. When node overflows it is split in two: the new right
+    // node and the separator to insert into the parent come back through split and promoted.
+    bool insertInto(BTreeNode* node, string_view key, uint64_t prefix, string& promoted, BTreeNode*& split) {
+        size_t i = upperBound(node, key, prefix);
+        if (node->leaf) {
+            if (i > 0 && node->keys[i - 1] == key) return false; // Duplicate keys are not allowed
+            node->keys.insert(node->keys.begin() + i, string(key));
+            node->prefixes.insert(node->prefixes.begin() + i, prefix);
+            node->dirty = true;
+            if (node->keys.size() > static_cast<size_t>(order - 1)) {
+                BTreeNode* right = nodes.create(true);
+                moveKeys(node, node->keys.size() / 2, right);
+                right->next = node->next;
+                node->next = right;
+                promoted = right->keys[0];
+                split = right;
+            }
+            return true;
+        }
+
+        string childPromoted;
+        BTreeNode* childSplit = nullptr;
+        if (!insertInto(node->children[i], key, prefix, childPromoted, childSplit)) return false;
+        node->dirty = true;
+        if (childSplit) {
+            node->prefixes.insert(node->prefixes.begin() + i, btreeKeyPrefix(childPromoted));
+            node->keys.insert(node->keys.begin() + i, move(childPromoted));
+            node->children.insert(node->children.begin() + i + 1, childSplit);
+            if (node->children.size() > static_cast<size_t>(order)) {
+                // The middle separator moves up; the keys right of it go to the new node
+                size_t middle = node->keys.size() / 2;
+                BTreeNode* right = nodes.create(false);
+                promoted = move(node->keys[middle]);
+                moveKeys(node, middle + 1, right);
+                node->keys.pop_back();
+                node->prefixes.pop_back();
+                right->children.assign(node->children.begin() + middle + 1, node->children.end());
+                node->children.resize(middle + 1);
+                split = right;
+            }
+        }
+        return true;
+    }
+
+    void rehashDirty(BTreeNode* node) {
+        if (!node || !node->dirty) return;
+
+        message.clear();
+        if (node->leaf) {
+            message.push_back('\x02');
+            for (const string& key : node->keys) {
+                appendKey(message, key);
+            }
+        }
+        else {
+            for (BTreeNode* child : node->children) {
+                rehashDirty(child);
+            }
+            message.clear();
+            message.push_back('\x03');
+            for (size_t i = 0; i < node->children.size(); i++) {
+                message.append(reinterpret_cast<const char*>(node->children[i]->hashValue.data()), 32);
+                if (i < node->keys.size()) appendKey(message, node->keys[i]);
+            }
+        }
+        hasher.hashMessage(message, node->hashValue);
+        node->dirty = false;
+    }
+
+    void destroySubtree(BTreeNode* node) {
+        if (!node) return;
+        for (BTreeNode* child : node->children) {
+            destroySubtree(child);
+        }
+        nodes.destroy(node);
+    }
+
+    // Bytes a node takes on disk, header included
+    static size_t serializedSize(const BTreeNode* node) {
+        size_t size = sizeof(BTreePageHeader) + node->children.size() * sizeof(uint32_t);
+        for (const string& key : node->keys) {
+            size += sizeof(uint16_t) + key.size();
+        }
+        return size;
+    }
+
+    // First pass of savePages: numbers the pages in post-order. Returns false if a key is
+    // too long for the page format.
+    bool assignPages(BTreeNode* node, uint32_t& nextPage) {
+        for (BTreeNode* child : node->children) {
+            if (!assignPages(child, nextPage)) return false;
+        }
+        for (const string& key : node->keys) {
+            if (key.size() > UINT16_MAX) return false;
+        }
+        node->page = nextPage;
+        nextPage += static_cast<uint32_t>((serializedSize(node) + BTREE_PAGE_SIZE - 1) / BTREE_PAGE_SIZE);
+        return true;
+    }
+
+    // Second pass: writes the nodes in the same order, each padded to whole pages
+    void writePages(BufferedFileWriter& out, BTreeNode* node, vector<char>& page) {
+        for (BTreeNode* child : node->children) {
+            writePages(out, child, page);
+        }
+        size_t size = serializedSize(node);
+        size_t span = (size + BTREE_PAGE_SIZE - 1) / BTREE_PAGE_SIZE;
+        page.assign(span * BTREE_PAGE_SIZE, 0);
+
+        BTreePageHeader header;
+        memset(&header, 0, sizeof(header));
+        header.type = node->leaf ? BTREE_LEAF_PAGE : BTREE_INTERNAL_PAGE;
+        header.count = static_cast<uint16_t>(node->keys.size());
+        header.span = static_cast<uint32_t>(span);
+        header.next = node->leaf && node->next ? node->next->page : 0;
+        header.hash = node->hashValue;
+        memcpy(page.data(), &header, sizeof(header));
+
+        char* cursor = page.data() + sizeof(header);
+        for (BTreeNode* child : node->children) {
+            memcpy(cursor, &child->page, sizeof(uint32_t));
+            cursor += sizeof(uint32_t);
+        }
+        for (const string& key : node->keys) {
+            uint16_t length = static_cast<uint16_t>(key.size());
+            memcpy(cursor, &length, sizeof(length));
+            memcpy(cursor + sizeof(length), key.data(), key.size());
+            cursor += sizeof(length) + key.size();
+        }
+        out.write(page.data(), page.size());
+    }
+
+public:
+    // order 0 picks the default
+    explicit BTree(int treeOrder = 0) : order(treeOrder == 0 ? BTREE_DEFAULT_ORDER : treeOrder) {
+        if (order < 3) order = 3;
+        if (order > 4096) order = 4096;
+    }
+
+    ~BTree() {
+        clear();
+    }
+
+    // The tree owns its nodes
+    BTree(const BTree&) = delete;
+    BTree& operator=(const BTree&) = delete;
+
+    void clear() {
+        destroySubtree(root);
+        nodes.release();
+        root = nullptr;
+        keyCount = 0;
+    }
+
+    int getOrder() const {
+        return order;
+    }
+
+    // Insert a key; returns false if it was already present
+    bool insert(string_view key) {
+        if (!root) {
+            root = nodes.create(true);
+        }
+        string promoted;
+        BTreeNode* split = nullptr;
+        if (!insertInto(root, key, btreeKeyPrefix(key), promoted, split)) return false;
+        if (split) {
+            BTreeNode* newRoot = nodes.create(false);
+            newRoot->prefixes.push_back(btreeKeyPrefix(promoted));
+            newRoot->keys.push_back(move(promoted));
+            newRoot->children.push_back(root);
+            newRoot->children.push_back(split);
+            root = newRoot;
+        }
+        keyCount++;
+        return true;
+    }
+
+    // Bulk load: replaces the tree with one built from sorted, duplicate-free keys in O(n).
+    // Nodes are filled evenly level by level, so every node is at least half full.
+    void buildFromSorted(vector<string>&& keys) {
+        clear();
+        if (keys.empty()) return;
+
+        size_t leafCapacity = static_cast<size_t>(order - 1);
+        size_t leafCount = (keys.size() + leafCapacity - 1) / leafCapacity;
+        vector<BTreeNode*> level;
+        vector<string> minKeys; // smallest key under each node of the level
+        size_t start = 0;
+        BTreeNode* previous = nullptr;
+        for (size_t l = 0; l < leafCount; l++) {
+            size_t end = keys.size() * (l + 1) / leafCount;
+            BTreeNode* leaf = nodes.create(true);
+            leaf->keys.reserve(end - start);
+            leaf->prefixes.reserve(end - start);
+            minKeys.push_back(keys[start]);
+            for (size_t i = start; i < end; i++) {
+                leaf->prefixes.push_back(btreeKeyPrefix(keys[i]));
+                leaf->keys.push_back(move(keys[i]));
+            }
+            if (previous) previous->next = leaf;
+            previous = leaf;
+            level.push_back(leaf);
+            start = end;
+        }
+        keyCount = keys.size();
+        keys.clear();
+
+        while (level.size() > 1) {
+            size_t parentCount = (level.size() + order - 1) / order;
+            vector<BTreeNode*> parents;
+            vector<string> parentMinKeys;
+            start = 0;
+            for (size_t p = 0; p < parentCount; p++) {
+                size_t end = level.size() * (p + 1) / parentCount;
+                BTreeNode* parent = nodes.create(false);
+                parentMinKeys.push_back(minKeys[start]);
+                for (size_t i = start; i < end; i++) {
+                    if (i > start) {
+                        parent->prefixes.push_back(btreeKeyPrefix(minKeys[i]));
+                        parent->keys.push_back(minKeys[i]);
+                    }
+                    parent->children.push_back(level[i]);
+                }
+                parents.push_back(parent);
+                start = end;
+            }
+            level.swap(parents);
+            minKeys.swap(parentMinKeys);
+        }
+        root = level[0];
+        flushHashes();
+    }
+
+    bool contains(string_view key) const {
+        const BTreeNode* node = root;
+        if (!node) return false;
+        uint64_t prefix = btreeKeyPrefix(key);
+        while (!node->leaf) {
+            node = node->children[upperBound(node, key, prefix)];
+        }
+        size_t i = upperBound(node, key, prefix);
+        return i > 0 && node->keys[i - 1] == key;
+    }
+
+    // Calls fn(key) for every key >= from in order, until fn returns false; walks the leaf chain
+    template <typename Fn>
+    void scanFrom(string_view from, Fn fn) const {
+        const BTreeNode* node = root;
+        if (!node) return;
+        uint64_t prefix = btreeKeyPrefix(from);
+        while (!node->leaf) {
+            node = node->children[upperBound(node, from, prefix)];
+        }
+        size_t i = upperBound(node, from, prefix);
+        if (i > 0 && node->keys[i - 1] == from) i--;
+        for (; node; node = node->next, i = 0) {
+            for (; i < node->keys.size(); i++) {
+                if (!fn(string_view(node->keys[i]))) return;
+            }
+        }
+    }
+
+    // Calls fn(key) for every key in order
+    template <typename Fn>
+    void forEachKey(Fn fn) const {
+        scanFrom(string_view(), [&](string_view key) {
+            fn(key);
+            return true;
+        });
+    }
+
+    void flushHashes() {
+        if (!root || !root->dirty) return;
+        Stopwatch timer;
+        rehashDirty(root);
+        hasher.addBatchTime(timer.nanoseconds());
+    }
+
+    string getRootHash() {
+        return Hasher::toString(getRootDigest());
+    }
+
+    HashDigest getRootDigest() {
+        flushHashes();
+        return root ? root->hashValue : HashDigest();
+    }
+
+    const HashStats& getHashStats() const {
+        return hasher.getStats();
+    }
+
+    uint64_t size() const {
+        return keyCount;
+    }
+
+    int height() const {
+        int levels = 0;
+        for (const BTreeNode* node = root; node; node = node->leaf ? nullptr : node->children[0]) {
+            levels++;
+        }
+        return levels;
+    }
+
+    // Saves the tree as 4 KiB pages (see BTreeFileHeader), searchable with BTreePageFile
+    bool savePages(const string& path) {
+        flushHashes();
+        uint32_t pageCount = 1;
+        if (root && !assignPages(root, pageCount)) {
+            cerr << "Error: A key is too long for the B-tree page format" << endl;
+            return false;
+        }
+
+        BufferedFileWriter out;
+        if (!out.open(path)) {
+            cerr << "Error: Unable to create B-tree file " << path << endl;
+            return false;
+        }
+        vector<char> page(BTREE_PAGE_SIZE, 0);
+        BTreeFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "GLBTREE", 8);
+        header.version = 1;
+        header.pageSize = BTREE_PAGE_SIZE;
+        header.order = static_cast<uint32_t>(order);
+        header.rootPage = root ? root->page : 0;
+        const BTreeNode* first = root;
+        while (first && !first->leaf) first = first->children[0];
+        header.firstLeaf = first ? first->page : 0;
+        header.pageCount = pageCount;
+        header.keyCount = keyCount;
+        header.height = static_cast<uint32_t>(height());
+        string hashName = Hasher::name();
+        memcpy(header.hashMethod, hashName.data(), min(hashName.size(), sizeof(header.hashMethod) - 1));
+        header.rootHash = root ? root->hashValue : HashDigest();
+        memcpy(page.data(), &header, sizeof(header));
+        out.write(page.data(), page.size());
+
+        if (root) writePages(out, root, page);
+        if (!out.close()) {
+            cerr << "Error: Failed writing B-tree file " << path << endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+// Searches a saved B-tree by reading only the pages on the path from the root to a leaf,
+// so a lookup costs height() page reads
+class BTreePageFile {
+private:
+    ifstream file;
+    BTreeFileHeader header;
+    vector<char> page;
+    uint64_t pagesRead = 0;
+
+    // Reads the node at pageNumber into page; false if it is malformed
+    bool readNode(uint32_t pageNumber, BTreePageHeader& node) {
+        if (pageNumber == 0 || pageNumber >= header.pageCount) return false;
+        page.resize(BTREE_PAGE_SIZE);
+        file.seekg(static_cast<streamoff>(pageNumber) * BTREE_PAGE_SIZE);
+        file.read(page.data(), BTREE_PAGE_SIZE);
+        memcpy(&node, page.data(), sizeof(node));
+        if (node.span == 0 || pageNumber + node.span > header.pageCount) return false;
+        if (node.span > 1) {
+            page.resize(static_cast<size_t>(node.span) * BTREE_PAGE_SIZE);
+            file.read(page.data() + BTREE_PAGE_SIZE, static_cast<streamsize>(page.size() - BTREE_PAGE_SIZE));
+        }
+        pagesRead += node.span;
+        return static_cast<bool>(file);
+    }
+
+public:
+    bool open(const string& path) {
+        file.close();
+        file.clear();
+        file.open(path, ios::binary);
+        if (!file) {
+            cerr << "Error: Unable to open B-tree file " << path << endl;
+            return false;
+        }
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!file || memcmp(header.magic, "GLBTREE", 8) != 0 || header.version != 1 || header.pageSize != BTREE_PAGE_SIZE) {
+            cerr << "Error: " << path << " is not a B-tree file" << endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool contains(string_view key) {
+        uint32_t pageNumber = header.rootPage;
+        if (pageNumber == 0) return false;
+        vector<string_view> keys;
+        for (uint32_t depth = 0; depth < header.height; depth++) {
+            BTreePageHeader node;
+            if (!readNode(pageNumber, node)) {
+                cerr << "Error: Corrupt B-tree page " << pageNumber << endl;
+                return false;
+            }
+            size_t children = node.type == BTREE_INTERNAL_PAGE ? node.count + 1u : 0u;
+            const char* cursor = page.data() + sizeof(node) + children * sizeof(uint32_t);
+            const char* end = page.data() + page.size();
+            keys.clear();
+            for (uint16_t i = 0; i < node.count; i++) {
+                uint16_t length;
+                if (cursor + sizeof(length) > end) return false;
+                memcpy(&length, cursor, sizeof(length));
+                if (cursor + sizeof(length) + length > end) return false;
+                keys.push_back(string_view(cursor + sizeof(length), length));
+                cursor += sizeof(length) + length;
+            }
+            size_t i = upper_bound(keys.begin(), keys.end(), key) - keys.begin();
+            if (node.type == BTREE_LEAF_PAGE) {
+                return i > 0 && keys[i - 1] == key;
+            }
+            memcpy(&pageNumber, page.data() + sizeof(node) + i * sizeof(uint32_t), sizeof(pageNumber));
+        }
+        return false;
+    }
+
+    uint64_t keyCount() const {
+        return header.keyCount;
+    }
+
+    uint32_t height() const {
+        return header.height;
+    }
+
+    HashDigest rootHash() const {
+        return header.rootHash;
+    }
+
+    string hashMethod() const {
+        return string(header.hashMethod, strnlen(header.hashMethod, sizeof(header.hashMethod)));
+    }
+
+    // Pages read by lookups so far
+    uint64_t getPagesRead() const {
+        return pagesRead;
+    }
+};
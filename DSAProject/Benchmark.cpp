@@ -0,0 +1,2059 @@
+// Benchmarks for the GitLite hot paths. Not part of the normal build; on Linux, "make bench"
+// or:
+//   g++ -std=c++17 -O2 -pthread -DGITLITE_BENCHMARK Benchmark.cpp -o gitlite_bench
+//   ./gitlite_bench <csv|scaling|bulkload|hash|alloc|batch|pack|mmap|arena|compact|rbtree|btree|traverse|range|commit|diff|persist|objects|rows|vector|pipeline|snapshot|columns> [rows]
+//   ./gitlite_bench suite [rows] [columns] [sorted|random|skewed|duplicate] [seed] > results.json
+#ifdef GITLITE_BENCHMARK
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <new>
+#include <filesystem>
+#include <cmath>
+#include <algorithm>
+#include "CSVReader.h"
+#include "ParallelLoader.h"
+#include "AVLtree.h"
+#include "RBtree.h"
+#include "MappedTree.h"
+#include "CompactTree.h"
+#include "BTree.h"
+#include "CommitDelta.h"
+#include "MerkleDiff.h"
+#include "PersistentTree.h"
+#include "SnapshotTree.h"
+#include "ObjectStore.h"
+#include "RowStore.h"
+#include "InitPipeline.h"
+#include "Myvector.h"
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+static volatile uint64_t sink; // keeps the optimizer from dropping the measured work
+
+// Every heap allocation in the process goes through here so benchmarks can count them. The
+// count is atomic since pool and snapshot threads allocate too; relaxed, as only the total
+// is read. (GCC can't see that new and delete below are a malloc/free pair and warns.)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+static atomic<uint64_t> allocationCount(0);
+
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void printThroughput(const string& label, uint64_t rows, uint64_t bytes, double seconds) {
+    printf("  %-28s %8.3f s  %12.0f rows/s  %8.1f MB/s\n", label.c_str(), seconds,
+        rows / seconds, bytes / seconds / (1024.0 * 1024.0));
+}
+
+// Writes a CSV with an id column, a few plain columns and a quoted comment column
+static uint64_t generateCSV(const string& path, uint64_t rows) {
+    ofstream out(path, ios::binary);
+    out << "id,name,city,amount,comment\r\n";
+    const char* cities[] = { "Lahore", "Karachi", "Islamabad", "Peshawar", "Quetta" };
+    unsigned long long state = 88172645463325252ULL;
+    for (uint64_t i = 0; i < rows; i++) {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        out << i << ",user" << (state % 100000) << ',' << cities[state % 5] << ','
+            << (state % 10000) << '.' << (state % 100) << ",\"note, " << (state % 1000) << "\"\r\n";
+    }
+    return static_cast<uint64_t>(out.tellp());
+}
+
+// The getline + splitLine path GitLite used before CSVReader
+static vector<string> splitLine(const string& line) {
+    vector<string> result;
+    size_t start = 0, end = 0;
+    while ((end = line.find(',', start)) != string::npos) {
+        result.push_back(line.substr(start, end - start));
+        start = end + 1;
+    }
+    result.push_back(line.substr(start));
+    return result;
+}
+
+static void benchCSV(uint64_t rows) {
+    const string path = "bench_input.csv";
+    const size_t column = 2;
+    cout << "Generating " << rows << " rows into " << path << "..." << endl;
+    uint64_t bytes = generateCSV(path, rows);
+
+    {
+        auto start = chrono::steady_clock::now();
+        ifstream file(path);
+        string line;
+        uint64_t checksum = 0, count = 0;
+        getline(file, line);
+        while (getline(file, line)) {
+            vector<string> row = splitLine(line);
+            if (column < row.size()) {
+                checksum += row[column].size();
+                count++;
+            }
+        }
+        printThroughput("getline + splitLine", count, bytes, secondsSince(start));
+        sink = checksum;
+    }
+
+    {
+        auto start = chrono::steady_clock::now();
+        CSVReader reader;
+        vector<string> header;
+        reader.open(path);
+        reader.readHeader(header);
+        uint64_t checksum = 0, count = 0;
+        reader.forEachField(column, [&](string_view field) {
+            checksum += field.size();
+            count++;
+        });
+        printThroughput("CSVReader (string_view)", count, bytes, secondsSince(start));
+        sink = checksum;
+    }
+
+    remove(path.c_str());
+}
+
+// Parallel column extraction + sort + merge for 1, 2, 4, ... threads up to the core count
+static void benchScaling(uint64_t rows) {
+    const string path = "bench_input.csv";
+    const size_t column = 0;
+    cout << "Generating " << rows << " rows into " << path << "..." << endl;
+    uint64_t bytes = generateCSV(path, rows);
+
+    CSVReader reader;
+    vector<string> header;
+    reader.open(path);
+    reader.readHeader(header);
+    uint64_t dataBegin = reader.position();
+
+    size_t cores = thread::hardware_concurrency();
+    if (cores == 0) cores = 1;
+
+    double baseline = 0;
+    for (size_t threads = 1; ; threads *= 2) {
+        if (threads > cores) threads = cores;
+
+        auto start = chrono::steady_clock::now();
+        ThreadPool pool(threads);
+        vector<string> keys = loadSortedColumn(path, dataBegin, column, pool);
+        double seconds = secondsSince(start);
+        if (threads == 1) baseline = seconds;
+
+        printThroughput(to_string(threads) + " thread(s)", keys.size(), bytes, seconds);
+        printf("  %-28s speedup %.2fx\n", "", baseline / seconds);
+
+        if (threads == cores) break;
+    }
+
+    remove(path.c_str());
+}
+
+// Returns whether two files hold the same bytes
+static bool sameFileBytes(const string& first, const string& second) {
+    ifstream a(first, ios::binary), b(second, ios::binary);
+    string textA((istreambuf_iterator<char>(a)), istreambuf_iterator<char>());
+    string textB((istreambuf_iterator<char>(b)), istreambuf_iterator<char>());
+    return a.good() == b.good() && textA == textB;
+}
+
+// Quoted fields holding line breaks: the parallel loader must cut its chunks at the same row
+// boundaries as the sequential reader, so both give byte-identical pack and row files
+static void checkMultilineRows(uint64_t rows) {
+    const string path = "bench_multiline.csv";
+    const size_t column = 1; // note, a quoted field with a line break in it
+    {
+        ofstream out(path, ios::binary);
+        out << "id,note\n";
+        char row[64];
+        for (uint64_t i = 0; i < rows; i++) {
+            snprintf(row, sizeof(row), "k%07llu,\"line one\nline two %llu\"\n",
+                static_cast<unsigned long long>(i), static_cast<unsigned long long>(i));
+            out << row;
+        }
+    }
+
+    CSVReader reader;
+    vector<string> header;
+    reader.open(path);
+    reader.readHeader(header);
+    uint64_t dataBegin = reader.position();
+
+    vector<string> keys;
+    reader.forEachField(column, [&](string_view key) {
+        keys.emplace_back(key);
+    });
+    prepareSortedKeys(keys);
+    size_t sequentialKeys = keys.size();
+    AVLTree<Sha256Hasher> sequential;
+    sequential.buildFromSorted(move(keys));
+    sequential.savePack("bench_multiline_1.pack");
+    RowStoreWriter sequentialWriter;
+    writeCSVRows(path, "bench_multiline_1.rows", column, sequentialWriter);
+
+    ThreadPool pool(4);
+    RowSorter sorter("bench_multiline_4.rows");
+    keys = loadSortedColumn(path, dataBegin, column, pool, 4, &sorter);
+    size_t parallelKeys = keys.size();
+    AVLTree<Sha256Hasher> parallel;
+    parallel.buildFromSorted(move(keys));
+    parallel.savePack("bench_multiline_4.pack");
+    RowStoreWriter parallelWriter;
+    sorter.write(header, "bench_multiline_4.rows", column, parallelWriter);
+
+    bool same = sameFileBytes("bench_multiline_1.pack", "bench_multiline_4.pack") &&
+        sameFileBytes("bench_multiline_1.rows", "bench_multiline_4.rows");
+    printf("  %-28s %zu keys sequential, %zu with 4 threads: pack and rows %s\n", "multi-line quoted fields",
+        sequentialKeys, parallelKeys, same ? "identical" : "DIFFER");
+
+    remove(path.c_str());
+    remove("bench_multiline_1.pack");
+    remove("bench_multiline_4.pack");
+    remove("bench_multiline_1.rows");
+    remove("bench_multiline_4.rows");
+}
+
+// Generates n distinct zero-padded ID keys, in sorted order
+static vector<string> makeSortedKeys(uint64_t n) {
+    vector<string> keys;
+    keys.reserve(n);
+    char text[32];
+    for (uint64_t i = 0; i < n; i++) {
+        snprintf(text, sizeof(text), "%012llu", static_cast<unsigned long long>(i * 7));
+        keys.push_back(text);
+    }
+    return keys;
+}
+
+// Incremental AVLTree::insert versus bottom-up buildFromSorted on the same sorted keys
+static void benchBulkLoad(uint64_t n) {
+    cout << n << " sorted keys:" << endl;
+    {
+        vector<string> keys = makeSortedKeys(n);
+        AVLTree<> tree;
+        auto start = chrono::steady_clock::now();
+        for (const string& key : keys) {
+            tree.insert(key);
+        }
+        double seconds = secondsSince(start);
+        printf("  %-28s %8.3f s  %12.0f keys/s  root hash %s\n", "incremental insert", seconds, n / seconds, tree.getRootHash().c_str());
+    }
+    {
+        vector<string> keys = makeSortedKeys(n);
+        AVLTree<> tree;
+        auto start = chrono::steady_clock::now();
+        prepareSortedKeys(keys); // already sorted, so only the check is paid
+        tree.buildFromSorted(move(keys));
+        double seconds = secondsSince(start);
+        printf("  %-28s %8.3f s  %12.0f keys/s  root hash %s\n", "buildFromSorted", seconds, n / seconds, tree.getRootHash().c_str());
+    }
+}
+
+// Internal-node Merkle hashes (two child digests + a 12-byte key) per hasher and SHA-256 backend,
+// one at a time through hashNode and in batches through hashNodes
+template <typename Hasher>
+static void benchHasher(const string& label, Hasher& hasher, uint64_t n) {
+    vector<string> keys = makeSortedKeys(1024);
+    vector<HashDigest> digests(1024);
+    for (size_t i = 0; i < digests.size(); i++) {
+        hasher.hashNode(keys[i], nullptr, nullptr, digests[i]);
+    }
+
+    auto start = chrono::steady_clock::now();
+    HashDigest out;
+    for (uint64_t i = 0; i < n; i++) {
+        size_t slot = i & 1023;
+        hasher.hashNode(keys[slot], &digests[slot], &digests[(slot + 1) & 1023], out);
+        digests[slot][0] ^= out[0];
+    }
+    double single = secondsSince(start);
+
+    vector<HashDigest> outs(1024);
+    vector<HashInput> batch(1024);
+    for (size_t i = 0; i < batch.size(); i++) {
+        batch[i] = { keys[i], &digests[i], &digests[(i + 1) & 1023], &outs[i] };
+    }
+    start = chrono::steady_clock::now();
+    for (uint64_t done = 0; done < n; done += batch.size()) {
+        hasher.hashNodes(batch.data(), batch.size());
+    }
+    double batched = secondsSince(start);
+
+    printf("  %-28s %12.0f hashes/s single  %12.0f hashes/s batched\n", label.c_str(), n / single, n / batched);
+    sink = out[0] + outs[0][0];
+}
+
+static void benchHash(uint64_t n) {
+    cout << n << " internal-node hashes:" << endl;
+    InstructorHash instructor;
+    benchHasher("Instructor Hash", instructor, n);
+
+    Sha256::Backend backends[] = { Sha256::PORTABLE, Sha256::SHA_NI, Sha256::AVX2 };
+    for (Sha256::Backend backend : backends) {
+        if (!Sha256::supports(backend)) {
+            printf("  %-28s not supported on this CPU\n", (string("SHA-256 ") + Sha256::backendName(backend)).c_str());
+            continue;
+        }
+        Sha256Hasher sha;
+        sha.setBackend(backend);
+        benchHasher(string("SHA-256 ") + Sha256::backendName(backend), sha, n);
+    }
+}
+
+// The Instructor Hash node combine as it was before hashing moved to digests:
+// two to_string calls and a concatenation for every internal node
+class LegacyInstructorHash {
+private:
+    InstructorHash hasher;
+    HashStats stats;
+
+public:
+    static const char* name() { return "Instructor Hash (string combine)"; }
+    static string toString(const HashDigest& digest) { return InstructorHash::toString(digest); }
+    const HashStats& getStats() const { return stats; }
+
+    void hashNode(string_view key, const HashDigest* left, const HashDigest* right, HashDigest& out) {
+        int value;
+        if (!left && !right) {
+            string ownedKey(key);
+            value = hasher.computeHash(ownedKey);
+            stats.bytesHashed += ownedKey.size();
+        }
+        else {
+            string combined = (left ? to_string(InstructorHash::digestValue(*left)) : "") +
+                (right ? to_string(InstructorHash::digestValue(*right)) : "");
+            value = hasher.computeHash(combined);
+            stats.bytesHashed += combined.size();
+        }
+        stats.hashesComputed++;
+        out.fill(0);
+        memcpy(out.data(), &value, sizeof(value));
+    }
+
+    void hashNodes(const HashInput* inputs, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            hashNode(inputs[i].key, inputs[i].left, inputs[i].right, *inputs[i].out);
+        }
+    }
+};
+
+// Heap allocations, hashes and hashed bytes per AVLTree::insert for each node-combine strategy.
+// Keys are 20+ characters so the key copy itself is one visible allocation per insert.
+template <typename Hasher>
+static void benchInsertAllocations(uint64_t n) {
+    vector<string> keys;
+    char text[48];
+    for (uint64_t i = 0; i < n; i++) {
+        snprintf(text, sizeof(text), "customer-%016llu", static_cast<unsigned long long>((i * 2654435761ULL) % 1000000007ULL));
+        keys.push_back(text);
+    }
+
+    AVLTree<Hasher> tree;
+    uint64_t allocationsBefore = allocationCount.load(memory_order_relaxed);
+    auto start = chrono::steady_clock::now();
+    for (const string& key : keys) {
+        tree.insert(key);
+    }
+    double seconds = secondsSince(start);
+    uint64_t allocations = allocationCount.load(memory_order_relaxed) - allocationsBefore;
+
+    const HashStats& stats = tree.getHashStats();
+    printf("  %-34s %6.2f allocs/insert  %6.2f hashes/insert  %7.1f bytes hashed/insert  %10.0f inserts/s\n",
+        Hasher::name(), double(allocations) / n, double(stats.hashesComputed) / tree.getInsertCount(),
+        double(stats.bytesHashed) / tree.getInsertCount(), n / seconds);
+}
+
+static void benchAllocations(uint64_t n) {
+    cout << n << " random inserts:" << endl;
+    benchInsertAllocations<LegacyInstructorHash>(n);
+    benchInsertAllocations<InstructorHash>(n);
+    benchInsertAllocations<Sha256Hasher>(n);
+}
+
+// Batch commits on top of an existing tree: each commit inserts 'batchSize' random keys and
+// then reads the root hash, with eager hashing versus deferred dirty-path hashing
+template <typename Hasher>
+static void benchBatchCommit(uint64_t baseKeys, uint64_t batchSize, uint64_t commits, bool deferred) {
+    AVLTree<Hasher> tree;
+    tree.buildFromSorted(makeSortedKeys(baseKeys));
+    tree.setDeferredHashing(deferred);
+    uint64_t hashesBefore = tree.getHashStats().hashesComputed;
+
+    unsigned long long state = 0x9E3779B97F4A7C15ULL;
+    char text[32];
+    auto start = chrono::steady_clock::now();
+    for (uint64_t c = 0; c < commits; c++) {
+        for (uint64_t i = 0; i < batchSize; i++) {
+            state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+            snprintf(text, sizeof(text), "%012llu", state % (baseKeys * 7 + 1));
+            tree.insert(text);
+        }
+        sink = tree.getRootDigest()[0];
+    }
+    double seconds = secondsSince(start);
+
+    uint64_t hashes = tree.getHashStats().hashesComputed - hashesBefore;
+    printf("  %-10s %-8s batch %7llu  %8.1f ms/commit  %10.1f hashes/commit\n", Hasher::name(),
+        deferred ? "deferred" : "eager", static_cast<unsigned long long>(batchSize),
+        seconds * 1000 / commits, double(hashes) / commits);
+}
+
+static void benchBatch(uint64_t baseKeys) {
+    cout << baseKeys << " keys in the tree:" << endl;
+    uint64_t batchSizes[] = { 10, 1000, 100000 };
+    for (uint64_t batchSize : batchSizes) {
+        uint64_t commits = max<uint64_t>(1, 200000 / batchSize);
+        benchBatchCommit<Sha256Hasher>(baseKeys, batchSize, commits, false);
+        benchBatchCommit<Sha256Hasher>(baseKeys, batchSize, commits, true);
+    }
+}
+
+// Bytes on disk under a directory, with each file rounded up to 4 KiB blocks
+static void directoryUsage(const string& path, uint64_t& files, uint64_t& bytes, uint64_t& blockBytes) {
+    files = bytes = blockBytes = 0;
+    for (const filesystem::directory_entry& entry : filesystem::directory_iterator(path)) {
+        uint64_t size = entry.file_size();
+        files++;
+        bytes += size;
+        blockBytes += (size + 4095) / 4096 * 4096;
+    }
+}
+
+// One .txt file per node (saveToFiles) versus a single pack file (savePack / loadPack)
+static void benchPack(uint64_t n) {
+    cout << n << " keys:" << endl;
+    const string directory = "bench_pack";
+    filesystem::remove_all(directory);
+    filesystem::create_directory(directory);
+    filesystem::path previous = filesystem::current_path();
+    filesystem::current_path(directory);
+
+    AVLTree<Sha256Hasher> tree;
+    tree.buildFromSorted(makeSortedKeys(n));
+    uint64_t files, bytes, blockBytes;
+
+    {
+        filesystem::create_directory("nodes");
+        filesystem::current_path("nodes");
+        auto start = chrono::steady_clock::now();
+        tree.saveToFiles();
+        double saveSeconds = secondsSince(start);
+        filesystem::current_path("..");
+
+        // Loading the per-file layout means opening and reading every node file again
+        start = chrono::steady_clock::now();
+        uint64_t lines = 0;
+        string line;
+        for (const filesystem::directory_entry& entry : filesystem::directory_iterator("nodes")) {
+            ifstream file(entry.path());
+            while (getline(file, line)) lines++;
+        }
+        double loadSeconds = secondsSince(start);
+        sink = lines;
+
+        directoryUsage("nodes", files, bytes, blockBytes);
+        printf("  %-14s save %8.3f s  load %8.3f s  %9llu files  %12llu bytes  %12llu bytes in 4K blocks\n", "per-node .txt",
+            saveSeconds, loadSeconds, (unsigned long long)files, (unsigned long long)bytes, (unsigned long long)blockBytes);
+    }
+
+    {
+        filesystem::create_directory("pack");
+        auto start = chrono::steady_clock::now();
+        tree.savePack("pack/repository.pack");
+        double saveSeconds = secondsSince(start);
+
+        AVLTree<Sha256Hasher> loaded;
+        start = chrono::steady_clock::now();
+        loaded.loadPack("pack/repository.pack");
+        double loadSeconds = secondsSince(start);
+        if (loaded.getRootDigest() != tree.getRootDigest()) {
+            cout << "  pack round trip changed the root hash!" << endl;
+        }
+
+        directoryUsage("pack", files, bytes, blockBytes);
+        printf("  %-14s save %8.3f s  load %8.3f s  %9llu files  %12llu bytes  %12llu bytes in 4K blocks\n", "pack file",
+            saveSeconds, loadSeconds, (unsigned long long)files, (unsigned long long)bytes, (unsigned long long)blockBytes);
+    }
+
+    filesystem::current_path(previous);
+    filesystem::remove_all(directory);
+}
+
+// Asks the kernel to drop a file's cached pages so the next reads come from disk
+static bool evictFromPageCache(const string& path) {
+#ifdef __linux__
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) return false;
+    fdatasync(descriptor);
+    bool dropped = posix_fadvise(descriptor, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(descriptor);
+    return dropped;
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+// Average time of a MappedTree::find over a fixed set of keys, half present and half missing
+static double lookupMicros(const MappedTree& tree, const vector<string>& probes) {
+    uint64_t found = 0;
+    auto start = chrono::steady_clock::now();
+    for (const string& key : probes) {
+        found += tree.contains(key);
+    }
+    double seconds = secondsSince(start);
+    sink = found;
+    return seconds * 1e6 / probes.size();
+}
+
+// Opening a pack by mapping it (MappedTree) versus reading it into nodes (loadPack),
+// then cold and warm lookups straight from the mapping
+static void benchMapped(uint64_t n) {
+    cout << n << " keys:" << endl;
+    const string avlPack = "bench_mmap_avl.pack";
+    const string rbPack = "bench_mmap_rb.pack";
+
+    {
+        AVLTree<Sha256Hasher> tree;
+        tree.buildFromSorted(makeSortedKeys(n));
+        tree.savePack(avlPack);
+    }
+
+    AVLTree<Sha256Hasher> loaded;
+    auto start = chrono::steady_clock::now();
+    loaded.loadPack(avlPack);
+    double loadSeconds = secondsSince(start);
+
+    MappedTree mapped;
+    start = chrono::steady_clock::now();
+    mapped.open(avlPack);
+    double mapSeconds = secondsSince(start);
+    if (mapped.rootHash() != loaded.getRootDigest()) {
+        cout << "  mapped root hash differs from loadPack!" << endl;
+    }
+    printf("  %-28s %10.3f ms\n", "open with loadPack", loadSeconds * 1e3);
+    printf("  %-28s %10.3f ms\n", "open with MappedTree", mapSeconds * 1e3);
+
+    // makeSortedKeys uses multiples of 7, so odd offsets are misses
+    vector<string> probes;
+    unsigned long long state = 88172645463325252ULL;
+    char buffer[32];
+    for (int i = 0; i < 100000; i++) {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        snprintf(buffer, sizeof(buffer), "%012llu", (state % n) * 7 + (i & 1));
+        probes.push_back(buffer);
+    }
+
+    mapped.close();
+    bool cold = evictFromPageCache(avlPack);
+    mapped.open(avlPack);
+    printf("  %-28s %10.3f us/lookup%s\n", "cold lookup (first 1000)", lookupMicros(mapped, vector<string>(probes.begin(), probes.begin() + 1000)),
+        cold ? "" : "  (page cache not evicted)");
+    lookupMicros(mapped, probes);
+    printf("  %-28s %10.3f us/lookup\n", "warm lookup", lookupMicros(mapped, probes));
+
+    {
+        RBTree<> tree;
+        for (uint64_t i = 0; i < n; i++) {
+            tree.insertValue(static_cast<int>(i * 7));
+        }
+        tree.savePack(rbPack);
+    }
+    MappedTree rb;
+    rb.open(rbPack);
+    vector<string> intProbes;
+    for (const string& key : probes) {
+        intProbes.push_back(packIntKey(atoi(key.c_str())));
+    }
+    lookupMicros(rb, intProbes);
+    printf("  %-28s %10.3f us/lookup\n", "warm lookup (RB int keys)", lookupMicros(rb, intProbes));
+
+    mapped.close();
+    rb.close();
+    remove(avlPack.c_str());
+    remove(rbPack.c_str());
+}
+
+// Resident set size of this process in KiB (Linux only; 0 elsewhere)
+static uint64_t residentKiB() {
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0) {
+            return strtoull(line.c_str() + 6, nullptr, 10);
+        }
+    }
+    return 0;
+}
+
+static void printArenaResult(const string& label, uint64_t n, double seconds, uint64_t allocations, uint64_t rssKiB, double freeSeconds) {
+    printf("  %-30s %12.0f nodes/s  %6.2f allocs/node  %8.1f MB RSS  free %8.3f s\n", label.c_str(), n / seconds,
+        double(allocations) / n, rssKiB / 1024.0, freeSeconds);
+}
+
+template <typename Allocator>
+static void benchAVLArena(const string& label, uint64_t n) {
+    vector<string> keys = makeSortedKeys(n);
+    uint64_t rssBefore = residentKiB();
+    uint64_t allocationsBefore = allocationCount.load(memory_order_relaxed);
+    auto* tree = new AVLTree<InstructorHash, Allocator>();
+    tree->setDeferredHashing(true); // measure node allocation, not hashing
+    auto start = chrono::steady_clock::now();
+    for (const string& key : keys) {
+        tree->insert(key);
+    }
+    double seconds = secondsSince(start);
+    uint64_t allocations = allocationCount.load(memory_order_relaxed) - allocationsBefore;
+    uint64_t rss = residentKiB();
+    rss = rss > rssBefore ? rss - rssBefore : 0;
+    start = chrono::steady_clock::now();
+    delete tree;
+    printArenaResult(label, n, seconds, allocations, rss, secondsSince(start));
+}
+
+template <typename Allocator>
+static void benchRBArena(const string& label, uint64_t n) {
+    uint64_t rssBefore = residentKiB();
+    uint64_t allocationsBefore = allocationCount.load(memory_order_relaxed);
+    auto* tree = new RBTree<int, InstructorHash, Allocator>();
+    tree->setDeferredHashing(true); // measure node allocation, not hashing
+    auto start = chrono::steady_clock::now();
+    unsigned long long state = 88172645463325252ULL;
+    for (uint64_t i = 0; i < n; i++) {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        tree->insertValue(static_cast<int>(state));
+    }
+    double seconds = secondsSince(start);
+    uint64_t allocations = allocationCount.load(memory_order_relaxed) - allocationsBefore;
+    uint64_t rss = residentKiB();
+    rss = rss > rssBefore ? rss - rssBefore : 0;
+    start = chrono::steady_clock::now();
+    delete tree;
+    printArenaResult(label, n, seconds, allocations, rss, secondsSince(start));
+}
+
+// Node arena versus one global new per node. Freed heap memory is kept by the C library, so
+// for exact RSS figures run one variant per process: arena [keys] <arena|heap>.
+static void benchArena(uint64_t n, const string& variant) {
+    cout << n << " inserts:" << endl;
+    if (variant != "heap") {
+        benchAVLArena<NodeArena<AVLNode>>("AVL (sorted keys), arena", n);
+        benchRBArena<NodeArena<RBNode<int>>>("RB (random ints), arena", n);
+    }
+    if (variant != "arena") {
+        benchAVLArena<HeapNodeAllocator<AVLNode>>("AVL (sorted keys), new", n);
+        benchRBArena<HeapNodeAllocator<RBNode<int>>>("RB (random ints), new", n);
+    }
+}
+
+// Bytes currently allocated on the heap (glibc), falling back to RSS elsewhere
+static uint64_t heapInUse() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd; // small blocks + large mmapped ones
+#else
+    return residentKiB() * 1024;
+#endif
+}
+
+template <typename Tree>
+static double searchMicros(const Tree& tree, const vector<string>& probes) {
+    uint64_t found = 0;
+    auto start = chrono::steady_clock::now();
+    for (const string& key : probes) {
+        found += tree.contains(key);
+    }
+    double seconds = secondsSince(start);
+    sink = found;
+    return seconds * 1e6 / probes.size();
+}
+
+// Pointer-based AVLTree versus the index-based CompactTree: heap bytes per key (hashes
+// included) and random search latency, with short keys (fit the inline prefix) and long ones
+static void benchCompactKeys(const string& label, const vector<string>& keys) {
+    uint64_t n = keys.size();
+    vector<string> probes;
+    unsigned long long state = 88172645463325252ULL;
+    for (int i = 0; i < 1000000; i++) {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        probes.push_back(keys[state % n]);
+        if (i & 1) probes.back() += '!'; // half the probes miss
+    }
+    cout << label << ":" << endl;
+
+    {
+        uint64_t before = heapInUse();
+        AVLTree<Sha256Hasher> tree;
+        tree.setDeferredHashing(true);
+        for (const string& key : keys) {
+            tree.insert(key);
+        }
+        tree.flushHashes();
+        double bytes = double(heapInUse() - before);
+        searchMicros(tree, probes);
+        printf("  %-24s %7.1f bytes/key  %7.3f us/search\n", "AVLTree (pointers)", bytes / n, searchMicros(tree, probes));
+    }
+    {
+        uint64_t before = heapInUse();
+        CompactTree<Sha256Hasher> tree;
+        for (const string& key : keys) {
+            tree.insert(key);
+        }
+        tree.flushHashes();
+        double bytes = double(heapInUse() - before);
+        searchMicros(tree, probes);
+        printf("  %-24s %7.1f bytes/key  %7.3f us/search\n", "CompactTree (indices)", bytes / n, searchMicros(tree, probes));
+    }
+}
+
+// About n distinct 8-digit keys in random order
+static vector<string> makeRandomKeys(uint64_t n) {
+    vector<string> keys;
+    unsigned long long state = 0x9E3779B97F4A7C15ULL;
+    char text[48];
+    for (uint64_t i = 0; i < n; i++) {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        snprintf(text, sizeof(text), "%08llu", state % 100000000ULL);
+        keys.push_back(text);
+    }
+    prepareSortedKeys(keys);
+    for (uint64_t i = keys.size(); i > 1; i--) {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        swap(keys[i - 1], keys[state % i]);
+    }
+    return keys;
+}
+
+static void benchCompact(uint64_t n) {
+    cout << n << " keys, random insert order" << endl;
+    vector<string> keys = makeRandomKeys(n);
+    benchCompactKeys("8-byte keys", keys);
+    for (string& key : keys) {
+        key = "customer-" + key + "-account";
+    }
+    benchCompactKeys("25-byte keys", keys);
+}
+
+// Reads one column of a CSV in file order
+static vector<string> readColumn(const string& path, size_t column) {
+    CSVReader reader;
+    vector<string> header, keys;
+    reader.open(path);
+    reader.readHeader(header);
+    reader.forEachField(column, [&](string_view key) {
+        keys.emplace_back(key);
+    });
+    return keys;
+}
+
+// Insert every key, search every key, then delete every other key, hashing eagerly
+template <typename Tree>
+static void benchTreeOps(const string& label, const vector<string>& keys) {
+    Tree tree;
+    auto start = chrono::steady_clock::now();
+    for (const string& key : keys) {
+        tree.insert(key);
+    }
+    double insertSeconds = secondsSince(start);
+    uint64_t insertHashes = tree.getHashStats().hashesComputed;
+
+    start = chrono::steady_clock::now();
+    uint64_t found = 0;
+    for (const string& key : keys) {
+        found += tree.contains(key);
+    }
+    double searchSeconds = secondsSince(start);
+    sink = found;
+
+    start = chrono::steady_clock::now();
+    uint64_t removed = 0;
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        removed += tree.remove(keys[i]);
+    }
+    double removeSeconds = secondsSince(start);
+
+    uint64_t n = keys.size();
+    printf("  %-6s insert %10.0f/s (%5.2f hashes each)  search %10.0f/s  delete %10.0f/s\n", label.c_str(),
+        n / insertSeconds, double(insertHashes) / n, n / searchSeconds, (n + 1) / 2 / removeSeconds);
+    sink = removed;
+}
+
+// Adapts RBTree's insertValue to the same insert(key) call as AVLTree
+template <typename Hasher>
+struct RBStringTree : RBTree<string, Hasher> {
+    void insert(const string& key) {
+        this->insertValue(key);
+    }
+};
+
+// AVLTree versus RBTree on the same CSV columns: sorted ids and random, repeating names
+static void benchRBTree(uint64_t rows) {
+    const string path = "bench_rbtree.csv";
+    generateCSV(path, rows);
+    const size_t columns[] = { 0, 1 };
+    const char* names[] = { "id (sorted)", "name (random, repeats)" };
+    for (int c = 0; c < 2; c++) {
+        vector<string> keys = readColumn(path, columns[c]);
+        cout << rows << " rows, column " << names[c] << ", SHA-256:" << endl;
+        benchTreeOps<AVLTree<Sha256Hasher>>("AVL", keys);
+        benchTreeOps<RBStringTree<Sha256Hasher>>("RB", keys);
+    }
+    remove(path.c_str());
+}
+
+// Insert (hashes brought up to date once at the end), random lookups and a full ordered scan
+template <typename Tree>
+static void benchTreeLookupScan(const string& label, Tree& tree, const vector<string>& keys, const vector<string>& probes) {
+    auto start = chrono::steady_clock::now();
+    for (const string& key : keys) {
+        tree.insert(key);
+    }
+    tree.getRootDigest();
+    double insertSeconds = secondsSince(start);
+
+    searchMicros(tree, probes);
+    double lookup = searchMicros(tree, probes);
+
+    start = chrono::steady_clock::now();
+    uint64_t bytes = 0;
+    tree.forEachKey([&](const string_view& key) {
+        bytes += key.size();
+    });
+    double scanSeconds = secondsSince(start);
+    sink = bytes;
+
+    printf("  %-16s insert %10.0f/s  lookup %7.3f us  scan %8.1f M keys/s\n", label.c_str(),
+        keys.size() / insertSeconds, lookup, keys.size() / scanSeconds / 1e6);
+}
+
+// Distinct 4 KiB pages of a mapped pack touched by the root-to-leaf path of a lookup
+static uint64_t packPagesTouched(const MappedTree& tree, string_view key) {
+    uint64_t pages = 0, lastPage = UINT64_MAX;
+    uint32_t index = tree.rootIndex();
+    for (int depth = 0; index != PACK_NO_NODE && depth < 128; depth++) {
+        uint64_t page = uint64_t(index) * sizeof(PackRecord) / 4096;
+        if (page != lastPage) pages++;
+        lastPage = page;
+        const PackRecord& record = tree.record(index);
+        int order = key.compare(tree.key(index));
+        if (order == 0) break;
+        index = order < 0 ? record.left : record.right;
+    }
+    return pages;
+}
+
+// BTree at a few orders versus AVLTree and RBTree in memory, then page reads per lookup on disk
+static void benchBTree(uint64_t n) {
+    vector<string> keys = makeRandomKeys(n);
+    vector<string> probes(keys.begin(), keys.begin() + min<size_t>(keys.size(), 1000000));
+    cout << keys.size() << " keys, random insert order, SHA-256:" << endl;
+    {
+        AVLTree<Sha256Hasher> tree;
+        tree.setDeferredHashing(true);
+        benchTreeLookupScan("AVLTree", tree, keys, probes);
+        tree.savePack("bench_btree.pack");
+    }
+    {
+        RBStringTree<Sha256Hasher> tree;
+        tree.setDeferredHashing(true);
+        benchTreeLookupScan("RBTree", tree, keys, probes);
+    }
+    for (int order : { 16, 64, 256 }) {
+        BTree<Sha256Hasher> tree(order);
+        benchTreeLookupScan("BTree order " + to_string(order), tree, keys, probes);
+        if (order == BTREE_DEFAULT_ORDER) tree.savePages("bench_btree.pages");
+    }
+
+    cout << "On disk, per lookup:" << endl;
+    BTreePageFile pages;
+    pages.open("bench_btree.pages");
+    MappedTree pack;
+    pack.open("bench_btree.pack");
+    const size_t lookups = 10000;
+    uint64_t packPages = 0;
+    for (size_t i = 0; i < lookups; i++) {
+        pages.contains(probes[i % probes.size()]);
+        packPages += packPagesTouched(pack, probes[i % probes.size()]);
+    }
+    printf("  %-16s %6.2f 4K pages\n", "AVL pack", double(packPages) / lookups);
+    printf("  %-16s %6.2f 4K pages (height %u)\n", "BTree pages", double(pages.getPagesRead()) / lookups, pages.height());
+    pack.close();
+    remove("bench_btree.pack");
+    remove("bench_btree.pages");
+}
+
+// Full in-order scans: forEachKey, and an iterator that is parked every 1000 keys and resumed
+template <typename Tree>
+static void benchTraversal(const string& label, Tree& tree, uint64_t n) {
+    uint64_t bytes = 0;
+    auto start = chrono::steady_clock::now();
+    tree.forEachKey([&](const string_view& key) {
+        bytes += key.size();
+    });
+    double scanSeconds = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    auto it = tree.begin();
+    while (it != tree.end()) {
+        for (int i = 0; i < 1000 && it != tree.end(); i++, ++it) {
+            bytes += it->size();
+        }
+        auto parked = it; // a paused scan is just a saved iterator
+        it = parked;
+    }
+    double resumedSeconds = secondsSince(start);
+    sink = bytes;
+
+    printf("  %-8s forEachKey %8.1f M keys/s  resumable iterator %8.1f M keys/s\n", label.c_str(),
+        n / scanSeconds / 1e6, n / resumedSeconds / 1e6);
+}
+
+static void benchTraverse(uint64_t n) {
+    vector<string> keys = makeRandomKeys(n);
+    cout << keys.size() << " keys:" << endl;
+
+    AVLTree<Sha256Hasher> avl;
+    avl.setDeferredHashing(true);
+    auto start = chrono::steady_clock::now();
+    for (const string& key : keys) {
+        avl.insert(key);
+    }
+    double insertSeconds = secondsSince(start);
+    printf("  %-8s insert %10.0f/s\n", "AVL", keys.size() / insertSeconds);
+    benchTraversal("AVL", avl, keys.size());
+
+    RBTree<string, Sha256Hasher> rb;
+    rb.setDeferredHashing(true);
+    for (const string& key : keys) {
+        rb.insertValue(key);
+    }
+    benchTraversal("RB", rb, keys.size());
+}
+
+// Range scans of about n * selectivity keys each, from a random start key
+template <typename Tree>
+static void benchRangeScans(const string& label, const Tree& tree, const vector<string>& sorted) {
+    unsigned long long state = 0x2545F4914F6CDD1DULL;
+    auto nextRandom = [&state]() {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        return state;
+    };
+    for (double selectivity : { 0.000001, 0.0001, 0.01, 0.1, 1.0 }) {
+        size_t width = max<size_t>(1, size_t(sorted.size() * selectivity));
+        size_t queries = max<size_t>(10, min<size_t>(100000, 20000000 / width));
+        uint64_t returned = 0, bytes = 0;
+        auto start = chrono::steady_clock::now();
+        for (size_t q = 0; q < queries; q++) {
+            size_t first = nextRandom() % (sorted.size() - width + 1);
+            const string& low = sorted[first];
+            const string high = first + width < sorted.size() ? sorted[first + width] : string("~");
+            for (const string& key : tree.range(low, high)) {
+                bytes += key.size();
+                returned++;
+            }
+        }
+        double seconds = secondsSince(start);
+        sink = bytes;
+        printf("  %-4s %9.4f%%  %8zu keys/query  %10.2f us/query  %8.1f M keys/s\n", label.c_str(),
+            selectivity * 100, width, seconds / queries * 1e6, returned / seconds / 1e6);
+    }
+
+    // Prefix scans over the digit keys: each extra digit narrows the slice about 10x
+    for (size_t length = 7; length >= 3; length -= 2) {
+        const size_t queries = 1000;
+        uint64_t returned = 0;
+        auto start = chrono::steady_clock::now();
+        for (size_t q = 0; q < queries; q++) {
+            const string& key = sorted[nextRandom() % sorted.size()];
+            auto keys = tree.prefix(string_view(key).substr(0, length));
+            for (; keys.valid(); keys.next()) {
+                returned++;
+            }
+        }
+        double seconds = secondsSince(start);
+        sink = returned;
+        printf("  %-4s prefix of %zu digits  %8.0f keys/query  %10.2f us/query\n", label.c_str(),
+            length, double(returned) / queries, seconds / queries * 1e6);
+    }
+}
+
+// range()/prefix() against the only option before them: a full scan that filters keys
+static void benchRange(uint64_t n) {
+    vector<string> keys = makeRandomKeys(n);
+    vector<string> sorted = keys;
+    sort(sorted.begin(), sorted.end());
+    cout << keys.size() << " keys, random insert order:" << endl;
+
+    AVLTree<Sha256Hasher> avl;
+    avl.setDeferredHashing(true);
+    for (const string& key : keys) {
+        avl.insert(key);
+    }
+    RBTree<string, Sha256Hasher> rb;
+    rb.setDeferredHashing(true);
+    for (const string& key : keys) {
+        rb.insertValue(key);
+    }
+
+    const string& low = sorted[sorted.size() / 2];
+    const string& high = sorted[sorted.size() / 2 + 1];
+    uint64_t matched = 0;
+    auto start = chrono::steady_clock::now();
+    avl.forEachKey([&](const string_view& key) {
+        if (key >= low && key < high) matched++;
+    });
+    double filterSeconds = secondsSince(start);
+    sink = matched;
+    printf("  AVL  full scan + filter          %10.2f us/query (any selectivity)\n", filterSeconds * 1e6);
+
+    benchRangeScans("AVL", avl, sorted);
+    benchRangeScans("RB", rb, sorted);
+}
+
+// One commit on a tree built from base: diff against the new revision, apply the delta,
+// and for comparison rebuild the whole tree from the new revision
+template <typename Tree>
+static void benchCommitTree(const string& label, const vector<string>& base, const vector<string>& revision) {
+    Tree tree;
+    tree.buildFromSorted(vector<string>(base));
+
+    uint64_t hashesBefore = tree.getHashStats().hashesComputed;
+    auto start = chrono::steady_clock::now();
+    KeyDelta delta = diffKeys(tree, revision);
+    double diffSeconds = secondsSince(start);
+    start = chrono::steady_clock::now();
+    applyDelta(tree, delta);
+    double applySeconds = secondsSince(start);
+    uint64_t hashes = tree.getHashStats().hashesComputed - hashesBefore;
+
+    Tree rebuilt;
+    start = chrono::steady_clock::now();
+    rebuilt.buildFromSorted(vector<string>(revision));
+    double rebuildSeconds = secondsSince(start);
+
+    printf("  %-4s %8zu changes  diff %8.1f ms  apply %8.1f ms (%9llu hashes)  full rebuild %8.1f ms\n",
+        label.c_str(), delta.size(), diffSeconds * 1e3, applySeconds * 1e3, (unsigned long long)hashes, rebuildSeconds * 1e3);
+}
+
+// Commits at 0.1%, 1% and 10% churn: half of the changed keys are removed, half are new
+static void benchCommit(uint64_t n) {
+    vector<string> base = makeRandomKeys(n);
+    prepareSortedKeys(base);
+    cout << base.size() << " keys, SHA-256:" << endl;
+
+    for (double churn : { 0.001, 0.01, 0.1 }) {
+        uint64_t changes = uint64_t(base.size() * churn);
+        uint64_t step = base.size() / (changes / 2 + 1);
+        vector<string> revision;
+        revision.reserve(base.size() + changes);
+        uint64_t removed = 0;
+        for (uint64_t i = 0; i < base.size(); i++) {
+            if (i % step == step / 2 && removed < changes / 2) {
+                removed++;
+                continue;
+            }
+            revision.push_back(base[i]);
+        }
+        char text[32];
+        for (uint64_t i = 0; i < changes - removed; i++) {
+            snprintf(text, sizeof(text), "%09llu", (unsigned long long)(i * 7919 % 1000000000ULL)); // 9 digits: never in base
+            revision.push_back(text);
+        }
+        prepareSortedKeys(revision);
+
+        cout << churn * 100 << "% churn:" << endl;
+        benchCommitTree<AVLTree<Sha256Hasher>>("AVL", base, revision);
+        benchCommitTree<RBTree<string, Sha256Hasher>>("RB", base, revision);
+    }
+}
+
+// Two commits of one tree at a given churn, diffed through the Merkle hashes and by merging
+template <typename Tree>
+static void benchDiffTree(const string& label, const vector<string>& base, double churn) {
+    Tree tree;
+    tree.buildFromSorted(vector<string>(base));
+    tree.savePack("bench_diff_a.pack");
+
+    vector<string> revision;
+    uint64_t changes = max<uint64_t>(1, uint64_t(base.size() * churn));
+    uint64_t step = base.size() / changes;
+    for (uint64_t i = 0; i < base.size(); i++) {
+        if (i % step != step / 2) revision.push_back(base[i]);
+    }
+    char text[32];
+    for (uint64_t i = 0; i < changes / 2; i++) {
+        snprintf(text, sizeof(text), "%09llu", (unsigned long long)(i * 7919 % 1000000000ULL));
+        revision.push_back(text);
+    }
+    prepareSortedKeys(revision);
+    applyDelta(tree, diffKeys(tree, revision));
+    tree.savePack("bench_diff_b.pack");
+
+    MappedTree from, to;
+    from.open("bench_diff_a.pack");
+    to.open("bench_diff_b.pack");
+    KeyDelta merged;
+    DiffStats mergeStats;
+    mergeDiffPacks(from, to, merged, mergeStats); // fault both files in
+
+    KeyDelta merkle;
+    DiffStats stats;
+    auto start = chrono::steady_clock::now();
+    diffPacks(from, to, merkle, stats);
+    double merkleSeconds = secondsSince(start);
+
+    merged = KeyDelta();
+    start = chrono::steady_clock::now();
+    mergeDiffPacks(from, to, merged, mergeStats);
+    double mergeSeconds = secondsSince(start);
+
+    printf("  %-4s %8.3f%%  %7zu changes  Merkle %9.3f ms (%9llu reads)  merge %9.3f ms  %s\n", label.c_str(),
+        churn * 100, merkle.size(), merkleSeconds * 1e3, (unsigned long long)stats.nodesVisited, mergeSeconds * 1e3,
+        merkle.removed == merged.removed && merkle.added == merged.added ? "" : "MISMATCH");
+    from.close();
+    to.close();
+    remove("bench_diff_a.pack");
+    remove("bench_diff_b.pack");
+}
+
+// diffPacks against a full sorted merge of two commits, at growing amounts of change
+static void benchDiff(uint64_t n) {
+    vector<string> base = makeRandomKeys(n);
+    prepareSortedKeys(base);
+    cout << base.size() << " keys, SHA-256:" << endl;
+    for (double churn : { 0.00001, 0.0001, 0.001, 0.01, 0.1 }) {
+        benchDiffTree<AVLTree<Sha256Hasher>>("AVL", base, churn);
+        benchDiffTree<RBTree<string, Sha256Hasher>>("RB", base, churn);
+    }
+}
+
+// Commits of changesPerCommit keys (half removed, half new) on a persistent tree: memory
+// kept per commit, commit time, and the latency of checking out an old commit and reading it
+template <typename Tree, typename FlatTree>
+static void benchPersistentTree(const string& label, const vector<string>& base, uint64_t commits, uint64_t changesPerCommit) {
+    uint64_t heapBefore = heapInUse();
+    Tree tree;
+    tree.buildFromSorted(vector<string>(base));
+    tree.commit();
+    uint64_t baseNodes = tree.nodeCount();
+    uint64_t baseHeap = heapInUse() - heapBefore;
+
+    unsigned long long state = 0x9E3779B97F4A7C15ULL;
+    auto nextRandom = [&state]() {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        return state;
+    };
+    char text[32];
+    uint64_t added = 0;
+    auto start = chrono::steady_clock::now();
+    for (uint64_t c = 0; c < commits; c++) {
+        for (uint64_t i = 0; i < changesPerCommit / 2; i++) {
+            tree.remove(base[nextRandom() % base.size()]);
+            snprintf(text, sizeof(text), "%09llu", (unsigned long long)added++); // 9 digits: never in base
+            tree.insert(text);
+        }
+        tree.commit();
+    }
+    double commitSeconds = secondsSince(start);
+    uint64_t nodesPerCommit = (tree.nodeCount() - baseNodes) / commits;
+    uint64_t heapPerCommit = (heapInUse() - heapBefore - baseHeap) / commits;
+
+    // Checkout of a random commit alone, then with 100 lookups in it, against loading a saved copy
+    const int checkouts = 1000;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < checkouts; i++) {
+        tree.checkout(nextRandom() % (commits + 1));
+    }
+    double bareCheckoutMicros = secondsSince(start) * 1e6 / checkouts;
+    uint64_t found = 0;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < checkouts; i++) {
+        tree.checkout(nextRandom() % (commits + 1));
+        for (int j = 0; j < 100; j++) {
+            found += tree.contains(base[nextRandom() % base.size()]);
+        }
+    }
+    double checkoutMicros = secondsSince(start) * 1e6 / checkouts;
+    sink = found;
+
+    FlatTree flat;
+    flat.buildFromSorted(vector<string>(base));
+    flat.savePack("bench_persist.pack");
+    start = chrono::steady_clock::now();
+    flat.loadPack("bench_persist.pack");
+    double loadMillis = secondsSince(start) * 1e3;
+    remove("bench_persist.pack");
+
+    printf("  %-4s base %6.1f MB  per commit: %6llu nodes %8.1f KB (full copy %6.1f MB) %7.2f ms\n", label.c_str(),
+        baseHeap / 1e6, (unsigned long long)nodesPerCommit, heapPerCommit / 1e3, baseHeap / 1e6, commitSeconds * 1e3 / commits);
+    printf("  %-4s checkout %6.2f us, with 100 lookups %8.1f us   loadPack of one commit %8.1f ms\n", label.c_str(),
+        bareCheckoutMicros, checkoutMicros, loadMillis);
+}
+
+// Path-copying persistent trees: 100 commits of 0.1% churn each on top of n keys
+static void benchPersist(uint64_t n) {
+    vector<string> base = makeRandomKeys(n);
+    prepareSortedKeys(base);
+    const uint64_t commits = 100, changes = max<uint64_t>(2, base.size() / 1000);
+    cout << base.size() << " keys, " << commits << " commits of " << changes << " changes, SHA-256:" << endl;
+    benchPersistentTree<PersistentAVLTree<Sha256Hasher>, AVLTree<Sha256Hasher>>("AVL", base, commits, changes);
+    benchPersistentTree<PersistentRBTree<Sha256Hasher>, RBTree<string, Sha256Hasher>>("RB", base, commits, changes);
+}
+
+// Successive commits with a few changes each, written to the object store against a full pack
+// per commit: bytes and time per commit, and how often the filter let a lookup reach the index.
+// Each commit reopens the store, as a commit --objects run does.
+template <typename Tree>
+static void benchObjectTree(const string& label, const vector<string>& base, uint64_t commits, uint64_t changesPerCommit) {
+    filesystem::remove_all("bench_objects");
+    ObjectStore store;
+    store.open("bench_objects");
+    Tree tree;
+    tree.buildFromSorted(vector<string>(base));
+    ObjectWriteStats first;
+    auto start = chrono::steady_clock::now();
+    store.writeTree(tree, first);
+    double firstMillis = secondsSince(start) * 1e3;
+
+    unsigned long long state = 0x9E3779B97F4A7C15ULL;
+    auto nextRandom = [&state]() {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        return state;
+    };
+    char text[32];
+    uint64_t added = 0;
+    ObjectWriteStats stats;
+    double openSeconds = 0, storeSeconds = 0, packSeconds = 0;
+    uint64_t packBytes = 0;
+    for (uint64_t c = 0; c < commits; c++) {
+        KeyDelta delta;
+        for (uint64_t i = 0; i < changesPerCommit / 2; i++) {
+            delta.removed.push_back(base[nextRandom() % base.size()]);
+            snprintf(text, sizeof(text), "%09llu", (unsigned long long)added++); // 9 digits: never in base
+            delta.added.push_back(text);
+        }
+        applyDelta(tree, delta);
+
+        start = chrono::steady_clock::now();
+        store.open("bench_objects");
+        openSeconds += secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        store.writeTree(tree, stats);
+        storeSeconds += secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        tree.savePack("bench_objects.pack");
+        packSeconds += secondsSince(start);
+        packBytes += filesystem::file_size("bench_objects.pack");
+    }
+    remove("bench_objects.pack");
+    filesystem::remove_all("bench_objects");
+
+    printf("  %-4s first commit %8llu objects %7.1f MB %8.1f ms   filter %5.1f MB for %llu objects\n", label.c_str(),
+        (unsigned long long)first.objectsWritten, first.bytesWritten / 1e6, firstMillis,
+        store.filterBytes() / 1e6, (unsigned long long)store.size());
+    printf("  %-4s per commit: open %6.2f ms, %6llu objects %8.1f KB %7.2f ms   full pack %7.1f MB %8.1f ms   index probes %llu, %llu subtrees shared\n",
+        label.c_str(), openSeconds * 1e3 / commits, (unsigned long long)(stats.objectsWritten / commits), stats.bytesWritten / 1e3 / commits,
+        storeSeconds * 1e3 / commits, packBytes / 1e6 / commits, packSeconds * 1e3 / commits,
+        (unsigned long long)(stats.indexProbes / commits), (unsigned long long)(stats.subtreesShared / commits));
+}
+
+// Content-addressed object store: 50 commits of 0.1% churn each on top of n keys
+static void benchObjects(uint64_t n) {
+    vector<string> base = makeRandomKeys(n);
+    prepareSortedKeys(base);
+    const uint64_t commits = 50, changes = max<uint64_t>(2, base.size() / 1000);
+    cout << base.size() << " keys, " << commits << " commits of " << changes << " changes, SHA-256:" << endl;
+    benchObjectTree<AVLTree<Sha256Hasher>>("AVL", base, commits, changes);
+    benchObjectTree<RBTree<string, Sha256Hasher>>("RB", base, commits, changes);
+}
+
+// Full rows in a row file keyed by one column: size against the CSV, write time, and the
+// latency of fetching a key's rows at random (a block decode each) and in key order
+static void benchRowFile(const string& csvPath, size_t column, const string& label, size_t sortBudget = ROW_SORT_BUDGET) {
+    RowStoreWriter writer;
+    auto start = chrono::steady_clock::now();
+    writeCSVRows(csvPath, "bench.rows", column, writer, sortBudget);
+    double writeSeconds = secondsSince(start);
+
+    RowStore rows;
+    rows.open("bench.rows");
+    vector<string> keys;
+    CSVReader reader;
+    vector<string> header;
+    reader.open(csvPath);
+    reader.readHeader(header);
+    reader.forEachField(column, [&](string_view key) {
+        keys.emplace_back(key);
+    });
+
+    unsigned long long state = 0x9E3779B97F4A7C15ULL;
+    vector<vector<string>> found;
+    uint64_t fetched = 0;
+    const int lookups = 20000;
+    uint64_t decodesBefore = rows.decodeCount();
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < lookups; i++) {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        rows.findRows(keys[state % keys.size()], found);
+        fetched += found.size();
+    }
+    double randomMicros = secondsSince(start) * 1e6 / lookups;
+    double decodesPerLookup = double(rows.decodeCount() - decodesBefore) / lookups;
+
+    prepareSortedKeys(keys);
+    start = chrono::steady_clock::now();
+    size_t ordered = min<size_t>(keys.size(), lookups);
+    uint64_t orderedRows = 0;
+    for (size_t i = 0; i < ordered; i++) {
+        rows.findRows(keys[i], found);
+        orderedRows += found.size();
+    }
+    double orderedMicros = secondsSince(start) * 1e6 / ordered;
+    sink = fetched + orderedRows;
+    remove("bench.rows");
+
+    printf("  %-6s %7.1f MB CSV -> %6.1f MB (%.1fx) in %6.0f ms   fetch: random %6.1f us (%.1f chunk decodes), in key order %5.2f us (%.1f rows per key)\n",
+        label.c_str(), writer.csvBytes() / 1e6, writer.fileBytes() / 1e6, double(writer.csvBytes()) / writer.fileBytes(),
+        writeSeconds * 1e3, randomMicros, decodesPerLookup, orderedMicros, double(orderedRows) / ordered);
+}
+
+static void benchRows(uint64_t rows) {
+    const string path = "bench_rows.csv";
+    generateCSV(path, rows);
+    cout << rows << " rows of id,name,city,amount,comment, 1024 rows per block, keyed by:" << endl;
+    benchRowFile(path, 0, "id");
+    benchRowFile(path, 1, "name");
+    benchRowFile(path, 3, "amount");
+    cout << "keyed by amount, sorted in 4 MiB runs spilled to disk and merged:" << endl;
+    benchRowFile(path, 3, "amount", 4 << 20);
+    remove(path.c_str());
+}
+
+// MyVector before move-aware growth: every resize default-constructs a new array and
+// copy-assigns each element into it
+template <typename T>
+class LegacyVector {
+private:
+    T* data = nullptr;
+    int size = 0;
+    int length = 0;
+
+    void resize(int newSize) {
+        T* newData = new T[newSize];
+        for (int i = 0; i < length; ++i) {
+            newData[i] = data[i];
+        }
+        delete[] data;
+        data = newData;
+        size = newSize;
+    }
+
+public:
+    ~LegacyVector() {
+        delete[] data;
+    }
+
+    void push_back(const T& value) {
+        if (length == size) {
+            resize(size == 0 ? 1 : size * 2);
+        }
+        data[length++] = value;
+    }
+
+    int getSize() const {
+        return length;
+    }
+};
+
+// Adds n strings built from the keys with add(vector, key) and returns strings per second
+template <typename Vector, typename Add>
+static double vectorThroughput(const vector<string>& keys, Add add) {
+    auto start = chrono::steady_clock::now();
+    Vector values;
+    for (const string& key : keys) {
+        add(values, key);
+    }
+    double seconds = secondsSince(start);
+    sink = reinterpret_cast<uintptr_t>(&values);
+    return keys.size() / seconds;
+}
+
+template <typename Vector>
+static void benchVectorType(const string& label, const vector<string>& keys) {
+    double copied = vectorThroughput<Vector>(keys, [](Vector& values, const string& key) {
+        values.push_back(key);
+    });
+    double moved = vectorThroughput<Vector>(keys, [](Vector& values, const string& key) {
+        string value = key;
+        values.push_back(std::move(value));
+    });
+    double emplaced = vectorThroughput<Vector>(keys, [](Vector& values, const string& key) {
+        values.emplace_back(string_view(key));
+    });
+    double reserved = vectorThroughput<Vector>(keys, [&keys](Vector& values, const string& key) {
+        if (values.empty()) values.reserve(keys.size());
+        values.emplace_back(string_view(key));
+    });
+    printf("  %-12s push_back copy %7.1f M/s   push_back move %7.1f M/s   emplace_back %7.1f M/s   reserve+emplace %7.1f M/s\n",
+        label.c_str(), copied / 1e6, moved / 1e6, emplaced / 1e6, reserved / 1e6);
+}
+
+// push_back throughput of std::string elements: short keys fit the string's inline buffer,
+// long ones are heap-allocated, so copying them on growth costs an allocation each
+static void benchVector(uint64_t n) {
+    for (size_t length : { 8, 40 }) {
+        vector<string> keys = makeRandomKeys(n);
+        for (string& key : keys) {
+            key.resize(length, 'x');
+        }
+        cout << keys.size() << " strings of " << length << " bytes:" << endl;
+        benchVectorType<vector<string>>("std::vector", keys);
+        benchVectorType<MyVector<string>>("MyVector", keys);
+        double legacy = vectorThroughput<LegacyVector<string>>(keys, [](LegacyVector<string>& values, const string& key) {
+            values.push_back(key);
+        });
+        printf("  %-12s push_back copy %7.1f M/s\n", "old MyVector", legacy / 1e6);
+    }
+}
+
+// Lookups per second from 1-32 reader threads while one writer keeps changing the tree:
+// lock-free snapshot reads against an RBTree behind a reader-writer lock
+static const double READ_SECONDS = 0.5;
+
+template <typename ReadOne, typename WriteOne>
+static void runReadersWithWriter(const string& label, size_t readerCount, const vector<string>& probes, ReadOne readOne, WriteOne writeOne) {
+    atomic<bool> stop{ false };
+    atomic<uint64_t> totalReads{ 0 };
+    atomic<uint64_t> totalFound{ 0 };
+    vector<thread> readers;
+    for (size_t r = 0; r < readerCount; r++) {
+        readers.emplace_back([&, r] {
+            uint64_t reads = 0, found = 0;
+            size_t at = r * 7919 % probes.size();
+            while (!stop.load(memory_order_relaxed)) {
+                found += readOne(r, probes[at]);
+                at = at + 1 == probes.size() ? 0 : at + 1;
+                reads++;
+            }
+            totalReads += reads;
+            totalFound += found;
+        });
+    }
+    // The writer runs on its own thread, so one that can't get in (a reader-preferring lock
+    // under steady reads) shows up as few writes instead of holding the run open
+    uint64_t writes = 0;
+    auto start = chrono::steady_clock::now();
+    thread writer([&] {
+        while (!stop.load(memory_order_relaxed)) {
+            writeOne(writes++);
+        }
+    });
+    this_thread::sleep_for(chrono::duration<double>(READ_SECONDS));
+    stop = true;
+    for (thread& reader : readers) {
+        reader.join();
+    }
+    writer.join();
+    double seconds = secondsSince(start);
+    sink = totalFound;
+    printf("  %-20s %2zu readers  %12.0f reads/s  %10.0f writes/s\n", label.c_str(), readerCount,
+        totalReads / seconds, writes / seconds);
+}
+
+static void benchSnapshot(uint64_t n) {
+    vector<string> base = makeRandomKeys(n);
+    vector<string> probes(base.begin(), base.begin() + min<size_t>(base.size(), 1000000));
+    prepareSortedKeys(base);
+    const uint64_t changesPerPublish = 64;
+    cout << base.size() << " keys, SHA-256, one writer inserting and removing keys, " << thread::hardware_concurrency()
+        << " cores; snapshots published every " << changesPerPublish << " changes" << endl;
+    auto changedKey = [](uint64_t write) {
+        return "w" + to_string(write % 4096);
+    };
+
+    size_t readerCounts[] = { 1, 2, 4, 8, 16, 32 };
+    for (size_t readerCount : readerCounts) {
+        SnapshotTree<PersistentRBTree<Sha256Hasher>> tree;
+        tree.working().buildFromSorted(vector<string>(base));
+        tree.publish();
+        vector<unique_ptr<SnapshotTree<PersistentRBTree<Sha256Hasher>>::Reader>> handles;
+        for (size_t r = 0; r < readerCount; r++) {
+            handles.push_back(make_unique<SnapshotTree<PersistentRBTree<Sha256Hasher>>::Reader>(tree));
+        }
+        size_t mostPending = 0;
+        runReadersWithWriter("snapshot (RB)", readerCount, probes,
+            [&](size_t r, const string& key) { return handles[r]->contains(key); },
+            [&](uint64_t write) {
+                string key = changedKey(write);
+                if (!tree.working().insert(key)) tree.working().remove(key);
+                if (write % changesPerPublish == changesPerPublish - 1) {
+                    tree.publish();
+                    mostPending = max(mostPending, tree.pendingCount());
+                }
+            });
+        printf("  %-20s %2zu readers  at most %zu replaced snapshots waiting to be freed\n", "", readerCount, mostPending);
+    }
+    for (size_t readerCount : readerCounts) {
+        RBTree<string, Sha256Hasher> tree;
+        tree.buildFromSorted(vector<string>(base));
+        tree.setDeferredHashing(true);
+        shared_mutex lock;
+        runReadersWithWriter("shared_mutex RBTree", readerCount, probes,
+            [&](size_t, const string& key) {
+                shared_lock<shared_mutex> reading(lock);
+                return tree.contains(key);
+            },
+            [&](uint64_t write) {
+                string key = changedKey(write);
+                unique_lock<shared_mutex> writing(lock);
+                if (!tree.insertValue(key)) tree.remove(key);
+                if (write % changesPerPublish == changesPerPublish - 1) tree.flushHashes();
+            });
+    }
+}
+
+// Sequential init (read the key column, build, save the pack, then read the file again for
+// the row file) against the pipeline, with each pipeline stage's share of the wall time
+static void benchPipeline(uint64_t rows) {
+    const string path = "bench_pipeline.csv";
+    uint64_t bytes = generateCSV(path, rows);
+    const size_t column = 3; // amount: repeats, in random order
+    cout << rows << " rows, " << bytes / (1024 * 1024) << " MiB, SHA-256 AVL tree, " << thread::hardware_concurrency() << " cores" << endl;
+
+    {
+        auto start = chrono::steady_clock::now();
+        CSVReader reader;
+        vector<string> header;
+        reader.open(path);
+        reader.readHeader(header);
+        vector<string> keys;
+        reader.forEachField(column, [&](string_view key) {
+            keys.emplace_back(key);
+        });
+        prepareSortedKeys(keys);
+        AVLTree<Sha256Hasher> tree;
+        tree.buildFromSorted(move(keys));
+        tree.savePack("bench_pipeline.pack");
+        RowStoreWriter writer;
+        writeCSVRows(path, "bench_pipeline.rows", column, writer);
+        printf("  %-22s %8.3f s wall\n", "sequential", secondsSince(start));
+    }
+
+    size_t parserCounts[] = { 1, 2, 4 };
+    for (size_t parsers : parserCounts) {
+        RunReport report("pipeline");
+        auto start = chrono::steady_clock::now();
+        CSVReader reader;
+        vector<string> header;
+        reader.open(path);
+        reader.readHeader(header);
+        InitPipeline pipeline(parsers);
+        pipeline.start(path, reader.position(), column, header, "bench_pipeline.rows");
+        AVLTree<Sha256Hasher> tree;
+        tree.buildFromSorted(pipeline.takeKeys());
+        tree.savePack("bench_pipeline.pack");
+        pipeline.finish();
+        double seconds = secondsSince(start);
+        pipeline.reportStages(report);
+        printf("  pipeline, %zu parser%s   %8.3f s wall   ", parsers, parsers > 1 ? "s" : " ", seconds);
+        report.writeJSON(cout);
+    }
+    remove(path.c_str());
+    remove("bench_pipeline.pack");
+    remove("bench_pipeline.rows");
+}
+
+// Indexing three columns (id, name, amount): one init per column, each reading the file and
+// building, hashing and saving its tree in turn, against one pass that collects all three
+// columns and builds the trees in parallel, a thread per column
+static void benchColumns(uint64_t rows) {
+    const string path = "bench_columns.csv";
+    uint64_t bytes = generateCSV(path, rows);
+    const vector<size_t> columns = { 0, 1, 3 };
+    cout << rows << " rows, " << bytes / (1024 * 1024) << " MiB, " << columns.size() << " columns, SHA-256 AVL trees, "
+        << thread::hardware_concurrency() << " cores" << endl;
+
+    auto buildAndSave = [](vector<string>& keys, size_t column) {
+        prepareSortedKeys(keys);
+        AVLTree<Sha256Hasher> tree;
+        tree.buildFromSorted(move(keys));
+        tree.savePack("bench_columns_" + to_string(column) + ".pack");
+        return tree.getRootHash();
+    };
+
+    vector<string> repeatedRoots(columns.size());
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < columns.size(); i++) {
+        vector<string> keys = readColumn(path, columns[i]);
+        repeatedRoots[i] = buildAndSave(keys, columns[i]);
+    }
+    double repeatedSeconds = secondsSince(start);
+    printf("  %-28s %8.3f s wall\n", "one init per column", repeatedSeconds);
+
+    vector<string> singleRoots(columns.size());
+    start = chrono::steady_clock::now();
+    vector<vector<string>> keys(columns.size());
+    {
+        CSVReader reader;
+        vector<string> header;
+        reader.open(path);
+        reader.readHeader(header);
+        string scratch;
+        string_view row, key;
+        while (reader.nextRow(row)) {
+            for (size_t slot = 0; slot < columns.size(); slot++) {
+                if (CSVReader::extractField(row, columns[slot], key, scratch)) {
+                    keys[slot].emplace_back(key);
+                }
+            }
+        }
+    }
+    double parseSeconds = secondsSince(start);
+    {
+        ThreadPool pool(columns.size());
+        for (size_t i = 0; i < columns.size(); i++) {
+            pool.submit([&, i] {
+                singleRoots[i] = buildAndSave(keys[i], columns[i]);
+            });
+        }
+        pool.wait();
+    }
+    double singleSeconds = secondsSince(start);
+    printf("  %-28s %8.3f s wall (%.3f s parsing)   %.2fx\n", "single pass, parallel trees", singleSeconds, parseSeconds,
+        repeatedSeconds / singleSeconds);
+    if (singleRoots != repeatedRoots) {
+        cout << "  root hashes differ" << endl;
+    }
+
+    remove(path.c_str());
+    for (size_t column : columns) {
+        remove(("bench_columns_" + to_string(column) + ".pack").c_str());
+    }
+}
+
+// ---- Reproducible suite: "suite [rows] [columns] [sorted|random|skewed|duplicate] [seed]" ----
+// Generates a CSV from a seed (same arguments, byte-identical file), runs init, insert, hash,
+// search, save and delete on AVLTree and RBTree and append/read on MyVector, and prints one
+// JSON document to stdout so runs can be saved and compared.
+
+enum class KeyDistribution { Sorted, Random, Skewed, Duplicate };
+
+struct SyntheticSpec {
+    uint64_t rows = 1000000;
+    size_t columns = 5;          // the key is column 0
+    KeyDistribution keys = KeyDistribution::Random;
+    uint64_t seed = 1;
+};
+
+static const char* distributionName(KeyDistribution keys) {
+    switch (keys) {
+    case KeyDistribution::Sorted: return "sorted";
+    case KeyDistribution::Random: return "random";
+    case KeyDistribution::Skewed: return "skewed";
+    default: return "duplicate";
+    }
+}
+
+static bool parseDistribution(const string& name, KeyDistribution& keys) {
+    const KeyDistribution all[] = { KeyDistribution::Sorted, KeyDistribution::Random, KeyDistribution::Skewed, KeyDistribution::Duplicate };
+    for (KeyDistribution candidate : all) {
+        if (name == distributionName(candidate)) {
+            keys = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// splitmix64 finalizer; a bijection, so distinct inputs give distinct keys
+static uint64_t mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// Keys by distribution:
+//   sorted     row numbers in order, all distinct
+//   random     all distinct, in random order
+//   skewed     Zipf-like: the key of rank r turns up about 1/r as often (a few very hot keys)
+//   duplicate  rows/100 distinct keys, each about 100 times
+// Other columns alternate between a name, an amount and a quoted comment containing a comma.
+static uint64_t generateSyntheticCSV(const string& path, const SyntheticSpec& spec) {
+    ofstream out(path, ios::binary);
+    out << "key";
+    for (size_t c = 1; c < spec.columns; c++) {
+        out << ",c" << c;
+    }
+    out << "\r\n";
+
+    uint64_t state = mix64(spec.seed) | 1;
+    auto next = [&]() {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        return state;
+    };
+    const uint64_t salt = mix64(spec.seed ^ 0x5EEDULL);
+    const uint64_t duplicateKeys = max<uint64_t>(1, spec.rows / 100);
+    const double logRows = log(double(max<uint64_t>(2, spec.rows)));
+    char text[64];
+    for (uint64_t row = 0; row < spec.rows; row++) {
+        switch (spec.keys) {
+        case KeyDistribution::Sorted:
+            snprintf(text, sizeof(text), "%012llu", (unsigned long long)row);
+            break;
+        case KeyDistribution::Random:
+            snprintf(text, sizeof(text), "%016llx", (unsigned long long)mix64(row ^ salt));
+            break;
+        case KeyDistribution::Skewed: {
+            double unit = (next() >> 11) * (1.0 / 9007199254740992.0);
+            uint64_t rank = min<uint64_t>(spec.rows - 1, uint64_t(exp(unit * logRows)) - 1);
+            snprintf(text, sizeof(text), "%016llx", (unsigned long long)mix64(rank ^ salt));
+            break;
+        }
+        case KeyDistribution::Duplicate:
+            snprintf(text, sizeof(text), "%016llx", (unsigned long long)mix64((next() % duplicateKeys) ^ salt));
+            break;
+        }
+        out << text;
+        for (size_t c = 1; c < spec.columns; c++) {
+            uint64_t value = next();
+            switch (c % 3) {
+            case 1: out << ",user" << value % 100000; break;
+            case 2: out << ',' << value % 100000 << '.' << (value >> 20) % 100; break;
+            default: out << ",\"note, " << value % 1000 << '"'; break;
+            }
+        }
+        out << "\r\n";
+    }
+    return static_cast<uint64_t>(out.tellp());
+}
+
+// One structure and operation: how many operations, their total time and, when they were
+// timed one at a time, each one's latency
+struct SuiteRecord {
+    string structure;
+    string operation;
+    uint64_t count = 0;
+    double seconds = 0;
+    vector<uint32_t> latencies;             // nanoseconds, including the timer's own overhead
+    vector<pair<string, double>> extras;
+};
+
+class SuiteReport {
+private:
+    vector<SuiteRecord> records;
+
+    static void writeLatencies(vector<uint32_t> sorted) {
+        sort(sorted.begin(), sorted.end());
+        auto at = [&](double quantile) {
+            return sorted[min(sorted.size() - 1, size_t(quantile * sorted.size()))];
+        };
+        printf(", \"latency_ns\": {\"p50\": %u, \"p90\": %u, \"p99\": %u, \"p999\": %u, \"max\": %u}",
+            at(0.5), at(0.9), at(0.99), at(0.999), sorted.back());
+    }
+
+public:
+    SuiteRecord& add(const string& structure, const string& operation, uint64_t count, double seconds) {
+        records.push_back(SuiteRecord{ structure, operation, count, seconds, {}, {} });
+        if (seconds > 0) {
+            fprintf(stderr, "  %-12s %-8s %10llu ops  %9.3f s\n", structure.c_str(), operation.c_str(), (unsigned long long)count, seconds);
+        }
+        return records.back();
+    }
+
+    // One record per line, so two runs can be compared with diff as well as with a script
+    void writeJSON(const SyntheticSpec& spec, uint64_t csvBytes, uint64_t distinctKeys, uint32_t timerOverhead) const {
+        printf("{\"config\": {\"rows\": %llu, \"columns\": %zu, \"keys\": \"%s\", \"seed\": %llu, \"csv_bytes\": %llu, "
+            "\"distinct_keys\": %llu, \"timer_overhead_ns\": %u},\n \"results\": [\n",
+            (unsigned long long)spec.rows, spec.columns, distributionName(spec.keys), (unsigned long long)spec.seed,
+            (unsigned long long)csvBytes, (unsigned long long)distinctKeys, timerOverhead);
+        for (size_t i = 0; i < records.size(); i++) {
+            const SuiteRecord& record = records[i];
+            printf("  {\"structure\": \"%s\", \"operation\": \"%s\", \"count\": %llu",
+                record.structure.c_str(), record.operation.c_str(), (unsigned long long)record.count);
+            if (record.seconds > 0) {
+                printf(", \"seconds\": %.6f, \"ops_per_sec\": %.0f", record.seconds, record.count / record.seconds);
+            }
+            if (!record.latencies.empty()) {
+                writeLatencies(record.latencies);
+            }
+            for (const pair<string, double>& extra : record.extras) {
+                printf(", \"%s\": %.6g", extra.first.c_str(), extra.second);
+            }
+            printf("}%s\n", i + 1 < records.size() ? "," : "");
+        }
+        printf(" ],\n \"peak_rss_bytes\": %llu}\n", (unsigned long long)peakResidentBytes());
+    }
+};
+
+// Runs op(i) for i in [0, count), timing each call; returns the total seconds
+template <typename Op>
+static double timeEach(uint64_t count, vector<uint32_t>& latencies, Op op) {
+    latencies.resize(count);
+    auto start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < count; i++) {
+        auto before = chrono::steady_clock::now();
+        op(i);
+        latencies[i] = uint32_t(min<int64_t>(UINT32_MAX, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - before).count()));
+    }
+    return secondsSince(start);
+}
+
+// Cost of the two clock reads around each timed operation
+static uint32_t timerOverheadNanos() {
+    vector<uint32_t> latencies;
+    timeEach(100000, latencies, [](uint64_t) {});
+    sort(latencies.begin(), latencies.end());
+    return latencies[latencies.size() / 2];
+}
+
+// init:   the file's key column read, sorted and built into a hashed tree, as GitLite init does
+// insert: the keys in file order, one at a time, with hashing deferred
+// hash:   bringing the Merkle hashes of those inserts up to date
+// search: random lookups, half of them misses
+// save:   writing the pack file
+// delete: half of the distinct keys, in random order
+template <typename Tree>
+static void suiteTree(SuiteReport& report, const string& label, const string& csvPath, uint64_t csvBytes,
+    uint64_t distinctKeys, const vector<string>& fileKeys, const vector<string>& probes, const vector<string>& deletions) {
+    {
+        auto start = chrono::steady_clock::now();
+        vector<string> keys = readColumn(csvPath, 0);
+        prepareSortedKeys(keys);
+        Tree tree;
+        tree.buildFromSorted(move(keys));
+        sink = tree.getRootHash().size();
+        double seconds = secondsSince(start);
+        report.add(label, "init", fileKeys.size(), seconds).extras = { { "mb_per_sec", csvBytes / seconds / (1024.0 * 1024.0) } };
+    }
+
+    vector<uint32_t> latencies;
+    latencies.reserve(max<size_t>(fileKeys.size(), probes.size()));
+    uint64_t heapBefore = heapInUse();
+    Tree tree;
+    tree.setDeferredHashing(true);
+    double seconds = timeEach(fileKeys.size(), latencies, [&](uint64_t i) { tree.insert(fileKeys[i]); });
+    report.add(label, "insert", fileKeys.size(), seconds).latencies = latencies;
+
+    uint64_t hashesBefore = tree.getHashStats().hashesComputed;
+    auto start = chrono::steady_clock::now();
+    tree.flushHashes();
+    seconds = secondsSince(start);
+    uint64_t hashes = tree.getHashStats().hashesComputed - hashesBefore;
+    report.add(label, "hash", hashes, seconds);
+    uint64_t heapBytes = heapInUse() - heapBefore;
+    report.add(label, "memory", distinctKeys, 0).extras = {
+        { "heap_bytes", double(heapBytes) }, { "bytes_per_key", double(heapBytes) / distinctKeys } };
+
+    uint64_t found = 0;
+    seconds = timeEach(probes.size(), latencies, [&](uint64_t i) { found += tree.contains(probes[i]); });
+    report.add(label, "search", probes.size(), seconds).latencies = latencies;
+    sink = found;
+
+    const string packPath = "bench_suite.pack";
+    start = chrono::steady_clock::now();
+    tree.savePack(packPath);
+    seconds = secondsSince(start);
+    report.add(label, "save", 1, seconds).extras = { { "bytes", double(filesystem::file_size(packPath)) } };
+    remove(packPath.c_str());
+
+    uint64_t removed = 0;
+    seconds = timeEach(deletions.size(), latencies, [&](uint64_t i) { removed += tree.remove(deletions[i]); });
+    report.add(label, "delete", deletions.size(), seconds).latencies = latencies;
+    sink = removed;
+}
+
+// append: push_back of every key in file order, growing from empty
+// read:   random indexed reads
+template <typename Vector>
+static void suiteVector(SuiteReport& report, const string& label, const vector<string>& fileKeys, const vector<uint32_t>& readOrder) {
+    vector<uint32_t> latencies;
+    latencies.reserve(fileKeys.size());
+    uint64_t heapBefore = heapInUse();
+    Vector values;
+    double seconds = timeEach(fileKeys.size(), latencies, [&](uint64_t i) { values.push_back(fileKeys[i]); });
+    report.add(label, "append", fileKeys.size(), seconds).latencies = latencies;
+    uint64_t heapBytes = heapInUse() - heapBefore;
+    report.add(label, "memory", fileKeys.size(), 0).extras = {
+        { "heap_bytes", double(heapBytes) }, { "bytes_per_element", double(heapBytes) / max<size_t>(1, fileKeys.size()) } };
+
+    uint64_t total = 0;
+    auto start = chrono::steady_clock::now();
+    for (uint32_t index : readOrder) {
+        total += values[index].size();
+    }
+    report.add(label, "read", readOrder.size(), secondsSince(start));
+    sink = total;
+}
+
+static int benchSuite(int argc, char* argv[]) {
+    SyntheticSpec spec;
+    if (argc > 2) spec.rows = max<uint64_t>(1, strtoull(argv[2], nullptr, 10));
+    if (argc > 3) spec.columns = max<size_t>(1, strtoull(argv[3], nullptr, 10));
+    if (argc > 4 && !parseDistribution(argv[4], spec.keys)) {
+        cerr << "Unknown key distribution: " << argv[4] << " (sorted, random, skewed or duplicate)" << endl;
+        return 1;
+    }
+    if (argc > 5) spec.seed = strtoull(argv[5], nullptr, 10);
+
+    const string path = "bench_suite.csv";
+    fprintf(stderr, "Generating %llu rows, %zu columns, %s keys, seed %llu...\n", (unsigned long long)spec.rows,
+        spec.columns, distributionName(spec.keys), (unsigned long long)spec.seed);
+    uint64_t csvBytes = generateSyntheticCSV(path, spec);
+
+    // Operation inputs, drawn from the same seed as the file
+    vector<string> fileKeys = readColumn(path, 0);
+    vector<string> distinct = fileKeys;
+    prepareSortedKeys(distinct);
+    uint64_t state = mix64(spec.seed ^ 0xB0B0ULL) | 1;
+    auto next = [&]() {
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        return state;
+    };
+    vector<string> probes;
+    for (size_t i = 0; i < min<size_t>(fileKeys.size(), 1000000); i++) {
+        probes.push_back(distinct[next() % distinct.size()]);
+        if (i & 1) probes.back() += '!';
+    }
+    vector<string> deletions = distinct;
+    for (size_t i = deletions.size(); i > 1; i--) {
+        swap(deletions[i - 1], deletions[next() % i]);
+    }
+    deletions.resize(deletions.size() / 2);
+    vector<uint32_t> readOrder;
+    for (size_t i = 0; i < min<size_t>(fileKeys.size(), 1000000); i++) {
+        readOrder.push_back(uint32_t(next() % fileKeys.size()));
+    }
+
+    SuiteReport report;
+    uint32_t overhead = timerOverheadNanos();
+    suiteTree<AVLTree<Sha256Hasher>>(report, "AVLTree", path, csvBytes, distinct.size(), fileKeys, probes, deletions);
+    suiteTree<RBStringTree<Sha256Hasher>>(report, "RBTree", path, csvBytes, distinct.size(), fileKeys, probes, deletions);
+    suiteVector<MyVector<string>>(report, "MyVector", fileKeys, readOrder);
+    suiteVector<vector<string>>(report, "std::vector", fileKeys, readOrder);
+    report.writeJSON(spec, csvBytes, distinct.size(), overhead);
+    remove(path.c_str());
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    string which = argc > 1 ? argv[1] : "csv";
+    uint64_t rows = argc > 2 ? strtoull(argv[2], nullptr, 10) : 10000000ULL;
+
+    if (which == "csv") {
+        benchCSV(rows);
+    }
+    else if (which == "scaling") {
+        benchScaling(rows);
+        checkMultilineRows(120000);
+    }
+    else if (which == "alloc") {
+        benchAllocations(argc > 2 ? rows : 1000000);
+    }
+    else if (which == "batch") {
+        benchBatch(argc > 2 ? rows : 1000000);
+    }
+    else if (which == "pack") {
+        benchPack(argc > 2 ? rows : 100000);
+    }
+    else if (which == "mmap") {
+        benchMapped(argc > 2 ? rows : 1000000);
+    }
+    else if (which == "arena") {
+        benchArena(rows, argc > 3 ? argv[3] : "both");
+    }
+    else if (which == "compact") {
+        benchCompact(argc > 2 ? rows : 5000000);
+    }
+    else if (which == "rbtree") {
+        benchRBTree(argc > 2 ? rows : 1000000);
+    }
+    else if (which == "btree") {
+        benchBTree(argc > 2 ? rows : 2000000);
+    }
+    else if (which == "traverse") {
+        benchTraverse(argc > 2 ? rows : 2000000);
+    }
+    else if (which == "range") {
+        benchRange(argc > 2 ? rows : 2000000);
+    }
+    else if (which == "commit") {
+        benchCommit(argc > 2 ? rows : 1000000);
+    }
+    else if (which == "diff") {
+        benchDiff(argc > 2 ? rows : 2000000);
+    }
+    else if (which == "persist") {
+        benchPersist(argc > 2 ? rows : 1000000);
+    }
+    else if (which == "objects") {
+        benchObjects(argc > 2 ? rows : 1000000);
+    }
+    else if (which == "rows") {
+        benchRows(argc > 2 ? rows : 1000000);
+    }
+    else if (which == "vector") {
+        benchVector(argc > 2 ? rows : 5000000);
+    }
+    else if (which == "snapshot") {
+        benchSnapshot(argc > 2 ? rows : 1000000);
+    }
+    else if (which == "pipeline") {
+        benchPipeline(argc > 2 ? rows : 2000000);
+    }
+    else if (which == "columns") {
+        benchColumns(argc > 2 ? rows : 2000000);
+    }
+    else if (which == "suite") {
+        return benchSuite(argc, argv);
+    }
+    else if (which == "hash") {
+        benchHash(argc > 2 ? rows : 2000000);
+    }
+    else if (which == "bulkload") {
+        if (argc > 2) {
+            benchBulkLoad(rows);
+        }
+        else {
+            benchBulkLoad(1000000);
+            benchBulkLoad(10000000);
+        }
+    }
+    else {
+        cerr << "Unknown benchmark: " << which << endl;
+        return 1;
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,284 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+using namespace std;
+
+// Streaming CSV reader: the file is pulled through one large reusable buffer and
+// rows/fields are handed out as string_views into it, so nothing is allocated per row.
+// Quoted fields ("a,b" and "say ""hi""") and CRLF line endings are handled.
+class CSVReader {
+private:
+    ifstream file;
+    vector<char> buffer;   // holds the current block (plus any row carried over from the last one)
+    size_t dataStart = 0;  // first unconsumed byte in buffer
+    size_t dataEnd = 0;    // one past the last valid byte in buffer
+    uint64_t bufferOffset = 0;  // file offset of buffer[0]
+    uint64_t rangeEnd = numeric_limits<uint64_t>::max(); // rows starting at or after this offset belong to someone else
+    bool endOfFile = false;
+    string scratch;        // only used when a quoted field contains escaped quotes
+    uint64_t totalBytes = 0;
+    uint64_t totalRows = 0;
+
+    // Reads the next block, keeping the unconsumed tail at the front of the buffer
+    bool refill() {
+        if (endOfFile) return false;
+
+        size_t tail = dataEnd - dataStart;
+        if (dataStart > 0 && tail > 0) {
+            memmove(buffer.data(), buffer.data() + dataStart, tail);
+        }
+        bufferOffset += dataStart;
+        dataStart = 0;
+        dataEnd = tail;
+
+        // A single row bigger than the whole buffer: grow instead of looping forever
+        if (dataEnd == buffer.size()) {
+            buffer.resize(buffer.size() * 2);
+        }
+
+        file.read(buffer.data() + dataEnd, buffer.size() - dataEnd);
+        size_t got = static_cast<size_t>(file.gcount());
+        if (got == 0) {
+            endOfFile = true;
+            return false;
+        }
+        dataEnd += got;
+        totalBytes += got;
+        return true;
+    }
+
+    size_t findRowEnd(size_t from) const {
+        return findRowEnd(buffer.data(), from, dataEnd);
+    }
+
+public:
+    static const size_t DEFAULT_BLOCK_SIZE = 4 << 20;
+
+    explicit CSVReader(size_t blockSize = DEFAULT_BLOCK_SIZE) : buffer(blockSize > 0 ? blockSize : 1) {}
+
+    // Finds the newline ending the row that starts at 'from', skipping newlines inside quotes.
+    // Returns the index of the '\n' or 'end' when the row is not complete yet.
+    static size_t findRowEnd(const char* base, size_t from, size_t end) {
+        const char* nl = static_cast<const char*>(memchr(base + from, '\n', end - from));
+        size_t rowEnd = nl ? static_cast<size_t>(nl - base) : end;
+
+        // Fast path: no quote before the newline, so it cannot be inside a quoted field
+        if (!memchr(base + from, '"', rowEnd - from)) {
+            return rowEnd;
+        }
+
+        bool inQuotes = false;
+        for (size_t i = from; i < end; i++) {
+            if (base[i] == '"') {
+                inQuotes = !inQuotes;
+            }
+            else if (base[i] == '\n' && !inQuotes) {
+                return i;
+            }
+        }
+        return end;
+    }
+
+    // Length of the complete rows at the start of text, which must begin at a row boundary:
+    // one past the last newline that isn't inside quotes, or 0 if there is none. A newline is
+    // outside quotes when an even number of quotes comes before it, so this counts quotes
+    // instead of walking the rows.
+    static size_t completeRowsLength(string_view text) {
+        size_t end = text.rfind('\n');
+        if (end == string_view::npos) return 0;
+        size_t quotes = static_cast<size_t>(count(text.begin(), text.begin() + end, '"'));
+        while (quotes % 2 != 0) {
+            size_t previous = end == 0 ? string_view::npos : text.rfind('\n', end - 1);
+            if (previous == string_view::npos) return 0;
+            quotes -= static_cast<size_t>(count(text.begin() + previous, text.begin() + end, '"'));
+            end = previous;
+        }
+        return end + 1;
+    }
+
+    // Calls onRow(string_view) with each row of text, without line endings, skipping blank
+    // lines; text holds whole rows as cut by completeRowsLength
+    template <typename Fn>
+    static void forEachRow(string_view text, Fn onRow) {
+        size_t start = 0;
+        while (start < text.size()) {
+            size_t end = findRowEnd(text.data(), start, text.size());
+            size_t length = end - start;
+            if (length > 0 && text[start + length - 1] == '\r') {
+                length--;
+            }
+            if (length > 0) {
+                onRow(text.substr(start, length));
+            }
+            start = end + 1;
+        }
+    }
+
+    bool open(const string& fileName) {
+        return open(fileName, 0, numeric_limits<uint64_t>::max());
+    }
+
+    // Opens only the rows that *start* in [begin, end). A row straddling 'begin' belongs to
+    // the previous range, so ranges cut at arbitrary offsets still cover every row exactly once.
+    // The first newline from begin - 1 on is taken to end a row, so when quoted fields may hold
+    // line breaks, begin must be a row start (see nextRowStart in ParallelLoader.h).
+    bool open(const string& fileName, uint64_t begin, uint64_t end) {
+        if (file.is_open()) file.close();
+        file.clear();
+        file.open(fileName, ios::binary);
+        dataStart = dataEnd = 0;
+        endOfFile = false;
+        totalBytes = totalRows = 0;
+        bufferOffset = begin > 0 ? begin - 1 : 0;
+        rangeEnd = end;
+        if (!file) return false;
+
+        if (begin > 0) {
+            // Start one byte early: if that byte is the '\n' ending the previous row we lose nothing
+            file.seekg(static_cast<streamoff>(begin - 1));
+            while (true) {
+                const char* base = buffer.data();
+                const char* nl = static_cast<const char*>(memchr(base + dataStart, '\n', dataEnd - dataStart));
+                if (nl) {
+                    dataStart = static_cast<size_t>(nl - base) + 1;
+                    break;
+                }
+                dataStart = dataEnd;
+                if (!refill()) break;
+            }
+        }
+        return true;
+    }
+
+    // File offset of the next unread row
+    uint64_t position() const {
+        return bufferOffset + dataStart;
+    }
+
+    // Returns the next row without its line ending; the view is valid until the next call
+    bool nextRow(string_view& row) {
+        while (true) {
+            if (position() >= rangeEnd) return false;
+
+            size_t end = dataStart < dataEnd ? findRowEnd(dataStart) : dataEnd;
+
+            if (end < dataEnd || (endOfFile && dataStart < dataEnd)) {
+                size_t rowLength = end - dataStart;
+                const char* rowBegin = buffer.data() + dataStart;
+                dataStart = end < dataEnd ? end + 1 : dataEnd;
+
+                if (rowLength > 0 && rowBegin[rowLength - 1] == '\r') {
+                    rowLength--;
+                }
+                if (rowLength == 0) {
+                    continue; // blank line
+                }
+                row = string_view(rowBegin, rowLength);
+                totalRows++;
+                return true;
+            }
+
+            if (!refill() && dataStart >= dataEnd) {
+                return false;
+            }
+        }
+    }
+
+    // Extracts field 'columnIndex' from a row; returns false if the row is too short.
+    // Quotes are stripped, and "" inside a quoted field is unescaped into 'scratch'.
+    static bool extractField(string_view row, size_t columnIndex, string_view& field, string& scratch) {
+        size_t pos = 0;
+        size_t column = 0;
+
+        while (true) {
+            bool quoted = pos < row.size() && row[pos] == '"';
+            size_t end = pos;
+            bool escaped = false;
+
+            if (quoted) {
+                end = pos + 1;
+                while (end < row.size()) {
+                    if (row[end] == '"') {
+                        if (end + 1 < row.size() && row[end + 1] == '"') {
+                            escaped = true;
+                            end += 2;
+                            continue;
+                        }
+                        break;
+                    }
+                    end++;
+                }
+                // end is on the closing quote (or past the row if it was never closed)
+                size_t comma = row.find(',', end);
+                if (column == columnIndex) {
+                    string_view inner = row.substr(pos + 1, min(end, row.size()) - pos - 1);
+                    if (!escaped) {
+                        field = inner;
+                    }
+                    else {
+                        scratch.clear();
+                        for (size_t i = 0; i < inner.size(); i++) {
+                            scratch.push_back(inner[i]);
+                            if (inner[i] == '"') i++; // skip the second quote of ""
+                        }
+                        field = scratch;
+                    }
+                    return true;
+                }
+                if (comma == string_view::npos) return false;
+                pos = comma + 1;
+            }
+            else {
+                end = row.find(',', pos);
+                if (column == columnIndex) {
+                    field = row.substr(pos, end == string_view::npos ? string_view::npos : end - pos);
+                    return true;
+                }
+                if (end == string_view::npos) return false;
+                pos = end + 1;
+            }
+            column++;
+        }
+    }
+
+    // Reads the first row as the list of column names
+    bool readHeader(vector<string>& columns) {
+        columns.clear();
+        string_view row;
+        if (!nextRow(row)) return false;
+
+        string_view field;
+        for (size_t i = 0; extractField(row, i, field, scratch); i++) {
+            columns.push_back(string(field));
+        }
+        return !columns.empty();
+    }
+
+    // Calls onField(string_view) with the selected column of every remaining row.
+    // Rows that don't have that column are skipped.
+    template <typename Fn>
+    void forEachField(size_t columnIndex, Fn onField) {
+        string_view row;
+        string_view field;
+        while (nextRow(row)) {
+            if (extractField(row, columnIndex, field, scratch)) {
+                onField(field);
+            }
+        }
+    }
+
+    uint64_t bytesRead() const {
+        return totalBytes;
+    }
+
+    uint64_t rowsRead() const {
+        return totalRows;
+    }
+};
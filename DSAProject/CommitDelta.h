@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "AVLtree.h"
+#include "RBtree.h"
+using namespace std;
+
+// Keys a new revision of the selected column adds to and removes from a committed tree.
+// A row whose key changed shows up as one removal plus one addition.
+struct KeyDelta {
+    vector<string> added;
+    vector<string> removed;
+
+    size_t size() const {
+        return added.size() + removed.size();
+    }
+};
+
+// Merge-walks the tree's keys in order against sorted, duplicate-free keys (see
+// prepareSortedKeys in ParallelLoader.h). Only compares keys: no hashing and no change to the tree.
+template <typename Tree>
+KeyDelta diffKeys(const Tree& tree, const vector<string>& keys) {
+    KeyDelta delta;
+    auto it = tree.begin();
+    auto end = tree.end();
+    size_t i = 0;
+    while (it != end && i < keys.size()) {
+        if (*it < keys[i]) {
+            delta.removed.push_back(*it);
+            ++it;
+        }
+        else if (keys[i] < *it) {
+            delta.added.push_back(keys[i]);
+            i++;
+        }
+        else {
+            ++it;
+            i++;
+        }
+    }
+    for (; it != end; ++it) {
+        delta.removed.push_back(*it);
+    }
+    delta.added.insert(delta.added.end(), keys.begin() + i, keys.end());
+    return delta;
+}
+
+template <typename Hasher, typename Allocator>
+void insertKey(AVLTree<Hasher, Allocator>& tree, const string& key) {
+    tree.insert(key);
+}
+
+template <typename Hasher, typename Allocator>
+void insertKey(RBTree<string, Hasher, Allocator>& tree, const string& key) {
+    tree.insertValue(key);
+}
+
+// Applies a delta in O(changes * log n). Hashing is deferred until every change is in, so
+// only the nodes on changed paths are rehashed, each of them once.
+template <typename Tree>
+void applyDelta(Tree& tree, const KeyDelta& delta) {
+    tree.setDeferredHashing(true);
+    for (const string& key : delta.removed) {
+        tree.remove(key);
+    }
+    for (const string& key : delta.added) {
+        insertKey(tree, key);
+    }
+    tree.setDeferredHashing(false);
+}
@@ -0,0 +1,280 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include "Hash.h"
+using namespace std;
+
+const uint32_t COMPACT_NIL = 0x7FFFFFFFu;   // "no child"; also the node limit
+const uint32_t COMPACT_FLAG = 0x80000000u;  // spare top bit of a child index
+
+// 24-byte node: the first 8 key bytes inline (zero padded), then the key's place in the
+// string pool and two 31-bit child indices. The spare top bits hold the color (left) and the
+// stale-hash flag (right). Comparing keys of up to 8 bytes never touches the pool.
+struct CompactNode {
+    uint64_t prefix;    // first 8 key bytes, big-endian, so integer order is byte order
+    uint32_t keyOffset; // into the key pool
+    uint32_t keyLength;
+    uint32_t leftAndRed;
+    uint32_t rightAndDirty;
+};
+static_assert(sizeof(CompactNode) == 24, "compact nodes must stay 24 bytes");
+
+// Red-black tree of string keys stored in flat arrays instead of heap nodes. Nodes are
+// addressed by 32-bit index, the Merkle hashes live in a parallel array (searches never load
+// them), and key bytes are interned once in a single pool. There are no parent links:
+// insert keeps the search path on the stack and rebalances along it.
+template <typename Hasher = InstructorHash>
+class CompactTree {
+private:
+    vector<CompactNode> nodes;
+    vector<HashDigest> hashes; // hashes[i] belongs to nodes[i]
+    vector<char> keyPool;
+    uint32_t root = COMPACT_NIL;
+    Hasher hasher;
+
+    // A red-black tree of 2^31 nodes is at most 62 levels deep
+    static const int MAX_DEPTH = 64;
+
+    static uint64_t makePrefix(string_view key) {
+        uint64_t prefix = 0;
+        size_t length = key.size() < 8 ? key.size() : 8;
+        for (size_t i = 0; i < length; i++) {
+            prefix |= static_cast<uint64_t>(static_cast<unsigned char>(key[i])) << (56 - 8 * i);
+        }
+        return prefix;
+    }
+
+    uint32_t left(uint32_t i) const {
+        return nodes[i].leftAndRed & ~COMPACT_FLAG;
+    }
+
+    uint32_t right(uint32_t i) const {
+        return nodes[i].rightAndDirty & ~COMPACT_FLAG;
+    }
+
+    void setLeft(uint32_t i, uint32_t child) {
+        nodes[i].leftAndRed = (nodes[i].leftAndRed & COMPACT_FLAG) | child;
+    }
+
+    void setRight(uint32_t i, uint32_t child) {
+        nodes[i].rightAndDirty = (nodes[i].rightAndDirty & COMPACT_FLAG) | child;
+    }
+
+    bool isRed(uint32_t i) const {
+        return i != COMPACT_NIL && (nodes[i].leftAndRed & COMPACT_FLAG) != 0;
+    }
+
+    void setRed(uint32_t i, bool red) {
+        nodes[i].leftAndRed = red ? (nodes[i].leftAndRed | COMPACT_FLAG) : (nodes[i].leftAndRed & ~COMPACT_FLAG);
+    }
+
+    bool isDirty(uint32_t i) const {
+        return (nodes[i].rightAndDirty & COMPACT_FLAG) != 0;
+    }
+
+    void setDirty(uint32_t i, bool dirty) {
+        nodes[i].rightAndDirty = dirty ? (nodes[i].rightAndDirty | COMPACT_FLAG) : (nodes[i].rightAndDirty & ~COMPACT_FLAG);
+    }
+
+    // Orders key against node i: the inline prefixes settle almost every comparison, and
+    // the pool is only read when both keys share their first 8 bytes
+    int compareKey(string_view key, uint64_t prefix, uint32_t i) const {
+        const CompactNode& node = nodes[i];
+        if (prefix != node.prefix) {
+            return prefix < node.prefix ? -1 : 1;
+        }
+        if (key.size() <= 8 && node.keyLength <= 8) {
+            return key.size() < node.keyLength ? -1 : (key.size() > node.keyLength ? 1 : 0);
+        }
+        return key.compare(keyAt(i));
+    }
+
+    uint32_t newNode(string_view key, uint64_t prefix) {
+        CompactNode node;
+        node.prefix = prefix;
+        node.keyLength = static_cast<uint32_t>(key.size());
+        node.keyOffset = static_cast<uint32_t>(keyPool.size());
+        keyPool.insert(keyPool.end(), key.begin(), key.end());
+        node.leftAndRed = COMPACT_NIL | COMPACT_FLAG; // new nodes are red
+        node.rightAndDirty = COMPACT_NIL | COMPACT_FLAG; // and not hashed yet
+        nodes.push_back(node);
+        hashes.emplace_back();
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+
+    // Rotations return the new subtree root; the caller relinks it to the parent
+    uint32_t rotateLeft(uint32_t x) {
+        uint32_t y = right(x);
+        setRight(x, left(y));
+        setLeft(y, x);
+        setDirty(x, true);
+        setDirty(y, true);
+        return y;
+    }
+
+    uint32_t rotateRight(uint32_t x) {
+        uint32_t y = left(x);
+        setLeft(x, right(y));
+        setRight(y, x);
+        setDirty(x, true);
+        setDirty(y, true);
+        return y;
+    }
+
+    void replaceChild(uint32_t parent, uint32_t oldChild, uint32_t newChild) {
+        if (parent == COMPACT_NIL) {
+            root = newChild;
+        }
+        else if (left(parent) == oldChild) {
+            setLeft(parent, newChild);
+        }
+        else {
+            setRight(parent, newChild);
+        }
+    }
+
+    // Post-order rehash of the dirty nodes; every ancestor of a dirty node is dirty too
+    void rehashDirty(uint32_t i) {
+        if (i == COMPACT_NIL || !isDirty(i)) return;
+
+        uint32_t l = left(i);
+        uint32_t r = right(i);
+        rehashDirty(l);
+        rehashDirty(r);
+        hasher.hashNode(keyAt(i),
+            l != COMPACT_NIL ? &hashes[l] : nullptr,
+            r != COMPACT_NIL ? &hashes[r] : nullptr,
+            hashes[i]);
+        setDirty(i, false);
+    }
+
+public:
+    // Reserve room for n keys of about averageKeyLength bytes, to avoid regrowing the arrays
+    void reserve(size_t n, size_t averageKeyLength = 0) {
+        nodes.reserve(n);
+        hashes.reserve(n);
+        keyPool.reserve(n * averageKeyLength);
+    }
+
+    // Inserts key; returns false if it was already present. Hashes are brought up to date
+    // lazily, like AVLTree's deferred mode.
+    bool insert(string_view key) {
+        if (nodes.size() >= COMPACT_NIL || keyPool.size() + key.size() > UINT32_MAX) {
+            cerr << "Error: Compact tree is full" << endl;
+            return false;
+        }
+
+        uint32_t path[MAX_DEPTH + 1];
+        int depth = 0;
+        uint64_t prefix = makePrefix(key);
+        uint32_t current = root;
+        bool goLeft = false;
+        while (current != COMPACT_NIL) {
+            int order = compareKey(key, prefix, current);
+            if (order == 0) return false; // Duplicate keys are not allowed
+            path[depth++] = current;
+            goLeft = order < 0;
+            current = goLeft ? left(current) : right(current);
+        }
+
+        uint32_t node = newNode(key, prefix);
+        if (depth == 0) {
+            root = node;
+            setRed(root, false);
+            return true;
+        }
+        if (goLeft) setLeft(path[depth - 1], node);
+        else setRight(path[depth - 1], node);
+        for (int i = 0; i < depth; i++) {
+            setDirty(path[i], true);
+        }
+        path[depth] = node;
+
+        // Red-black fixup, walking back up the recorded path
+        int k = depth;
+        while (k >= 2 && isRed(path[k - 1])) {
+            uint32_t parent = path[k - 1];
+            uint32_t grand = path[k - 2];
+            uint32_t greatGrand = k >= 3 ? path[k - 3] : COMPACT_NIL;
+            if (parent == left(grand)) {
+                uint32_t uncle = right(grand);
+                if (isRed(uncle)) {
+                    setRed(parent, false);
+                    setRed(uncle, false);
+                    setRed(grand, true);
+                    k -= 2;
+                    continue;
+                }
+                if (path[k] == right(parent)) {
+                    parent = rotateLeft(parent);
+                    setLeft(grand, parent);
+                }
+                setRed(parent, false);
+                setRed(grand, true);
+                replaceChild(greatGrand, grand, rotateRight(grand));
+            }
+            else {
+                uint32_t uncle = left(grand);
+                if (isRed(uncle)) {
+                    setRed(parent, false);
+                    setRed(uncle, false);
+                    setRed(grand, true);
+                    k -= 2;
+                    continue;
+                }
+                if (path[k] == left(parent)) {
+                    parent = rotateRight(parent);
+                    setRight(grand, parent);
+                }
+                setRed(parent, false);
+                setRed(grand, true);
+                replaceChild(greatGrand, grand, rotateLeft(grand));
+            }
+            break;
+        }
+        setRed(root, false);
+        return true;
+    }
+
+    bool contains(string_view key) const {
+        uint64_t prefix = makePrefix(key);
+        uint32_t current = root;
+        while (current != COMPACT_NIL) {
+            int order = compareKey(key, prefix, current);
+            if (order == 0) return true;
+            current = order < 0 ? left(current) : right(current);
+        }
+        return false;
+    }
+
+    // Key of node i (valid until the next insert)
+    string_view keyAt(uint32_t i) const {
+        return string_view(keyPool.data() + nodes[i].keyOffset, nodes[i].keyLength);
+    }
+
+    void flushHashes() {
+        rehashDirty(root);
+    }
+
+    HashDigest getRootDigest() {
+        flushHashes();
+        return root == COMPACT_NIL ? HashDigest() : hashes[root];
+    }
+
+    string getRootHash() {
+        return Hasher::toString(getRootDigest());
+    }
+
+    size_t size() const {
+        return nodes.size();
+    }
+
+    // Bytes held by the node, hash and key arrays (capacity, not just what is used)
+    size_t memoryBytes() const {
+        return nodes.capacity() * sizeof(CompactNode) + hashes.capacity() * sizeof(HashDigest) + keyPool.capacity();
+    }
+};
@@ -0,0 +1,657 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+using namespace std;
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define GITLITE_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define GITLITE_TARGET(features)
+#else
+#include <cpuid.h>
+#define GITLITE_TARGET(features) __attribute__((target(features)))
+#endif
+#endif
+
+// Every tree node stores a 32-byte digest, whatever hash method produced it
+typedef array<uint8_t, 32> HashDigest;
+
+inline string digestToHex(const HashDigest& digest) {
+    static const char hexDigits[] = "0123456789abcdef";
+    string text(64, '0');
+    for (size_t i = 0; i < digest.size(); i++) {
+        text[2 * i] = hexDigits[digest[i] >> 4];
+        text[2 * i + 1] = hexDigits[digest[i] & 15];
+    }
+    return text;
+}
+
+// Running totals kept by every hasher
+struct HashStats {
+    uint64_t hashesComputed = 0;
+    uint64_t bytesHashed = 0;
+    uint64_t batchNanoseconds = 0; // time the trees spent in bulk hashing and deferred flushes
+};
+
+// One node to hash in a batch: the node's key, its children's digests (null if absent)
+// and where the result goes
+struct HashInput {
+    string_view key;
+    const HashDigest* left;
+    const HashDigest* right;
+    HashDigest* out;
+};
+
+// Instructor Hash Class
+class InstructorHash {
+private:
+    HashStats stats;
+
+    int foldBytes(int hashValue, string_view bytes) {
+        for (size_t i = 0; i < bytes.length(); i++) {
+            int asciiValue = static_cast<int>(bytes[i]); // Get the ASCII value of the character at index i
+            hashValue = (hashValue * asciiValue) % 29; // Multiply and take modulo 29
+        }
+        stats.bytesHashed += bytes.length();
+        return hashValue;
+    }
+
+    // Folds the decimal text of number into the hash, as if it had been to_string'd
+    int foldDigits(int hashValue, int number) {
+        char text[16];
+        size_t length = 0;
+        unsigned int magnitude = number < 0 ? 0u - static_cast<unsigned int>(number) : static_cast<unsigned int>(number);
+        do {
+            text[sizeof(text) - 1 - length++] = static_cast<char>('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude > 0);
+        if (number < 0) text[sizeof(text) - 1 - length++] = '-';
+        return foldBytes(hashValue, string_view(text + sizeof(text) - length, length));
+    }
+
+public:
+    static const char* name() {
+        return "Instructor Hash";
+    }
+
+    // Compute Instructor Hash for an integer
+    int computeHash(int number) {
+        int hashValue = 1;
+        while (number > 0) {
+            int digit = number % 10; // Extract the last digit
+            hashValue = (hashValue * digit) % 29; // Multiply and take modulo 29
+            number /= 10; // Remove the last digit
+        }
+        return hashValue;
+    }
+
+    // Compute Instructor Hash for a string
+    int computeHash(string_view str)
+    {
+        return foldBytes(1, str); // Start with an initial hash value of 1
+    }
+
+    // The int result lives in the first 4 bytes of the digest, the rest stays zero
+    static int digestValue(const HashDigest& digest) {
+        int value;
+        memcpy(&value, digest.data(), sizeof(value));
+        return value;
+    }
+
+    static string toString(const HashDigest& digest) {
+        return to_string(digestValue(digest));
+    }
+
+    // Leaf node: hash is based on its key
+    // Internal node: hash combines left and right child hashes. This is the Instructor Hash of
+    // to_string(left) + to_string(right), folded digit by digit so no string is built.
+    void hashNode(string_view key, const HashDigest* left, const HashDigest* right, HashDigest& out) {
+        int value = 1;
+        if (!left && !right) {
+            value = foldBytes(value, key);
+        }
+        else {
+            if (left) value = foldDigits(value, digestValue(*left));
+            if (right) value = foldDigits(value, digestValue(*right));
+        }
+        stats.hashesComputed++;
+        out.fill(0);
+        memcpy(out.data(), &value, sizeof(value));
+    }
+
+    void hashNodes(const HashInput* inputs, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            hashNode(inputs[i].key, inputs[i].left, inputs[i].right, *inputs[i].out);
+        }
+    }
+
+    // Hashes a node already serialized by the tree (nodes with many keys, e.g. B-tree nodes)
+    void hashMessage(string_view message, HashDigest& out) {
+        int value = foldBytes(1, message);
+        stats.hashesComputed++;
+        out.fill(0);
+        memcpy(out.data(), &value, sizeof(value));
+    }
+
+    const HashStats& getStats() const {
+        return stats;
+    }
+
+    void addBatchTime(uint64_t nanoseconds) {
+        stats.batchNanoseconds += nanoseconds;
+    }
+
+    void resetStats() {
+        stats = HashStats();
+    }
+};
+
+// SHA-256 (FIPS 180-4) with three compression backends picked at runtime:
+// SHA-NI for single messages, AVX2 8-lane multi-buffer for batches, and portable C++.
+class Sha256 {
+public:
+    enum Backend { PORTABLE, SHA_NI, AVX2 };
+
+    static const char* backendName(Backend backend) {
+        switch (backend) {
+        case SHA_NI: return "SHA-NI";
+        case AVX2: return "AVX2 x8";
+        default: return "portable";
+        }
+    }
+
+    static bool supports(Backend backend) {
+        static const CpuFeatures features = detectCpu();
+        switch (backend) {
+        case SHA_NI: return features.shaNi;
+        case AVX2: return features.avx2;
+        default: return true;
+        }
+    }
+
+    // Streaming context for messages that arrive in pieces; never allocates
+    struct Context {
+        uint32_t state[8];
+        uint8_t block[64];
+        size_t blockLength;
+        uint64_t totalLength;
+        Backend backend;
+
+        explicit Context(Backend backend = Sha256::bestSingleBackend()) : blockLength(0), totalLength(0), backend(backend) {
+            memcpy(state, initialState(), sizeof(state));
+        }
+
+        void update(const void* data, size_t length) {
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+            totalLength += length;
+            if (blockLength > 0) {
+                size_t take = min(length, 64 - blockLength);
+                memcpy(block + blockLength, bytes, take);
+                blockLength += take;
+                bytes += take;
+                length -= take;
+                if (blockLength < 64) return;
+                compress(backend, state, block, 1);
+                blockLength = 0;
+            }
+            if (length >= 64) {
+                compress(backend, state, bytes, length / 64);
+                bytes += length / 64 * 64;
+                length %= 64;
+            }
+            memcpy(block, bytes, length);
+            blockLength = length;
+        }
+
+        void finish(HashDigest& out) {
+            uint8_t tail[128];
+            size_t tailBlocks = padTail(block, blockLength, totalLength, tail);
+            compress(backend, state, tail, tailBlocks);
+            storeState(state, out);
+        }
+    };
+
+    static Backend bestSingleBackend() {
+        return supports(SHA_NI) ? SHA_NI : PORTABLE;
+    }
+
+    // Eight AVX2 lanes edge out SHA-NI on batches of short messages
+    static Backend bestBatchBackend() {
+        return supports(AVX2) ? AVX2 : bestSingleBackend();
+    }
+
+    static void hash(const void* data, size_t length, HashDigest& out, Backend backend = bestSingleBackend()) {
+        Context context(backend == AVX2 ? bestSingleBackend() : backend);
+        context.update(data, length);
+        context.finish(out);
+    }
+
+    // Hashes count independent messages. With the AVX2 backend they go through
+    // the 8-lane multi-buffer path; otherwise they are hashed one after another.
+    static void hashMany(const uint8_t* const* messages, const size_t* lengths, HashDigest* outs, size_t count,
+        Backend backend = bestBatchBackend())
+    {
+        size_t done = 0;
+#ifdef GITLITE_X86
+        if (backend == AVX2 && supports(AVX2)) {
+            for (; done + 8 <= count; done += 8) {
+                hash8Avx2(messages + done, lengths + done, outs + done);
+            }
+            backend = bestSingleBackend();
+        }
+#endif
+        for (; done < count; done++) {
+            hash(messages[done], lengths[done], outs[done], backend == AVX2 ? bestSingleBackend() : backend);
+        }
+    }
+
+private:
+    struct CpuFeatures {
+        bool shaNi = false;
+        bool avx2 = false;
+    };
+
+    static CpuFeatures detectCpu() {
+        CpuFeatures features;
+#ifdef GITLITE_X86
+        unsigned int regs1[4] = { 0, 0, 0, 0 };
+        unsigned int regs7[4] = { 0, 0, 0, 0 };
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return features;
+        __cpuid(info, 1);
+        for (int i = 0; i < 4; i++) regs1[i] = static_cast<unsigned int>(info[i]);
+        __cpuidex(info, 7, 0);
+        for (int i = 0; i < 4; i++) regs7[i] = static_cast<unsigned int>(info[i]);
+#else
+        if (__get_cpuid_max(0, nullptr) < 7) return features;
+        __get_cpuid(1, &regs1[0], &regs1[1], &regs1[2], &regs1[3]);
+        __get_cpuid_count(7, 0, &regs7[0], &regs7[1], &regs7[2], &regs7[3]);
+#endif
+        bool sse41 = (regs1[2] & (1u << 19)) != 0;
+        bool ssse3 = (regs1[2] & (1u << 9)) != 0;
+        bool osxsave = (regs1[2] & (1u << 27)) != 0;
+        bool avx = (regs1[2] & (1u << 28)) != 0;
+        features.shaNi = sse41 && ssse3 && (regs7[1] & (1u << 29)) != 0;
+
+        // AVX2 also needs the OS to save the YMM registers
+        if (osxsave && avx && (regs7[1] & (1u << 5)) != 0) {
+#ifdef _MSC_VER
+            unsigned long long xcr0 = _xgetbv(0);
+#else
+            unsigned int eax, edx;
+            __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+            unsigned long long xcr0 = (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+            features.avx2 = (xcr0 & 6) == 6;
+        }
+#endif
+        return features;
+    }
+
+    static const uint32_t* initialState() {
+        static const uint32_t values[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        return values;
+    }
+
+    static const uint32_t* roundConstants() {
+        static const uint32_t values[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+        return values;
+    }
+
+    static uint32_t loadBigEndian(const uint8_t* p) {
+        return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+            (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+    }
+
+    static void storeState(const uint32_t state[8], HashDigest& out) {
+        for (int i = 0; i < 8; i++) {
+            out[4 * i] = static_cast<uint8_t>(state[i] >> 24);
+            out[4 * i + 1] = static_cast<uint8_t>(state[i] >> 16);
+            out[4 * i + 2] = static_cast<uint8_t>(state[i] >> 8);
+            out[4 * i + 3] = static_cast<uint8_t>(state[i]);
+        }
+    }
+
+    // Builds the final padded block(s) for a message whose last 'length' bytes are in 'data';
+    // returns how many 64-byte blocks were written to 'tail' (1 or 2)
+    static size_t padTail(const uint8_t* data, size_t length, uint64_t totalLength, uint8_t tail[128]) {
+        size_t blocks = length + 9 <= 64 ? 1 : 2;
+        memset(tail, 0, blocks * 64);
+        memcpy(tail, data, length);
+        tail[length] = 0x80;
+        uint64_t bits = totalLength * 8;
+        for (int i = 0; i < 8; i++) {
+            tail[blocks * 64 - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+        }
+        return blocks;
+    }
+
+    static uint32_t rotr(uint32_t x, int n) {
+        return (x >> n) | (x << (32 - n));
+    }
+
+    static void compressPortable(uint32_t state[8], const uint8_t* data, size_t blocks) {
+        const uint32_t* k = roundConstants();
+        uint32_t w[64];
+        while (blocks--) {
+            for (int t = 0; t < 16; t++) {
+                w[t] = loadBigEndian(data + 4 * t);
+            }
+            for (int t = 16; t < 64; t++) {
+                uint32_t s0 = rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ (w[t - 15] >> 3);
+                uint32_t s1 = rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ (w[t - 2] >> 10);
+                w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+            }
+
+            uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+            uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+            for (int t = 0; t < 64; t++) {
+                uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+                uint32_t ch = (e & f) ^ (~e & g);
+                uint32_t temp1 = h + s1 + ch + k[t] + w[t];
+                uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+                uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+                uint32_t temp2 = s0 + maj;
+                h = g; g = f; f = e; e = d + temp1;
+                d = c; c = b; b = a; a = temp1 + temp2;
+            }
+            state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+            state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+            data += 64;
+        }
+    }
+
+#ifdef GITLITE_X86
+    GITLITE_TARGET("sha,sse4.1,ssse3")
+    static void compressShaNi(uint32_t state[8], const uint8_t* data, size_t blocks) {
+        const uint32_t* k = roundConstants();
+        const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+        // The SHA instructions want the state as ABEF / CDGH
+        __m128i temp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0])), 0xB1);
+        __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4])), 0x1B);
+        __m128i state0 = _mm_alignr_epi8(temp, state1, 8);
+        state1 = _mm_blend_epi16(state1, temp, 0xF0);
+
+        while (blocks--) {
+            __m128i saved0 = state0;
+            __m128i saved1 = state1;
+            __m128i w[4]; // rolling window of the last 16 message words
+
+            for (int i = 0; i < 16; i++) {
+                __m128i words;
+                if (i < 4) {
+                    words = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i)), byteSwap);
+                }
+                else {
+                    words = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                    words = _mm_add_epi32(words, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+                    words = _mm_sha256msg2_epu32(words, w[(i + 3) & 3]);
+                }
+                w[i & 3] = words;
+
+                __m128i message = _mm_add_epi32(words, _mm_loadu_si128(reinterpret_cast<const __m128i*>(k + 4 * i)));
+                state1 = _mm_sha256rnds2_epu32(state1, state0, message);
+                message = _mm_shuffle_epi32(message, 0x0E);
+                state0 = _mm_sha256rnds2_epu32(state0, state1, message);
+            }
+
+            state0 = _mm_add_epi32(state0, saved0);
+            state1 = _mm_add_epi32(state1, saved1);
+            data += 64;
+        }
+
+        temp = _mm_shuffle_epi32(state0, 0x1B);
+        state1 = _mm_shuffle_epi32(state1, 0xB1);
+        state0 = _mm_blend_epi16(temp, state1, 0xF0);
+        state1 = _mm_alignr_epi8(state1, temp, 8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+    }
+
+    GITLITE_TARGET("avx2")
+    static __m256i rotr8(__m256i x, int n) {
+        return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+    }
+
+    // Eight messages at once, one per 32-bit lane. Lanes whose message has run out of
+    // blocks keep computing on a dummy block but their state is not updated.
+    GITLITE_TARGET("avx2")
+    static void hash8Avx2(const uint8_t* const* messages, const size_t* lengths, HashDigest* outs) {
+        const uint32_t* k = roundConstants();
+        uint8_t tails[8][128];
+        size_t fullBlocks[8];
+        size_t totalBlocks[8];
+        size_t maxBlocks = 0;
+        static const uint8_t dummy[64] = { 0 };
+
+        for (int lane = 0; lane < 8; lane++) {
+            fullBlocks[lane] = lengths[lane] / 64;
+            size_t rest = lengths[lane] % 64;
+            totalBlocks[lane] = fullBlocks[lane] +
+                padTail(messages[lane] + fullBlocks[lane] * 64, rest, lengths[lane], tails[lane]);
+            maxBlocks = max(maxBlocks, totalBlocks[lane]);
+        }
+
+        __m256i state[8];
+        for (int i = 0; i < 8; i++) {
+            state[i] = _mm256_set1_epi32(static_cast<int>(initialState()[i]));
+        }
+
+        for (size_t block = 0; block < maxBlocks; block++) {
+            const uint8_t* blockData[8];
+            alignas(32) uint32_t activeMask[8];
+            for (int lane = 0; lane < 8; lane++) {
+                if (block < fullBlocks[lane]) {
+                    blockData[lane] = messages[lane] + block * 64;
+                }
+                else if (block < totalBlocks[lane]) {
+                    blockData[lane] = tails[lane] + (block - fullBlocks[lane]) * 64;
+                }
+                else {
+                    blockData[lane] = dummy;
+                }
+                activeMask[lane] = block < totalBlocks[lane] ? 0xFFFFFFFFu : 0;
+            }
+
+            __m256i w[64];
+            for (int t = 0; t < 16; t++) {
+                w[t] = _mm256_setr_epi32(
+                    static_cast<int>(loadBigEndian(blockData[0] + 4 * t)), static_cast<int>(loadBigEndian(blockData[1] + 4 * t)),
+                    static_cast<int>(loadBigEndian(blockData[2] + 4 * t)), static_cast<int>(loadBigEndian(blockData[3] + 4 * t)),
+                    static_cast<int>(loadBigEndian(blockData[4] + 4 * t)), static_cast<int>(loadBigEndian(blockData[5] + 4 * t)),
+                    static_cast<int>(loadBigEndian(blockData[6] + 4 * t)), static_cast<int>(loadBigEndian(blockData[7] + 4 * t)));
+            }
+            for (int t = 16; t < 64; t++) {
+                __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr8(w[t - 15], 7), rotr8(w[t - 15], 18)), _mm256_srli_epi32(w[t - 15], 3));
+                __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr8(w[t - 2], 17), rotr8(w[t - 2], 19)), _mm256_srli_epi32(w[t - 2], 10));
+                w[t] = _mm256_add_epi32(_mm256_add_epi32(w[t - 16], s0), _mm256_add_epi32(w[t - 7], s1));
+            }
+
+            __m256i a = state[0], b = state[1], c = state[2], d = state[3];
+            __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+            for (int t = 0; t < 64; t++) {
+                __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr8(e, 6), rotr8(e, 11)), rotr8(e, 25));
+                __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+                __m256i temp1 = _mm256_add_epi32(_mm256_add_epi32(h, s1),
+                    _mm256_add_epi32(ch, _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(k[t])), w[t])));
+                __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr8(a, 2), rotr8(a, 13)), rotr8(a, 22));
+                __m256i maj = _mm256_xor_si256(_mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(a, c)), _mm256_and_si256(b, c));
+                __m256i temp2 = _mm256_add_epi32(s0, maj);
+                h = g; g = f; f = e; e = _mm256_add_epi32(d, temp1);
+                d = c; c = b; b = a; a = _mm256_add_epi32(temp1, temp2);
+            }
+
+            __m256i mask = _mm256_load_si256(reinterpret_cast<const __m256i*>(activeMask));
+            __m256i rounds[8] = { a, b, c, d, e, f, g, h };
+            for (int i = 0; i < 8; i++) {
+                state[i] = _mm256_add_epi32(state[i], _mm256_and_si256(rounds[i], mask));
+            }
+        }
+
+        alignas(32) uint32_t lanes[8][8];
+        for (int i = 0; i < 8; i++) {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lanes[i]), state[i]);
+        }
+        for (int lane = 0; lane < 8; lane++) {
+            uint32_t laneState[8];
+            for (int i = 0; i < 8; i++) {
+                laneState[i] = lanes[i][lane];
+            }
+            storeState(laneState, outs[lane]);
+        }
+    }
+#endif
+
+    static void compress(Backend backend, uint32_t state[8], const uint8_t* data, size_t blocks) {
+#ifdef GITLITE_X86
+        if (backend == SHA_NI && supports(SHA_NI)) {
+            compressShaNi(state, data, blocks);
+            return;
+        }
+#endif
+        compressPortable(state, data, blocks);
+    }
+};
+
+// Merkle hashing with SHA-256. Leaves hash 0x00 || key; internal nodes hash
+// 0x01 || left digest || right digest || key, with a missing child as 32 zero bytes,
+// so both the keys and the shape of the tree are covered by the root.
+class Sha256Hasher {
+private:
+    HashStats stats;
+    Sha256::Backend singleBackend = Sha256::bestSingleBackend();
+    Sha256::Backend batchBackend = Sha256::bestBatchBackend();
+    vector<uint8_t> batchBuffer;
+    vector<const uint8_t*> batchMessages;
+    vector<size_t> batchLengths;
+    vector<HashDigest> batchDigests;
+
+public:
+    static const char* name() {
+        return "SHA-256";
+    }
+
+    static string toString(const HashDigest& digest) {
+        return digestToHex(digest);
+    }
+
+    // Forces a backend (the benchmark uses this); unsupported ones fall back to portable
+    void setBackend(Sha256::Backend backend) {
+        singleBackend = backend == Sha256::AVX2 ? Sha256::bestSingleBackend() : backend;
+        batchBackend = backend;
+    }
+
+    void hashNode(string_view key, const HashDigest* left, const HashDigest* right, HashDigest& out) {
+        // Tag and child digests go into a fixed stack buffer; the key is fed straight from the node
+        uint8_t header[65];
+        size_t headerLength = 1;
+        if (!left && !right) {
+            header[0] = 0x00;
+        }
+        else {
+            header[0] = 0x01;
+            if (left) memcpy(header + 1, left->data(), 32);
+            else memset(header + 1, 0, 32);
+            if (right) memcpy(header + 33, right->data(), 32);
+            else memset(header + 33, 0, 32);
+            headerLength = 65;
+        }
+
+        Sha256::Context context(singleBackend);
+        context.update(header, headerLength);
+        context.update(key.data(), key.size());
+        context.finish(out);
+
+        stats.hashesComputed++;
+        stats.bytesHashed += headerLength + key.size();
+    }
+
+    // Hashes a batch of independent nodes (e.g. one level of a bulk-built tree)
+    void hashNodes(const HashInput* inputs, size_t count) {
+        if (batchBackend != Sha256::AVX2 || count < 8) {
+            for (size_t i = 0; i < count; i++) {
+                hashNode(inputs[i].key, inputs[i].left, inputs[i].right, *inputs[i].out);
+            }
+            return;
+        }
+
+        // Lay the messages out back to back so the multi-buffer path can read them
+        size_t total = 0;
+        for (size_t i = 0; i < count; i++) {
+            bool leaf = !inputs[i].left && !inputs[i].right;
+            total += 1 + (leaf ? 0 : 64) + inputs[i].key.size();
+        }
+        batchBuffer.resize(total);
+        batchMessages.resize(count);
+        batchLengths.resize(count);
+        batchDigests.resize(count);
+
+        static const HashDigest empty = {};
+        uint8_t* cursor = batchBuffer.data();
+        for (size_t i = 0; i < count; i++) {
+            const HashInput& input = inputs[i];
+            uint8_t* start = cursor;
+            if (!input.left && !input.right) {
+                *cursor++ = 0x00;
+            }
+            else {
+                *cursor++ = 0x01;
+                memcpy(cursor, (input.left ? *input.left : empty).data(), 32);
+                memcpy(cursor + 32, (input.right ? *input.right : empty).data(), 32);
+                cursor += 64;
+            }
+            memcpy(cursor, input.key.data(), input.key.size());
+            cursor += input.key.size();
+            batchMessages[i] = start;
+            batchLengths[i] = static_cast<size_t>(cursor - start);
+        }
+
+        Sha256::hashMany(batchMessages.data(), batchLengths.data(), batchDigests.data(), count, Sha256::AVX2);
+        for (size_t i = 0; i < count; i++) {
+            *inputs[i].out = batchDigests[i];
+        }
+        stats.hashesComputed += count;
+        stats.bytesHashed += total;
+    }
+
+    // Hashes a node already serialized by the tree (nodes with many keys, e.g. B-tree nodes).
+    // The tree's message must start with its own tag byte, distinct from 0x00 and 0x01.
+    void hashMessage(string_view message, HashDigest& out) {
+        Sha256::hash(message.data(), message.size(), out, singleBackend);
+        stats.hashesComputed++;
+        stats.bytesHashed += message.size();
+    }
+
+    const HashStats& getStats() const {
+        return stats;
+    }
+
+    void addBatchTime(uint64_t nanoseconds) {
+        stats.batchNanoseconds += nanoseconds;
+    }
+
+    void resetStats() {
+        stats = HashStats();
+    }
+};
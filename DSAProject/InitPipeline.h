@@ -0,0 +1,382 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include "CSVReader.h"
+#include "ParallelLoader.h"
+#include "RowStore.h"
+#include "Instrumentation.h"
+using namespace std;
+
+// Waits a little longer each time it is called: spins first, then yields, then sleeps, so a
+// stage with nothing to do hands its core to the stages that have work
+class Backoff {
+private:
+    unsigned rounds = 0;
+
+public:
+    void wait() {
+        if (rounds < 64) {
+            rounds++;
+        }
+        else if (rounds < 128) {
+            rounds++;
+            this_thread::yield();
+        }
+        else {
+            this_thread::sleep_for(chrono::microseconds(50));
+        }
+    }
+};
+
+// Bounded single-producer, single-consumer ring. Lock-free: the producer is the only writer
+// of tail and the consumer the only writer of head, so each side needs one acquire load of
+// the other's index. push waits while the ring is full, which is what holds a fast stage
+// back to the pace of the one after it.
+template <typename T>
+class SpscQueue {
+private:
+    vector<T> slots;
+    alignas(64) atomic<size_t> head{ 0 };   // next slot to pop
+    alignas(64) atomic<size_t> tail{ 0 };   // next slot to push
+    alignas(64) atomic<bool> closed{ false };
+
+public:
+    explicit SpscQueue(size_t capacity) : slots(capacity + 1) {}
+
+    // Returns the nanoseconds spent waiting for room
+    uint64_t push(T&& value) {
+        size_t at = tail.load(memory_order_relaxed);
+        size_t next = at + 1 == slots.size() ? 0 : at + 1;
+        if (next == head.load(memory_order_acquire)) {
+            Stopwatch waited;
+            Backoff backoff;
+            while (next == head.load(memory_order_acquire)) {
+                backoff.wait();
+            }
+            slots[at] = move(value);
+            tail.store(next, memory_order_release);
+            return waited.nanoseconds();
+        }
+        slots[at] = move(value);
+        tail.store(next, memory_order_release);
+        return 0;
+    }
+
+    // No more pushes; pop returns false once the ring is drained
+    void close() {
+        closed.store(true, memory_order_release);
+    }
+
+    // Waits for the next value, adding the time spent waiting to waitedNanoseconds. Returns
+    // false when the producer has closed the queue and everything has been popped.
+    bool pop(T& value, uint64_t& waitedNanoseconds) {
+        size_t at = head.load(memory_order_relaxed);
+        if (at == tail.load(memory_order_acquire)) {
+            Stopwatch waited;
+            Backoff backoff;
+            while (at == tail.load(memory_order_acquire)) {
+                // closed is set after the last push, so a closed queue that still looks
+                // empty after a second look really is
+                if (closed.load(memory_order_acquire) && at == tail.load(memory_order_acquire)) {
+                    waitedNanoseconds += waited.nanoseconds();
+                    return false;
+                }
+                backoff.wait();
+            }
+            waitedNanoseconds += waited.nanoseconds();
+        }
+        value = move(slots[at]);
+        head.store(at + 1 == slots.size() ? 0 : at + 1, memory_order_release);
+        return true;
+    }
+};
+
+// Lifetime and waiting time of one stage thread; the rest of its lifetime is work
+struct StageTimes {
+    uint64_t lifetimeNanoseconds = 0;
+    uint64_t waitNanoseconds = 0;
+
+    uint64_t busyNanoseconds() const {
+        return lifetimeNanoseconds - min(lifetimeNanoseconds, waitNanoseconds);
+    }
+};
+
+// Repository init as a pipeline instead of read, parse, build and save one after another:
+//
+//   reader --blocks--> parsers --sorted key runs--> merge (the caller) --> tree build, hash, pack
+//                              \--row blocks-----> row writer (sorts and writes the row file)
+//
+// The reader cuts the file into large blocks at row boundaries and deals them out to the
+// parsers in turn; the merge and row writer stages collect from the parsers in the same
+// turn, so file order is kept without sequence numbers. Several key columns can be read in
+// the same pass: each parsed block then carries a sorted run per column, merged column by
+// column, and the rows are sorted by the first. Every queue is bounded, so a stage
+// that falls behind slows down the ones feeding it instead of piling up blocks. The parsers
+// keep the rows they parse for the row writer, so the file is read once instead of twice.
+// The row writer hands each block to a RowSorter as it arrives, which spills sorted runs to
+// disk past its memory budget, so the rows in memory stay bounded by the budget and the
+// queues rather than the file size; the runs are merged into the row file while the caller
+// builds, hashes and saves the tree.
+class InitPipeline {
+private:
+    struct ParsedBlock {
+        vector<string> keys;   // sorted, duplicate-free
+        CSVRowBlock rows;
+    };
+
+    string csvPath;
+    uint64_t dataBegin = 0;
+    vector<size_t> keyColumns; // the row file is sorted by the first
+    vector<string> header;
+    string rowsPath;
+    size_t parserCount;
+    size_t blockSize;
+
+    vector<unique_ptr<SpscQueue<string>>> blockQueues;       // reader -> parser i
+    vector<unique_ptr<SpscQueue<vector<vector<string>>>>> runQueues; // parser i -> merge, a run per column
+    vector<unique_ptr<SpscQueue<CSVRowBlock>>> rowQueues;    // parser i -> row writer
+    vector<thread> threads;
+
+    Stopwatch wall;
+    StageTimes readTimes;
+    vector<StageTimes> parseTimes;
+    StageTimes mergeTimes;
+    StageTimes writeTimes;
+    uint64_t totalBytesRead = 0;
+    atomic<bool> readFailed{ false };
+    bool keysTaken = false;
+    bool rowsWritten = false;
+    bool started = false;
+    RowStoreWriter writer;
+
+    void readStage() {
+        Stopwatch lifetime;
+        ifstream file(csvPath, ios::binary);
+        if (!file || !file.seekg(static_cast<streamoff>(dataBegin))) {
+            readFailed = true;
+        }
+        string carry;
+        size_t next = 0;
+        while (!readFailed) {
+            string block = move(carry);
+            size_t kept = block.size();
+            block.resize(kept + blockSize);
+            file.read(&block[kept], static_cast<streamsize>(blockSize));
+            size_t got = static_cast<size_t>(file.gcount());
+            block.resize(kept + got);
+            totalBytesRead += got;
+            if (got == 0) {
+                if (!block.empty()) {
+                    readTimes.waitNanoseconds += blockQueues[next]->push(move(block)); // last row, no newline
+                }
+                break;
+            }
+            size_t length = CSVReader::completeRowsLength(block);
+            if (length == 0) {
+                carry = move(block); // one row longer than a block: read more of it
+                continue;
+            }
+            carry.assign(block, length, string::npos);
+            block.resize(length);
+            readTimes.waitNanoseconds += blockQueues[next]->push(move(block));
+            next = (next + 1) % parserCount;
+        }
+        for (unique_ptr<SpscQueue<string>>& queue : blockQueues) {
+            queue->close();
+        }
+        readTimes.lifetimeNanoseconds = lifetime.nanoseconds();
+    }
+
+    // Splits each block into rows, keeping the rows and handing on the block's keys sorted,
+    // column by column
+    void parseStage(size_t index) {
+        Stopwatch lifetime;
+        StageTimes& times = parseTimes[index];
+        string block;
+        string scratch;
+        while (blockQueues[index]->pop(block, times.waitNanoseconds)) {
+            CSVRowBlock rows;
+            rows.text = move(block);
+            string unescaped; // keys that had quotes removed, stored after the rows
+            vector<vector<string>> keys(keyColumns.size());
+            const char* base = rows.text.data();
+            CSVReader::forEachRow(rows.text, [&](string_view row) {
+                CSVRowBlock::RowSpan span{ uint64_t(row.data() - base), uint64_t(row.data() - base), static_cast<uint32_t>(row.size()), 0 };
+                string_view field;
+                for (size_t slot = 0; slot < keyColumns.size(); slot++) {
+                    if (!CSVReader::extractField(row, keyColumns[slot], field, scratch)) continue;
+                    if (slot == 0) {
+                        span.keyLength = static_cast<uint32_t>(field.size());
+                        if (field.data() >= row.data() && field.data() + field.size() <= row.data() + row.size()) {
+                            span.keyOffset = uint64_t(field.data() - base);
+                        }
+                        else {
+                            span.keyOffset = rows.text.size() + unescaped.size();
+                            unescaped.append(field);
+                        }
+                    }
+                    keys[slot].emplace_back(field);
+                }
+                rows.spans.push_back(span);
+            });
+            rows.text += unescaped;
+            for (vector<string>& columnKeys : keys) {
+                sort(columnKeys.begin(), columnKeys.end());
+                columnKeys.erase(unique(columnKeys.begin(), columnKeys.end()), columnKeys.end());
+            }
+            times.waitNanoseconds += runQueues[index]->push(move(keys));
+            times.waitNanoseconds += rowQueues[index]->push(move(rows));
+        }
+        runQueues[index]->close();
+        rowQueues[index]->close();
+        times.lifetimeNanoseconds = lifetime.nanoseconds();
+    }
+
+    void writeStage() {
+        Stopwatch lifetime;
+        RowSorter sorter(rowsPath);
+        CSVRowBlock rows;
+        for (size_t i = 0; rowQueues[i]->pop(rows, writeTimes.waitNanoseconds); i = (i + 1) % parserCount) {
+            sorter.addBlock(move(rows));
+        }
+        if (!readFailed) {
+            rowsWritten = sorter.write(header, rowsPath, keyColumns[0], writer);
+        }
+        writeTimes.lifetimeNanoseconds = lifetime.nanoseconds();
+    }
+
+public:
+    // parsers == 0 means one parser per hardware core
+    explicit InitPipeline(size_t parsers = 1, size_t blockBytes = CSVReader::DEFAULT_BLOCK_SIZE)
+        : parserCount(parsers), blockSize(max<size_t>(blockBytes, 1)) {
+        if (parserCount == 0) {
+            parserCount = max<size_t>(1, thread::hardware_concurrency());
+        }
+    }
+
+    ~InitPipeline() {
+        if (started && !keysTaken) {
+            takeColumnKeys(); // lets the parsers finish so their threads can be joined
+        }
+        for (thread& worker : threads) {
+            if (worker.joinable()) worker.join();
+        }
+    }
+
+    InitPipeline(const InitPipeline&) = delete;
+    InitPipeline& operator=(const InitPipeline&) = delete;
+
+    // Starts the reader, parser and row writer threads on the rows from dataBegin on (after
+    // the header) and returns at once
+    void start(const string& fileName, uint64_t rowsBegin, size_t column, const vector<string>& columnNames, const string& rowFile) {
+        start(fileName, rowsBegin, vector<size_t>(1, column), columnNames, rowFile);
+    }
+
+    // The same for several key columns; the row file is sorted by the first
+    void start(const string& fileName, uint64_t rowsBegin, const vector<size_t>& columns, const vector<string>& columnNames, const string& rowFile) {
+        csvPath = fileName;
+        dataBegin = rowsBegin;
+        keyColumns = columns;
+        header = columnNames;
+        rowsPath = rowFile;
+        parseTimes.resize(parserCount);
+        for (size_t i = 0; i < parserCount; i++) {
+            blockQueues.push_back(make_unique<SpscQueue<string>>(2));
+            runQueues.push_back(make_unique<SpscQueue<vector<vector<string>>>>(4));
+            rowQueues.push_back(make_unique<SpscQueue<CSVRowBlock>>(4));
+        }
+        wall = Stopwatch();
+        started = true;
+        threads.emplace_back([this] { readStage(); });
+        for (size_t i = 0; i < parserCount; i++) {
+            threads.emplace_back([this, i] { parseStage(i); });
+        }
+        threads.emplace_back([this] { writeStage(); });
+    }
+
+    // Runs the merge stage on the calling thread and returns every key of each key column,
+    // sorted and duplicate-free. Runs are merged as they arrive, smaller ones first, like the
+    // levels of a binary counter, so each key is merged O(log runs) times.
+    vector<vector<string>> takeColumnKeys() {
+        Stopwatch lifetime;
+        keysTaken = true;
+        vector<vector<vector<string>>> levels(keyColumns.size()); // per column, sizes shrinking toward the back
+        vector<vector<string>> runs;
+        for (size_t i = 0; runQueues[i]->pop(runs, mergeTimes.waitNanoseconds); i = (i + 1) % parserCount) {
+            for (size_t slot = 0; slot < runs.size(); slot++) {
+                vector<vector<string>>& column = levels[slot];
+                column.push_back(move(runs[slot]));
+                while (column.size() >= 2 && column.back().size() * 2 >= column[column.size() - 2].size()) {
+                    vector<string> merged = mergeSortedRuns(move(column[column.size() - 2]), move(column.back()));
+                    column.pop_back();
+                    column.back() = move(merged);
+                }
+            }
+        }
+        vector<vector<string>> keys(keyColumns.size());
+        for (size_t slot = 0; slot < levels.size(); slot++) {
+            vector<vector<string>>& column = levels[slot];
+            while (column.size() >= 2) {
+                vector<string> merged = mergeSortedRuns(move(column[column.size() - 2]), move(column.back()));
+                column.pop_back();
+                column.back() = move(merged);
+            }
+            if (!column.empty()) keys[slot] = move(column.back());
+        }
+        mergeTimes.lifetimeNanoseconds = lifetime.nanoseconds();
+        return keys;
+    }
+
+    // The keys of the only key column
+    vector<string> takeKeys() {
+        vector<vector<string>> keys = takeColumnKeys();
+        return keys.empty() ? vector<string>() : move(keys[0]);
+    }
+
+    // Waits for the reader, parsers and row writer; false if the file couldn't be read or
+    // the row file couldn't be written
+    bool finish() {
+        for (thread& worker : threads) {
+            if (worker.joinable()) worker.join();
+        }
+        if (readFailed) {
+            cerr << "Error: Unable to read rows from " << csvPath << endl;
+        }
+        return !readFailed && rowsWritten;
+    }
+
+    bool failed() const {
+        return readFailed;
+    }
+
+    const RowStoreWriter& rowWriter() const {
+        return writer;
+    }
+
+    uint64_t bytesRead() const {
+        return totalBytesRead;
+    }
+
+    // Each stage's work time and its share of the pipeline's wall time so far (the parsers
+    // share theirs between them); call after finish
+    void reportStages(RunReport& report) const {
+        uint64_t elapsed = wall.nanoseconds();
+        uint64_t parseBusy = 0;
+        for (const StageTimes& times : parseTimes) {
+            parseBusy += times.busyNanoseconds();
+        }
+        report.addStage("read", readTimes.busyNanoseconds(), elapsed);
+        report.addStage("parse", parseBusy, elapsed * parserCount);
+        report.addStage("merge", mergeTimes.busyNanoseconds(), elapsed);
+        report.addStage("rows", writeTimes.busyNanoseconds(), elapsed);
+    }
+};
@@ -0,0 +1,170 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+using namespace std;
+
+// Per-node console logging (insert, save, missed delete). Off unless --verbose: on large
+// files the formatting and flushing cost more than the tree work being logged.
+inline bool verboseLogging = false;
+
+// Elapsed time of a scope or phase, read from the monotonic clock
+class Stopwatch {
+private:
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+public:
+    uint64_t nanoseconds() const {
+        return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+    }
+
+    double milliseconds() const {
+        return nanoseconds() / 1e6;
+    }
+};
+
+// Largest resident set of the process so far, or 0 where it can't be read
+inline uint64_t peakResidentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss);        // bytes
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024; // KiB
+#endif
+#endif
+}
+
+// Phase times and counters of one repository operation, printed as one JSON object at the
+// end. Everything is recorded per phase or read from totals the trees and readers keep
+// anyway, never per node, so a report costs the same for any file size.
+class RunReport {
+private:
+    string operation;
+    Stopwatch wall;
+    vector<pair<string, uint64_t>> phases;   // nanoseconds, in the order first recorded
+    vector<pair<string, uint64_t>> counters;
+
+    // A stage of work that ran alongside others: time spent working, and the wall time of
+    // the threads it had
+    struct Stage {
+        string name;
+        uint64_t busyNanoseconds;
+        uint64_t availableNanoseconds;
+    };
+    vector<Stage> stages;
+
+    static void add(vector<pair<string, uint64_t>>& entries, const string& name, uint64_t value) {
+        for (pair<string, uint64_t>& entry : entries) {
+            if (entry.first == name) {
+                entry.second += value;
+                return;
+            }
+        }
+        entries.emplace_back(name, value);
+    }
+
+    // Writes text as a JSON string. Names can come from CSV headers, so every control
+    // character is escaped, not just quotes and backslashes.
+    static void writeEscaped(ostream& out, const string& text) {
+        static const char hexDigits[] = "0123456789abcdef";
+        out << '"';
+        for (char c : text) {
+            unsigned char byte = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\') out << '\\' << c;
+            else if (c == '\n') out << "\\n";
+            else if (c == '\r') out << "\\r";
+            else if (c == '\t') out << "\\t";
+            else if (byte < 0x20) out << "\\u00" << hexDigits[byte >> 4] << hexDigits[byte & 0xF];
+            else out << c;
+        }
+        out << '"';
+    }
+
+public:
+    explicit RunReport(const string& operationName) : operation(operationName) {}
+
+    // Adds to a phase; a phase recorded twice is summed
+    void addPhase(const string& name, uint64_t nanoseconds) {
+        add(phases, name, nanoseconds);
+    }
+
+    void addCounter(const string& name, uint64_t value) {
+        add(counters, name, value);
+    }
+
+    // Adds another report's phases, each name followed by suffix: work on other threads is
+    // timed into reports of its own and gathered here once the threads are done
+    void addPhases(const RunReport& other, const string& suffix) {
+        for (const pair<string, uint64_t>& phase : other.phases) {
+            add(phases, phase.first + suffix, phase.second);
+        }
+    }
+
+    // Records a concurrent stage; its utilization is busy time over available time
+    void addStage(const string& name, uint64_t busyNanoseconds, uint64_t availableNanoseconds) {
+        stages.push_back(Stage{ name, busyNanoseconds, availableNanoseconds });
+    }
+
+    // Times the phase from construction to destruction
+    class Phase {
+    private:
+        RunReport& report;
+        string name;
+        Stopwatch timer;
+
+    public:
+        Phase(RunReport& owner, const string& phaseName) : report(owner), name(phaseName) {}
+
+        ~Phase() {
+            report.addPhase(name, timer.nanoseconds());
+        }
+    };
+
+    void writeJSON(ostream& out) const {
+        out << "{\"operation\": ";
+        writeEscaped(out, operation);
+        out << ", \"phases_ms\": {";
+        for (size_t i = 0; i < phases.size(); i++) {
+            out << (i ? ", " : "");
+            writeEscaped(out, phases[i].first);
+            out << ": " << phases[i].second / 1e6;
+        }
+        out << "}, \"counters\": {";
+        for (size_t i = 0; i < counters.size(); i++) {
+            out << (i ? ", " : "");
+            writeEscaped(out, counters[i].first);
+            out << ": " << counters[i].second;
+        }
+        out << "}";
+        if (!stages.empty()) {
+            out << ", \"stages\": {";
+            for (size_t i = 0; i < stages.size(); i++) {
+                out << (i ? ", " : "");
+                writeEscaped(out, stages[i].name);
+                double utilization = stages[i].availableNanoseconds ? double(stages[i].busyNanoseconds) / stages[i].availableNanoseconds : 0;
+                out << ": {\"busy_ms\": " << stages[i].busyNanoseconds / 1e6 << ", \"utilization\": " << utilization << "}";
+            }
+            out << "}";
+        }
+        out << ", \"wall_ms\": " << wall.milliseconds() << ", \"peak_rss_bytes\": " << peakResidentBytes() << "}" << endl;
+    }
+};
@@ -0,0 +1,83 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include "Hash.h"
+using namespace std;
+
+// Streaming view of the keys in [start, upper) of a tree. It walks the tree's own in-order
+// iterator and stops at the first key >= upper, so nothing is materialized and a slice costs
+// O(log n + keys returned). Use it in a range-for, or step it by hand with valid()/next()
+// to pause and resume. Any insert or remove invalidates it.
+template <typename Iterator, typename Key>
+class KeyRange {
+private:
+    Iterator current;
+    Iterator stop;      // the tree's end()
+    Key upper;
+    bool hasUpper;
+
+public:
+    struct End {};
+
+    class Position {
+    private:
+        KeyRange* range;
+
+    public:
+        explicit Position(KeyRange* owner) : range(owner) {}
+
+        const Key& operator*() const {
+            return range->key();
+        }
+
+        Position& operator++() {
+            range->next();
+            return *this;
+        }
+
+        // Compared against End by range-for
+        bool operator!=(const End&) const {
+            return range->valid();
+        }
+    };
+
+    KeyRange(Iterator start, Iterator treeEnd, Key upperBound, bool bounded)
+        : current(start), stop(treeEnd), upper(move(upperBound)), hasUpper(bounded) {}
+
+    bool valid() const {
+        return current != stop && (!hasUpper || *current < upper);
+    }
+
+    const Key& key() const {
+        return *current;
+    }
+
+    // Merkle hash of the current key's subtree
+    const HashDigest& hash() const {
+        return current.hash();
+    }
+
+    void next() {
+        ++current;
+    }
+
+    Position begin() {
+        return Position(this);
+    }
+
+    End end() const {
+        return End();
+    }
+};
+
+// Smallest string greater than every string starting with prefix, for turning a prefix
+// scan into [prefix, upper). Returns false if there is none (prefix is empty or all 0xFF).
+inline bool prefixUpperBound(string_view prefix, string& upper) {
+    upper.assign(prefix.data(), prefix.size());
+    while (!upper.empty() && static_cast<unsigned char>(upper.back()) == 0xFF) {
+        upper.pop_back();
+    }
+    if (upper.empty()) return false;
+    upper.back() = static_cast<char>(static_cast<unsigned char>(upper.back()) + 1);
+    return true;
+}
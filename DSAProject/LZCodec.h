@@ -0,0 +1,126 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+using namespace std;
+
+// Byte-oriented LZ77 block codec in the style of LZ4: fast to decode, no entropy coding.
+// A block is a run of sequences, each one
+//
+//   [token][literal length extra][literals][offset u16][match length extra]
+//
+// The token's high nibble is the literal count and its low nibble the match length minus 4;
+// a nibble of 15 continues in extra bytes of 255 until a byte below 255. The last sequence
+// has literals only and ends the block. Matches reach back at most 65535 bytes.
+const size_t LZ_MIN_MATCH = 4;
+const size_t LZ_MAX_OFFSET = 65535;
+
+inline void lzWriteLength(vector<uint8_t>& out, size_t length) {
+    while (length >= 255) {
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back(static_cast<uint8_t>(length));
+}
+
+inline void lzWriteSequence(vector<uint8_t>& out, const uint8_t* literals, size_t literalCount, size_t offset, size_t matchLength) {
+    size_t matchCode = matchLength == 0 ? 0 : matchLength - LZ_MIN_MATCH;
+    out.push_back(static_cast<uint8_t>((min<size_t>(literalCount, 15) << 4) | min<size_t>(matchCode, 15)));
+    if (literalCount >= 15) lzWriteLength(out, literalCount - 15);
+    out.insert(out.end(), literals, literals + literalCount);
+    if (matchLength == 0) return;
+    out.push_back(static_cast<uint8_t>(offset));
+    out.push_back(static_cast<uint8_t>(offset >> 8));
+    if (matchCode >= 15) lzWriteLength(out, matchCode - 15);
+}
+
+// Appends the compressed form of src to out. Greedy matching through a hash table of the
+// last position each 4-byte sequence was seen at.
+inline void lzCompress(const uint8_t* src, size_t size, vector<uint8_t>& out) {
+    const int HASH_BITS = 14;
+    vector<uint32_t> table(size_t(1) << HASH_BITS, 0xFFFFFFFFu);
+    auto hashAt = [&](size_t pos) {
+        uint32_t sequence;
+        memcpy(&sequence, src + pos, sizeof(sequence));
+        return (sequence * 2654435761u) >> (32 - HASH_BITS);
+    };
+
+    size_t literalStart = 0;
+    size_t pos = 0;
+    while (pos + LZ_MIN_MATCH <= size) {
+        uint32_t& slot = table[hashAt(pos)];
+        size_t candidate = slot;
+        slot = static_cast<uint32_t>(pos);
+        if (candidate == 0xFFFFFFFFu || pos - candidate > LZ_MAX_OFFSET || memcmp(src + candidate, src + pos, LZ_MIN_MATCH) != 0) {
+            pos++;
+            continue;
+        }
+        size_t length = LZ_MIN_MATCH;
+        while (pos + length < size && src[candidate + length] == src[pos + length]) {
+            length++;
+        }
+        lzWriteSequence(out, src + literalStart, pos - literalStart, pos - candidate, length);
+        pos += length;
+        literalStart = pos;
+    }
+    lzWriteSequence(out, src + literalStart, size - literalStart, 0, 0);
+}
+
+// Decodes a block into exactly rawSize bytes at dst. Returns false for a corrupt block
+// instead of reading or writing out of bounds.
+inline bool lzDecompress(const uint8_t* src, size_t size, uint8_t* dst, size_t rawSize) {
+    const uint8_t* in = src;
+    const uint8_t* inEnd = src + size;
+    size_t out = 0;
+    auto readLength = [&](size_t& length) {
+        uint8_t extra;
+        do {
+            if (in >= inEnd) return false;
+            extra = *in++;
+            length += extra;
+        } while (extra == 255);
+        return true;
+    };
+
+    while (in < inEnd) {
+        uint8_t token = *in++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(literals)) return false;
+        if (literals > size_t(inEnd - in) || literals > rawSize - out) return false;
+        // Short runs are copied as one fixed 16 bytes when there is room on both sides; the
+        // bytes past the run are overwritten by what comes next
+        if (literals <= 16 && inEnd - in >= 16 && rawSize - out >= 16) {
+            memcpy(dst + out, in, 16);
+        }
+        else {
+            memcpy(dst + out, in, literals);
+        }
+        in += literals;
+        out += literals;
+        if (in == inEnd) break; // the last sequence has no match
+
+        if (inEnd - in < 2) return false;
+        size_t offset = in[0] | (size_t(in[1]) << 8);
+        in += 2;
+        size_t length = token & 15;
+        if (length == 15 && !readLength(length)) return false;
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > out || length > rawSize - out) return false;
+        if (offset >= 16 && length <= 16 && rawSize - out >= 16) {
+            memcpy(dst + out, dst + out - offset, 16);
+            out += length;
+            continue;
+        }
+        // A match closer than its length repeats itself; copy it offset bytes at a time
+        // so that no single copy overlaps
+        while (length > 0) {
+            size_t piece = min(offset, length);
+            memcpy(dst + out, dst + out - offset, piece);
+            out += piece;
+            length -= piece;
+        }
+    }
+    return out == rawSize;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include "PackFile.h"
+#include "MappedFile.h"
+using namespace std;
+
+// Read-only tree searched directly inside a memory-mapped pack file (written by
+// AVLTree::savePack or RBTree::savePack). Opening only checks the footer, so it takes the
+// same time for any repository size, and a lookup only faults in the pages on its path.
+class MappedTree {
+private:
+    MappedFile file;
+    PackFooter footer;
+    const PackRecord* records = nullptr;
+    const char* keys = nullptr;
+
+    // Deeper than any balanced tree of 2^32 nodes; stops a corrupt file from looping
+    static const int MAX_DEPTH = 128;
+
+public:
+    bool open(const string& path) {
+        records = nullptr;
+        keys = nullptr;
+        if (!file.open(path)) {
+            cerr << "Error: Unable to map pack file " << path << endl;
+            return false;
+        }
+        memcpy(&footer, file.data() + file.size() - sizeof(footer), sizeof(footer));
+        if (!isValidPackFooter(footer, file.size())) {
+            cerr << "Error: " << path << " is not a valid pack file" << endl;
+            file.close();
+            return false;
+        }
+        // The mapping is page-aligned and records start at offset 0 in 56-byte steps,
+        // so they can be read in place
+        records = reinterpret_cast<const PackRecord*>(file.data() + footer.recordsOffset);
+        keys = file.data() + footer.keysOffset;
+        return true;
+    }
+
+    void close() {
+        file.close();
+        records = nullptr;
+        keys = nullptr;
+    }
+
+    uint64_t size() const {
+        return records ? footer.nodeCount : 0;
+    }
+
+    string hashMethod() const {
+        return string(footer.hashMethod, strnlen(footer.hashMethod, sizeof(footer.hashMethod)));
+    }
+
+    uint32_t rootIndex() const {
+        return size() > 0 ? footer.rootIndex : PACK_NO_NODE;
+    }
+
+    const PackRecord& record(uint32_t index) const {
+        return records[index];
+    }
+
+    string_view key(uint32_t index) const {
+        const PackRecord& node = records[index];
+        if (node.keyOffset > footer.keysSize || node.keyLength > footer.keysSize - node.keyOffset) return string_view();
+        return string_view(keys + node.keyOffset, node.keyLength);
+    }
+
+    HashDigest rootHash() const {
+        return size() > 0 ? records[footer.rootIndex].hash : HashDigest();
+    }
+
+    // Record index of the i-th smallest key
+    uint32_t inOrder(uint64_t position) const {
+        uint32_t index;
+        memcpy(&index, file.data() + footer.indexOffset + position * sizeof(uint32_t), sizeof(index));
+        return index;
+    }
+
+    // Walks the stored tree from the root; returns the record index or PACK_NO_NODE
+    uint32_t find(string_view wanted) const {
+        uint32_t current = rootIndex();
+        for (int depth = 0; current != PACK_NO_NODE && current < footer.nodeCount && depth < MAX_DEPTH; depth++) {
+            int order = wanted.compare(key(current));
+            if (order == 0) return current;
+            current = order < 0 ? records[current].left : records[current].right;
+        }
+        return PACK_NO_NODE;
+    }
+
+    bool contains(string_view wanted) const {
+        return find(wanted) != PACK_NO_NODE;
+    }
+};
@@ -0,0 +1,260 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include "Hash.h"
+#include "MappedTree.h"
+#include "CommitDelta.h"
+using namespace std;
+
+struct DiffStats {
+    uint64_t nodesVisited = 0;    // records read, including spine walks
+    uint64_t subtreesSkipped = 0; // equal-hash subtrees pruned without being read
+};
+
+// In-order walk over a mapped pack that can step over a whole subtree at once. The stack
+// holds what is left to visit, smallest keys on top: either an unopened subtree or a single
+// node whose key is next.
+class PackCursor {
+private:
+    struct Entry {
+        uint32_t index;
+        bool subtree;
+        uint32_t first; // smallest and largest node of the subtree, once known
+        uint32_t last;
+    };
+
+    const MappedTree& tree;
+    vector<Entry> stack;
+    DiffStats& stats;
+    bool corrupt = false;
+
+    // A balanced tree of 2^32 nodes never gets close; stops a corrupt file from looping
+    static const size_t MAX_STACK = 3 * 128;
+
+    void push(uint32_t index, bool subtree, uint32_t first = PACK_NO_NODE, uint32_t last = PACK_NO_NODE) {
+        if (index == PACK_NO_NODE) return;
+        if (index >= tree.size() || stack.size() >= MAX_STACK) {
+            corrupt = true;
+            return;
+        }
+        stack.push_back(Entry{ index, subtree, first, last });
+    }
+
+    // Last node on the left (or right) spine of a subtree
+    uint32_t spineEnd(uint32_t index, bool left) const {
+        for (size_t depth = 0; depth < MAX_STACK; depth++) {
+            stats.nodesVisited++;
+            uint32_t next = left ? tree.record(index).left : tree.record(index).right;
+            if (next == PACK_NO_NODE || next >= tree.size()) break;
+            index = next;
+        }
+        return index;
+    }
+
+public:
+    PackCursor(const MappedTree& packTree, DiffStats& diffStats) : tree(packTree), stats(diffStats) {
+        push(tree.rootIndex(), true);
+    }
+
+    bool done() const {
+        return stack.empty() || corrupt;
+    }
+
+    bool isCorrupt() const {
+        return corrupt;
+    }
+
+    bool atSubtree() const {
+        return stack.back().subtree;
+    }
+
+    const HashDigest& hash() const {
+        return tree.record(stack.back().index).hash;
+    }
+
+    // Key of the top node (only when !atSubtree())
+    string_view key() const {
+        return tree.key(stack.back().index);
+    }
+
+    // Smallest and largest key of the top subtree. The ends found are passed down to the
+    // children that share them, so each spine is walked about once.
+    string_view minKey() {
+        Entry& top = stack.back();
+        if (top.first == PACK_NO_NODE) top.first = spineEnd(top.index, true);
+        return tree.key(top.first);
+    }
+
+    string_view maxKey() {
+        Entry& top = stack.back();
+        if (top.last == PACK_NO_NODE) top.last = spineEnd(top.index, false);
+        return tree.key(top.last);
+    }
+
+    // Opens the top subtree: its left subtree, then its key, then its right subtree
+    void expand() {
+        Entry top = stack.back();
+        stack.pop_back();
+        stats.nodesVisited++;
+        const PackRecord& record = tree.record(top.index);
+        push(record.right, true, PACK_NO_NODE, top.last);
+        push(top.index, false);
+        push(record.left, true, top.first, PACK_NO_NODE);
+    }
+
+    void pop() {
+        stack.pop_back();
+    }
+};
+
+// Key-by-key comparison: merges the two packs' sorted indexes, reading every record once
+inline bool mergeDiffPacks(const MappedTree& from, const MappedTree& to, KeyDelta& delta, DiffStats& stats) {
+    auto keyAt = [](const MappedTree& tree, uint64_t position, bool& corrupt) {
+        uint32_t index = tree.inOrder(position);
+        if (index >= tree.size()) {
+            corrupt = true;
+            return string_view();
+        }
+        return tree.key(index);
+    };
+    bool corrupt = false;
+    uint64_t i = 0, j = 0;
+    while (i < from.size() && j < to.size() && !corrupt) {
+        string_view a = keyAt(from, i, corrupt);
+        string_view b = keyAt(to, j, corrupt);
+        int order = a.compare(b);
+        if (order < 0) {
+            delta.removed.emplace_back(a);
+            i++;
+        }
+        else if (order > 0) {
+            delta.added.emplace_back(b);
+            j++;
+        }
+        else {
+            i++;
+            j++;
+        }
+    }
+    for (; i < from.size() && !corrupt; i++) {
+        delta.removed.emplace_back(keyAt(from, i, corrupt));
+    }
+    for (; j < to.size() && !corrupt; j++) {
+        delta.added.emplace_back(keyAt(to, j, corrupt));
+    }
+    stats.nodesVisited += from.size() + to.size();
+    if (corrupt) {
+        cerr << "Error: Corrupt pack file, diff stopped" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Keys removed from and added to the tree in 'from' to get the tree in 'to'. Both trees are
+// walked top-down in key order; whenever the next unvisited subtrees of both sides have the
+// same hash they hold the same keys and are skipped whole, so the work grows with the size
+// of the change, not of the trees. Its reads are scattered, though, so once it has read a
+// quarter as many records as a merge would (somewhere under 1% churn) it gives up and merges
+// instead, and a large diff costs a little more than a merge.
+//
+// Only SHA-256 hashes cover the keys of a subtree (the instructor hash of an internal node
+// ignores its key), so packs with other hashes are always merged. The trees only store
+// keys, so a modified row shows up as one removed and one added key.
+inline bool diffPacks(const MappedTree& from, const MappedTree& to, KeyDelta& delta, DiffStats& stats) {
+    if (from.hashMethod() != to.hashMethod() || from.hashMethod() != Sha256Hasher::name()) {
+        return mergeDiffPacks(from, to, delta, stats);
+    }
+    const uint64_t budget = stats.nodesVisited + (from.size() + to.size()) / 4;
+    const size_t removedBefore = delta.removed.size();
+    const size_t addedBefore = delta.added.size();
+    PackCursor a(from, stats);
+    PackCursor b(to, stats);
+
+    while (!a.done() && !b.done()) {
+        if (stats.nodesVisited > budget) {
+            delta.removed.resize(removedBefore);
+            delta.added.resize(addedBefore);
+            return mergeDiffPacks(from, to, delta, stats);
+        }
+        if (a.atSubtree() && b.atSubtree()) {
+            if (a.hash() == b.hash()) {
+                a.pop();
+                b.pop();
+                stats.subtreesSkipped++;
+                continue;
+            }
+            // Open the subtree that reaches lower, or if both start at the same key, the one
+            // that reaches higher: the other may still match one of its children
+            int order = a.minKey().compare(b.minKey());
+            if (order == 0) {
+                order = b.maxKey().compare(a.maxKey());
+                if (order == 0) {
+                    a.expand();
+                    b.expand();
+                    continue;
+                }
+            }
+            if (order < 0) a.expand();
+            else b.expand();
+        }
+        else if (a.atSubtree()) {
+            // A key below everything left in the other tree can't be in it
+            if (b.key() < a.minKey()) {
+                delta.added.emplace_back(b.key());
+                b.pop();
+            }
+            else {
+                a.expand();
+            }
+        }
+        else if (b.atSubtree()) {
+            if (a.key() < b.minKey()) {
+                delta.removed.emplace_back(a.key());
+                a.pop();
+            }
+            else {
+                b.expand();
+            }
+        }
+        else {
+            int order = a.key().compare(b.key());
+            if (order < 0) {
+                delta.removed.emplace_back(a.key());
+                a.pop();
+            }
+            else if (order > 0) {
+                delta.added.emplace_back(b.key());
+                b.pop();
+            }
+            else {
+                a.pop();
+                b.pop();
+            }
+        }
+    }
+    while (!a.done()) {
+        if (a.atSubtree()) {
+            a.expand();
+            continue;
+        }
+        delta.removed.emplace_back(a.key());
+        a.pop();
+    }
+    while (!b.done()) {
+        if (b.atSubtree()) {
+            b.expand();
+            continue;
+        }
+        delta.added.emplace_back(b.key());
+        b.pop();
+    }
+
+    if (a.isCorrupt() || b.isCorrupt()) {
+        cerr << "Error: Corrupt pack file, diff stopped" << endl;
+        return false;
+    }
+    return true;
+}
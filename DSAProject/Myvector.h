@@ -1,50 +1,182 @@
+#pragma once
 #include <iostream>
+#include <new>
+#include <memory>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
 using namespace std;
 
+// Growable array. Storage is raw memory: elements are constructed in place when added and
+// destroyed when removed, so growing moves each element once instead of default-constructing
+// a new array and copy-assigning into it. Elements are moved on growth unless their move
+// constructor can throw and they can be copied (then a failed growth leaves the vector as it was).
 template <typename T>
 class MyVector {
 private:
 
-    T* data;      
-    int size;
-    int length;  
+    T* data;
+    size_t size;     // capacity
+    size_t length;   // elements in use
 
-    void resize(int newSize) {
-        T* newData = new T[newSize];
-        for (int i = 0; i < length; ++i) {
-            newData[i] = data[i];
+    static T* allocate(size_t count) {
+        return static_cast<T*>(::operator new(count * sizeof(T)));
+    }
+
+    static void deallocate(T* block) {
+        ::operator delete(block);
+    }
+
+    void destroyAll() {
+        for (size_t i = 0; i < length; ++i) {
+            data[i].~T();
+        }
+        length = 0;
+    }
+
+    // Moves the elements into a new block of newSize; newData already holds anything the
+    // caller constructed past the old elements
+    void adopt(T* newData, size_t newSize) {
+        if constexpr (is_nothrow_move_constructible<T>::value || !is_copy_constructible<T>::value) {
+            uninitialized_move(data, data + length, newData);
+        }
+        else {
+            uninitialized_copy(data, data + length, newData);
         }
-        delete[] data;
+        size_t kept = length;
+        destroyAll();
+        deallocate(data);
         data = newData;
         size = newSize;
+        length = kept;
+    }
+
+    void resize(size_t newSize) {
+        T* newData = allocate(newSize);
+        try {
+            adopt(newData, newSize);
+        }
+        catch (...) {
+            deallocate(newData);
+            throw;
+        }
+    }
+
+    size_t grownSize() const {
+        return size == 0 ? 1 : size * 2;
     }
 
 public:
     MyVector() : data(nullptr), size(0), length(0) {}
 
+    MyVector(const MyVector& other) : data(nullptr), size(0), length(0) {
+        if (other.length == 0) return;
+        data = allocate(other.length);
+        try {
+            uninitialized_copy(other.data, other.data + other.length, data);
+        }
+        catch (...) {
+            deallocate(data);
+            throw;
+        }
+        size = other.length;
+        length = other.length;
+    }
+
+    MyVector(MyVector&& other) noexcept : data(other.data), size(other.size), length(other.length) {
+        other.data = nullptr;
+        other.size = 0;
+        other.length = 0;
+    }
+
+    MyVector& operator=(const MyVector& other) {
+        if (this != &other) {
+            MyVector copy(other);
+            swap(copy);
+        }
+        return *this;
+    }
+
+    MyVector& operator=(MyVector&& other) noexcept {
+        if (this != &other) {
+            destroyAll();
+            deallocate(data);
+            data = other.data;
+            size = other.size;
+            length = other.length;
+            other.data = nullptr;
+            other.size = 0;
+            other.length = 0;
+        }
+        return *this;
+    }
+
     ~MyVector() {
-        delete[] data;
+        destroyAll();
+        deallocate(data);
+    }
+
+    void swap(MyVector& other) noexcept {
+        std::swap(data, other.data);
+        std::swap(size, other.size);
+        std::swap(length, other.length);
+    }
+
+    // Makes room for capacity elements without changing the contents
+    void reserve(size_t capacity) {
+        if (capacity > size) {
+            resize(capacity);
+        }
+    }
+
+    // Constructs the element in place from args. When the vector grows, the new element is
+    // built before the old ones move, so args may refer to an element of this vector.
+    template <typename... Args>
+    T& emplace_back(Args&&... args) {
+        if (length < size) {
+            ::new (static_cast<void*>(data + length)) T(std::forward<Args>(args)...);
+            return data[length++];
+        }
+        size_t newSize = grownSize();
+        T* newData = allocate(newSize);
+        try {
+            ::new (static_cast<void*>(newData + length)) T(std::forward<Args>(args)...);
+        }
+        catch (...) {
+            deallocate(newData);
+            throw;
+        }
+        try {
+            adopt(newData, newSize);
+        }
+        catch (...) {
+            newData[length].~T();
+            deallocate(newData);
+            throw;
+        }
+        return data[length++];
     }
 
     void push_back(const T& value) {
-        if (length == size) 
-        {
-            if (size == 0)
-            {
-                resize(1);
-            }
-            else
-            {
-                resize(size * 2);
-            }
+        emplace_back(value);
+    }
+
+    void push_back(T&& value) {
+        emplace_back(std::move(value));
+    }
+
+    void pop_back() {
+        if (length == 0) {
+            cout << "Index out of range" << endl;
+            return;
         }
-        data[length++] = value;
+        data[--length].~T();
     }
 
-    T& operator[](int index) 
+    T& operator[](size_t index)
     {
         if (index >= length) {
-            cout<<"Index out of range"<<endl;
+            cout << "Index out of range" << endl;
         }
         return data[index];
     }
@@ -53,23 +185,31 @@ public:
         return data;
     }
 
-    const T& operator[](int index) const {
+    const T& operator[](size_t index) const {
         if (index >= length) {
             cout << "Index out of range" << endl;
         }
         return data[index];
     }
 
-    int getSize() const {
+    T& back() {
+        return data[length - 1];
+    }
+
+    const T& back() const {
+        return data[length - 1];
+    }
+
+    size_t getSize() const {
         return length;
     }
 
-    int getCapacity() const {
+    size_t getCapacity() const {
         return size;
     }
 
     T* begin() {
-        return data; 
+        return data;
     }
 
     bool empty() const {
@@ -78,17 +218,27 @@ public:
 
 
     T* end() {
-        return data + length; 
+        return data + length;
     }
 
     const T* end() const {
         return data + length;
     }
 
+    // Destroys the elements but keeps the storage, so a reused vector doesn't reallocate
     void clear() {
-        delete[] data;
-        data = nullptr;
-        size = 0;
-        length = 0;
+        destroyAll();
+    }
+
+    // Gives back the capacity that isn't in use
+    void shrink_to_fit() {
+        if (length == size) return;
+        if (length == 0) {
+            deallocate(data);
+            data = nullptr;
+            size = 0;
+            return;
+        }
+        resize(length);
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,126 @@
+#pragma once
+#include <vector>
+#include <new>
+#include <utility>
+#include <cstddef>
+using namespace std;
+
+// Slab allocator for tree nodes. Nodes are carved out of large contiguous slabs instead of
+// one heap allocation each, destroyed nodes go on a free list and are reused by the next
+// create(), and all slabs are released together when the arena is destroyed.
+//
+// The arena does not run destructors on its own: call destroy() for every live node whose
+// type owns memory (e.g. a string key). Trivially destructible nodes can just be dropped.
+template <typename Node>
+class NodeArena {
+private:
+    // A recycled slot; overlays the memory of the node that was destroyed
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+    static_assert(sizeof(Node) >= sizeof(FreeSlot), "nodes must be large enough to hold a free-list link");
+
+    static const size_t SLAB_BYTES = 1 << 20;
+    static const size_t NODES_PER_SLAB = SLAB_BYTES / sizeof(Node) > 0 ? SLAB_BYTES / sizeof(Node) : 1;
+
+    vector<Node*> slabs;
+    size_t usedInSlab = NODES_PER_SLAB; // slots handed out from the last slab
+    FreeSlot* freeList = nullptr;
+    size_t liveCount = 0;
+
+    void* allocateSlot() {
+        if (freeList) {
+            FreeSlot* slot = freeList;
+            freeList = slot->next;
+            return slot;
+        }
+        if (usedInSlab == NODES_PER_SLAB) {
+            slabs.push_back(static_cast<Node*>(::operator new(NODES_PER_SLAB * sizeof(Node))));
+            usedInSlab = 0;
+        }
+        return slabs.back() + usedInSlab++;
+    }
+
+public:
+    // release() frees every node at once, so trees with trivially destructible nodes can
+    // skip walking the tree on destruction
+    static const bool BULK_RELEASE = true;
+
+    NodeArena() {}
+
+    ~NodeArena() {
+        release();
+    }
+
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    template <typename... Args>
+    Node* create(Args&&... args) {
+        void* slot = allocateSlot();
+        liveCount++;
+        return new (slot) Node(forward<Args>(args)...);
+    }
+
+    // Runs the node's destructor and keeps its slot for the next create()
+    void destroy(Node* node) {
+        node->~Node();
+        FreeSlot* slot = new (node) FreeSlot;
+        slot->next = freeList;
+        freeList = slot;
+        liveCount--;
+    }
+
+    // Frees every slab at once; nodes still alive are dropped without their destructors
+    void release() {
+        for (Node* slab : slabs) {
+            ::operator delete(slab);
+        }
+        slabs.clear();
+        usedInSlab = NODES_PER_SLAB;
+        freeList = nullptr;
+        liveCount = 0;
+    }
+
+    size_t size() const {
+        return liveCount;
+    }
+
+    size_t bytesReserved() const {
+        return slabs.size() * NODES_PER_SLAB * sizeof(Node);
+    }
+};
+
+// One global new/delete per node, with the same interface as NodeArena, for comparison
+template <typename Node>
+class HeapNodeAllocator {
+private:
+    size_t liveCount = 0;
+
+public:
+    static const bool BULK_RELEASE = false;
+
+    template <typename... Args>
+    Node* create(Args&&... args) {
+        liveCount++;
+        return new Node(forward<Args>(args)...);
+    }
+
+    void destroy(Node* node) {
+        delete node;
+        liveCount--;
+    }
+
+    // Nodes still alive are leaked; trees destroy theirs before releasing
+    void release() {
+        liveCount = 0;
+    }
+
+    size_t size() const {
+        return liveCount;
+    }
+
+    size_t bytesReserved() const {
+        return liveCount * sizeof(Node);
+    }
+};
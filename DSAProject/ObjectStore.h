@@ -0,0 +1,437 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <filesystem>
+#include <type_traits>
+#include "Hash.h"
+#include "PackFile.h"
+#include "MappedFile.h"
+using namespace std;
+
+// Set of digests with no false negatives and about 1% false positives up to its capacity.
+// Digests are already uniformly random, so their bytes are used as the hash functions.
+class BloomFilter {
+private:
+    static const int PROBES = 7;
+    static const size_t BITS_PER_ENTRY = 10;
+
+    vector<uint64_t> bits;
+    uint64_t bitCount = 0;
+    size_t capacity = 0;
+    size_t count = 0;
+
+    template <typename Fn>
+    void forEachBit(const HashDigest& digest, Fn fn) const {
+        uint64_t first, step;
+        memcpy(&first, digest.data(), sizeof(first));
+        memcpy(&step, digest.data() + 8, sizeof(step));
+        step |= 1;
+        for (int i = 0; i < PROBES; i++) {
+            fn((first + i * step) % bitCount);
+        }
+    }
+
+public:
+    void reset(size_t expected) {
+        capacity = max<size_t>(expected, 1024);
+        bitCount = (capacity * BITS_PER_ENTRY + 63) / 64 * 64;
+        bits.assign(bitCount / 64, 0);
+        count = 0;
+    }
+
+    void add(const HashDigest& digest) {
+        forEachBit(digest, [&](uint64_t bit) {
+            bits[bit / 64] |= uint64_t(1) << (bit % 64);
+        });
+        count++;
+    }
+
+    bool mayContain(const HashDigest& digest) const {
+        bool present = true;
+        forEachBit(digest, [&](uint64_t bit) {
+            present = present && (bits[bit / 64] >> (bit % 64) & 1) != 0;
+        });
+        return present;
+    }
+
+    // Past capacity the false-positive rate climbs; the owner rebuilds it larger
+    bool isFull() const {
+        return count >= capacity;
+    }
+
+    size_t memoryBytes() const {
+        return bits.size() * sizeof(uint64_t);
+    }
+
+    // Saved as a header then the bit words, so the store can load it instead of rereading
+    // every index entry
+    struct FileHeader {
+        char magic[8];          // "GLBLOOM"
+        uint64_t bitCount;
+        uint64_t capacity;
+        uint64_t count;
+        uint64_t segments;      // the index files it covers: the first segments, in order
+        uint64_t objects;       // entries in those files, to tell a stale filter
+    };
+
+    bool save(const string& path, uint64_t segments, uint64_t objects) const {
+        FileHeader header = {};
+        memcpy(header.magic, "GLBLOOM", 8);
+        header.bitCount = bitCount;
+        header.capacity = capacity;
+        header.count = count;
+        header.segments = segments;
+        header.objects = objects;
+        BufferedFileWriter out;
+        if (!out.open(path)) return false;
+        out.write(&header, sizeof(header));
+        out.write(bits.data(), memoryBytes());
+        return out.close();
+    }
+
+    // False if the file is missing or not a whole filter; header tells what it covers
+    bool load(const string& path, FileHeader& header) {
+        ifstream in(path, ios::binary | ios::ate);
+        if (!in) return false;
+        uint64_t fileBytes = static_cast<uint64_t>(in.tellg());
+        in.seekg(0);
+        if (fileBytes < sizeof(header) || !in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+            memcmp(header.magic, "GLBLOOM", 8) != 0 || header.bitCount == 0 || header.bitCount % 64 != 0 ||
+            header.bitCount / 8 != fileBytes - sizeof(header)) {
+            return false;
+        }
+        bits.assign(header.bitCount / 64, 0);
+        if (!in.read(reinterpret_cast<char*>(bits.data()), static_cast<streamsize>(header.bitCount / 8))) {
+            return false;
+        }
+        bitCount = header.bitCount;
+        capacity = header.capacity;
+        count = header.count;
+        return true;
+    }
+};
+
+// Index entry: where an object starts in objects.log
+struct ObjectIndexEntry {
+    HashDigest digest;
+    uint64_t offset;
+};
+static_assert(sizeof(ObjectIndexEntry) == 40, "object index entries must stay 40 bytes");
+
+struct ObjectWriteStats {
+    uint64_t objectsWritten = 0;
+    uint64_t bytesWritten = 0;  // objects and index
+    uint64_t subtreesShared = 0; // subtrees already stored, skipped whole
+    uint64_t indexProbes = 0;   // index lookups the filter could not rule out
+};
+
+// One node as stored: its key and its children's object ids
+struct StoredObject {
+    string key;
+    bool hasLeft = false;
+    bool hasRight = false;
+    HashDigest left;
+    HashDigest right;
+};
+
+// Content-addressed store of tree nodes, shared by every commit. An object's id is the node's
+// SHA-256 Merkle hash, which covers its key and both subtrees, so an id already in the store
+// stands for a whole subtree that is stored already. Writing a commit only walks and writes
+// the nodes that are new, and identical subtrees are stored once across all commits.
+//
+//   objects.log     appended objects: [id 32][payload length 4][flags 1][left id][right id][key]
+//   index_<n>.idx   one sorted ObjectIndexEntry array per write, merged once there are many
+//   filter          the Bloom filter over the first index files (see below)
+//
+// Most nodes a commit writes are new, so each lookup first asks an in-memory Bloom filter,
+// and only ids it can't rule out are searched for in the index files. The filter is saved
+// when it is rebuilt or the index files are merged, and open() loads it and adds only the
+// index files written since, so opening doesn't read the whole index of a large store.
+class ObjectStore {
+private:
+    static const size_t MAX_SEGMENTS = 16;
+
+    string directory;
+    vector<unique_ptr<MappedFile>> segments; // oldest first
+    BloomFilter filter;
+    bool filterChanged = false; // rebuilt or merged since saved
+    uint64_t logSize = 0;
+    uint64_t objectCount = 0;
+
+    string logPath() const {
+        return directory + "/objects.log";
+    }
+
+    string segmentPath(size_t index) const {
+        return directory + "/index_" + to_string(index) + ".idx";
+    }
+
+    string filterPath() const {
+        return directory + "/filter";
+    }
+
+    static const ObjectIndexEntry* entries(const MappedFile& segment) {
+        return reinterpret_cast<const ObjectIndexEntry*>(segment.data());
+    }
+
+    static size_t entryCount(const MappedFile& segment) {
+        return segment.size() / sizeof(ObjectIndexEntry);
+    }
+
+    bool findOffset(const HashDigest& digest, uint64_t& offset) const {
+        for (size_t s = segments.size(); s-- > 0;) {
+            const ObjectIndexEntry* first = entries(*segments[s]);
+            const ObjectIndexEntry* last = first + entryCount(*segments[s]);
+            const ObjectIndexEntry* found = lower_bound(first, last, digest, [](const ObjectIndexEntry& entry, const HashDigest& wanted) {
+                return memcmp(entry.digest.data(), wanted.data(), wanted.size()) < 0;
+            });
+            if (found != last && found->digest == digest) {
+                offset = found->offset;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Sized for twice what is stored, so it is rebuilt about every time the store doubles
+    void rebuildFilter(const vector<ObjectIndexEntry>& pending) {
+        filter.reset((objectCount + pending.size()) * 2);
+        for (const unique_ptr<MappedFile>& segment : segments) {
+            for (size_t i = 0; i < entryCount(*segment); i++) {
+                filter.add(entries(*segment)[i].digest);
+            }
+        }
+        for (const ObjectIndexEntry& entry : pending) {
+            filter.add(entry.digest);
+        }
+        filterChanged = true;
+    }
+
+    // Loads the saved filter and adds the index files written after it; rebuilds it if it is
+    // missing, stale or already full
+    void loadFilter() {
+        BloomFilter::FileHeader header;
+        bool usable = filter.load(filterPath(), header) && header.segments <= segments.size();
+        uint64_t covered = 0;
+        for (size_t s = 0; usable && s < header.segments; s++) {
+            covered += entryCount(*segments[s]);
+        }
+        if (!usable || covered != header.objects) {
+            rebuildFilter({});
+            return;
+        }
+        for (size_t s = header.segments; s < segments.size(); s++) {
+            for (size_t i = 0; i < entryCount(*segments[s]); i++) {
+                filter.add(entries(*segments[s])[i].digest);
+            }
+        }
+        if (filter.isFull()) rebuildFilter({});
+    }
+
+    // The filter covers every index file once the new objects' file is written
+    bool saveFilter() {
+        const string temporary = filterPath() + ".tmp";
+        if (!filter.save(temporary, segments.size(), objectCount)) return false;
+        error_code error;
+        filesystem::rename(temporary, filterPath(), error);
+        filterChanged = false;
+        return !error;
+    }
+
+    bool mapSegment(const string& path) {
+        unique_ptr<MappedFile> segment(new MappedFile());
+        if (!segment->open(path) || segment->size() % sizeof(ObjectIndexEntry) != 0) {
+            return false;
+        }
+        objectCount += entryCount(*segment);
+        segments.push_back(move(segment));
+        return true;
+    }
+
+    static bool writeEntries(const string& path, vector<ObjectIndexEntry>& added) {
+        sort(added.begin(), added.end(), [](const ObjectIndexEntry& a, const ObjectIndexEntry& b) {
+            return memcmp(a.digest.data(), b.digest.data(), a.digest.size()) < 0;
+        });
+        BufferedFileWriter out;
+        if (!out.open(path)) return false;
+        out.write(added.data(), added.size() * sizeof(ObjectIndexEntry));
+        return out.close();
+    }
+
+    // Merges the newer index files into one, so a lookup stays a handful of binary searches.
+    // The oldest, largest file is only rewritten once the others add up to its size, which
+    // keeps the bytes merged per write about constant as the store grows.
+    bool mergeSegments() {
+        size_t newer = 0;
+        for (size_t s = 1; s < segments.size(); s++) {
+            newer += entryCount(*segments[s]);
+        }
+        const size_t first = newer < entryCount(*segments[0]) ? 1 : 0;
+        vector<ObjectIndexEntry> merged;
+        for (size_t s = first; s < segments.size(); s++) {
+            merged.insert(merged.end(), entries(*segments[s]), entries(*segments[s]) + entryCount(*segments[s]));
+        }
+        const string mergedPath = directory + "/index.tmp";
+        if (!writeEntries(mergedPath, merged)) return false;
+        size_t count = segments.size();
+        for (size_t s = first; s < count; s++) {
+            objectCount -= entryCount(*segments[s]);
+        }
+        segments.resize(first);
+        error_code error;
+        for (size_t s = first + 1; s < count; s++) {
+            filesystem::remove(segmentPath(s), error);
+        }
+        filesystem::rename(mergedPath, segmentPath(first), error);
+        return !error && mapSegment(segmentPath(first));
+    }
+
+public:
+    // Opens the store in directory, creating it if needed
+    bool open(const string& path) {
+        directory = path;
+        segments.clear();
+        objectCount = 0;
+        filterChanged = false;
+        error_code error;
+        filesystem::create_directories(directory, error);
+        if (error) {
+            cerr << "Error: Unable to create object store " << directory << endl;
+            return false;
+        }
+        ifstream log(logPath(), ios::binary | ios::ate);
+        logSize = log ? static_cast<uint64_t>(log.tellg()) : 0;
+        while (filesystem::exists(segmentPath(segments.size()))) {
+            if (!mapSegment(segmentPath(segments.size()))) {
+                cerr << "Error: Corrupt object index " << segmentPath(segments.size()) << endl;
+                return false;
+            }
+        }
+        loadFilter();
+        if (filterChanged && !saveFilter()) {
+            cerr << "Error: Unable to write " << filterPath() << endl;
+        }
+        return true;
+    }
+
+    bool contains(const HashDigest& id, ObjectWriteStats* stats = nullptr) const {
+        if (!filter.mayContain(id)) return false;
+        if (stats) stats->indexProbes++;
+        uint64_t offset;
+        return findOffset(id, offset);
+    }
+
+    // Stores every node of tree that isn't stored yet; stats counts what was written. Tree
+    // is AVLTree or RBTree with Sha256Hasher: the instructor hash is far too weak to name
+    // objects by, and an internal node's instructor hash doesn't even cover its key.
+    template <typename Tree>
+    bool writeTree(Tree& tree, ObjectWriteStats& stats) {
+        static_assert(is_same<typename Tree::HasherType, Sha256Hasher>::value, "the object store needs SHA-256 node hashes");
+
+        BufferedFileWriter log;
+        if (!log.open(logPath(), true)) {
+            cerr << "Error: Unable to write " << logPath() << endl;
+            return false;
+        }
+        vector<ObjectIndexEntry> added;
+        tree.visitNodes([&](string_view key, const HashDigest& id, const HashDigest* left, const HashDigest* right) {
+            if (contains(id, &stats)) {
+                stats.subtreesShared++;
+                return false;
+            }
+            uint8_t flags = (left ? 1 : 0) | (right ? 2 : 0);
+            uint32_t payloadLength = static_cast<uint32_t>(1 + (left ? id.size() : 0) + (right ? id.size() : 0) + key.size());
+            added.push_back(ObjectIndexEntry{ id, logSize + log.position() });
+            log.write(id.data(), id.size());
+            log.write(&payloadLength, sizeof(payloadLength));
+            log.write(&flags, 1);
+            if (left) log.write(left->data(), left->size());
+            if (right) log.write(right->data(), right->size());
+            log.write(key.data(), key.size());
+            filter.add(id);
+            if (filter.isFull()) rebuildFilter(added);
+            return true;
+        });
+        uint64_t logBytes = log.position();
+        if (!log.close()) {
+            cerr << "Error: Failed writing " << logPath() << endl;
+            return false;
+        }
+        logSize += logBytes;
+        stats.objectsWritten += added.size();
+        stats.bytesWritten += logBytes + added.size() * sizeof(ObjectIndexEntry);
+        if (added.empty()) return true;
+
+        // The index goes last: objects without an index entry are just unreachable
+        const string path = segmentPath(segments.size());
+        if (!writeEntries(path, added) || !mapSegment(path)) {
+            cerr << "Error: Failed writing " << path << endl;
+            return false;
+        }
+        if (segments.size() > MAX_SEGMENTS) {
+            if (!mergeSegments()) {
+                cerr << "Error: Failed merging the object index" << endl;
+                return false;
+            }
+            filterChanged = true;
+        }
+        // A stale or missing filter is only rebuilt on the next open, so failing to save it
+        // isn't fatal
+        if (filterChanged && !saveFilter()) {
+            cerr << "Error: Unable to write " << filterPath() << endl;
+        }
+        return true;
+    }
+
+    // Reads an object back and checks that its content still hashes to its id
+    bool readObject(const HashDigest& id, StoredObject& object) const {
+        uint64_t offset;
+        if (!findOffset(id, offset)) return false;
+
+        ifstream log(logPath(), ios::binary);
+        HashDigest storedId;
+        uint32_t payloadLength = 0;
+        uint8_t flags = 0;
+        log.seekg(static_cast<streamoff>(offset));
+        log.read(reinterpret_cast<char*>(storedId.data()), storedId.size());
+        log.read(reinterpret_cast<char*>(&payloadLength), sizeof(payloadLength));
+        log.read(reinterpret_cast<char*>(&flags), 1);
+        object.hasLeft = (flags & 1) != 0;
+        object.hasRight = (flags & 2) != 0;
+        uint64_t fixedLength = 1 + (object.hasLeft ? id.size() : 0) + (object.hasRight ? id.size() : 0);
+        if (!log || storedId != id || payloadLength < fixedLength ||
+            offset + id.size() + sizeof(payloadLength) + payloadLength > logSize) {
+            cerr << "Error: Corrupt object at offset " << offset << endl;
+            return false;
+        }
+        uint64_t keyLength = payloadLength - fixedLength;
+        if (object.hasLeft) log.read(reinterpret_cast<char*>(object.left.data()), object.left.size());
+        if (object.hasRight) log.read(reinterpret_cast<char*>(object.right.data()), object.right.size());
+        object.key.resize(static_cast<size_t>(keyLength));
+        log.read(&object.key[0], static_cast<streamsize>(keyLength));
+
+        Sha256Hasher hasher;
+        HashDigest check;
+        hasher.hashNode(object.key, object.hasLeft ? &object.left : nullptr, object.hasRight ? &object.right : nullptr, check);
+        if (!log || check != id) {
+            cerr << "Error: Object " << Sha256Hasher::toString(id) << " does not match its content" << endl;
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t size() const {
+        return objectCount;
+    }
+
+    size_t filterBytes() const {
+        return filter.memoryBytes();
+    }
+};
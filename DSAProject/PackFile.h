@@ -0,0 +1,318 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "Hash.h"
+using namespace std;
+
+// Packed repository file: every node of a tree in one append-only binary file.
+//
+//   [records][key bytes][in-order index][footer]
+//
+// Records are fixed-size and written in post-order (children before parents), so a tree can
+// be streamed out in one pass and the root is always the last record. Child links are record
+// indices. The index lists record indices in key order, for binary search and ordered scans.
+// Everything is stored little-endian, as laid out in memory on x86/x64.
+
+const uint32_t PACK_NO_NODE = 0xFFFFFFFFu;
+
+struct PackRecord {
+    HashDigest hash;    // Merkle hash of the node
+    uint64_t keyOffset; // into the key bytes
+    uint32_t keyLength;
+    uint32_t left;      // record index or PACK_NO_NODE
+    uint32_t right;
+    uint16_t height;
+    uint8_t flags;      // tree-specific (e.g. node color)
+    uint8_t reserved;
+};
+static_assert(sizeof(PackRecord) == 56, "pack records must stay 56 bytes");
+
+struct PackFooter {
+    char magic[8];        // "GLPACK1"
+    uint32_t version;
+    uint32_t recordSize;
+    char hashMethod[16];  // Hasher::name(), so a pack isn't loaded with the wrong hasher
+    uint64_t nodeCount;
+    uint64_t recordsOffset;
+    uint64_t keysOffset;
+    uint64_t keysSize;
+    uint64_t indexOffset;
+    uint32_t rootIndex;
+    uint32_t reserved;
+};
+static_assert(sizeof(PackFooter) == 80, "pack footer must stay 80 bytes");
+
+// Checks that the footer's regions fit in a file of fileSize bytes. The counts and offsets
+// come from the file, so each is bounded by the file size before any product or sum is
+// formed, and the rest is compared by subtraction: crafted values can't wrap around.
+inline bool isValidPackFooter(const PackFooter& footer, uint64_t fileSize) {
+    if (memcmp(footer.magic, "GLPACK1", 8) != 0 || footer.version != 1 || footer.recordSize != sizeof(PackRecord) ||
+        fileSize < sizeof(PackFooter)) {
+        return false;
+    }
+    const uint64_t dataSize = fileSize - sizeof(PackFooter);
+    if (footer.nodeCount > dataSize / sizeof(PackRecord) || footer.recordsOffset > dataSize ||
+        footer.keysOffset > dataSize || footer.keysSize > dataSize || footer.indexOffset > dataSize) {
+        return false;
+    }
+    return footer.recordsOffset <= footer.keysOffset &&
+        footer.nodeCount * sizeof(PackRecord) <= footer.keysOffset - footer.recordsOffset &&
+        footer.keysSize <= dataSize - footer.keysOffset &&
+        footer.nodeCount * sizeof(uint32_t) <= dataSize - footer.indexOffset &&
+        (footer.nodeCount == 0 || footer.rootIndex < footer.nodeCount);
+}
+
+// Pack keys are compared as raw bytes, so integer keys are stored big-endian with the sign
+// bit flipped: byte order then matches numeric order
+inline string packIntKey(int value) {
+    uint32_t bits = static_cast<uint32_t>(value) ^ 0x80000000u;
+    string key(4, '\0');
+    for (int i = 0; i < 4; i++) {
+        key[i] = static_cast<char>(bits >> (24 - 8 * i));
+    }
+    return key;
+}
+
+// Key bytes of a tree key, as stored in packs and fed to the hasher
+inline string packKey(int value) {
+    return packIntKey(value);
+}
+
+inline string_view packKey(const string& value) {
+    return value;
+}
+
+// Inverse of packKey, for loading a pack back into a tree; false if the bytes can't be a key
+inline bool unpackKey(string_view bytes, int& value) {
+    if (bytes.size() != 4) return false;
+    uint32_t bits = 0;
+    for (int i = 0; i < 4; i++) {
+        bits = (bits << 8) | static_cast<unsigned char>(bytes[i]);
+    }
+    value = static_cast<int>(bits ^ 0x80000000u);
+    return true;
+}
+
+inline bool unpackKey(string_view bytes, string& value) {
+    value.assign(bytes.data(), bytes.size());
+    return true;
+}
+
+// Collects small writes and hands them to the stream in large sequential blocks
+class BufferedFileWriter {
+private:
+    ofstream file;
+    vector<char> buffer;
+    size_t used = 0;
+    uint64_t written = 0;
+
+public:
+    explicit BufferedFileWriter(size_t blockSize = 1 << 20) : buffer(blockSize) {}
+
+    // Truncates the file, or with append keeps it and writes after its end
+    bool open(const string& path, bool append = false) {
+        file.open(path, ios::binary | (append ? ios::app : ios::trunc));
+        used = 0;
+        written = 0;
+        return static_cast<bool>(file);
+    }
+
+    void write(const void* data, size_t length) {
+        const char* bytes = static_cast<const char*>(data);
+        if (length >= buffer.size()) {
+            flush();
+            file.write(bytes, static_cast<streamsize>(length));
+            written += length;
+            return;
+        }
+        if (used + length > buffer.size()) {
+            flush();
+        }
+        memcpy(buffer.data() + used, bytes, length);
+        used += length;
+        written += length;
+    }
+
+    void flush() {
+        if (used > 0) {
+            file.write(buffer.data(), static_cast<streamsize>(used));
+            used = 0;
+        }
+    }
+
+    // Bytes written so far, including what is still buffered
+    uint64_t position() const {
+        return written;
+    }
+
+    bool close() {
+        flush();
+        file.close();
+        return !file.fail();
+    }
+};
+
+// Streams nodes into a pack file. Add every node after both of its children, note each node's
+// place in key order with reserveIndexSlot/fillIndexSlot, then finish with the root's index.
+class PackWriter {
+private:
+    BufferedFileWriter out;
+    vector<char> keys;          // key bytes, written after the records
+    vector<uint32_t> inOrder;   // record indices in key order
+    uint32_t nodeCount = 0;
+    string hashMethod;
+
+public:
+    bool open(const string& path, const string& hasherName) {
+        keys.clear();
+        inOrder.clear();
+        nodeCount = 0;
+        hashMethod = hasherName;
+        return out.open(path);
+    }
+
+    uint32_t addNode(string_view key, const HashDigest& hash, uint32_t left, uint32_t right, int height, uint8_t flags = 0) {
+        PackRecord record;
+        memset(&record, 0, sizeof(record));
+        record.hash = hash;
+        record.keyOffset = keys.size();
+        record.keyLength = static_cast<uint32_t>(key.size());
+        record.left = left;
+        record.right = right;
+        record.height = static_cast<uint16_t>(height);
+        record.flags = flags;
+        keys.insert(keys.end(), key.begin(), key.end());
+        out.write(&record, sizeof(record));
+        return nodeCount++;
+    }
+
+    // In-order position of a node whose record index isn't known yet
+    size_t reserveIndexSlot() {
+        inOrder.push_back(PACK_NO_NODE);
+        return inOrder.size() - 1;
+    }
+
+    void fillIndexSlot(size_t slot, uint32_t recordIndex) {
+        inOrder[slot] = recordIndex;
+    }
+
+    bool finish(uint32_t rootIndex) {
+        PackFooter footer;
+        memset(&footer, 0, sizeof(footer));
+        memcpy(footer.magic, "GLPACK1", 8);
+        footer.version = 1;
+        footer.recordSize = sizeof(PackRecord);
+        memcpy(footer.hashMethod, hashMethod.data(), min(hashMethod.size(), sizeof(footer.hashMethod) - 1));
+        footer.nodeCount = nodeCount;
+        footer.recordsOffset = 0;
+        footer.keysOffset = out.position();
+        footer.keysSize = keys.size();
+        out.write(keys.data(), keys.size());
+        footer.indexOffset = out.position();
+        out.write(inOrder.data(), inOrder.size() * sizeof(uint32_t));
+        footer.rootIndex = rootIndex;
+        out.write(&footer, sizeof(footer));
+        return out.close();
+    }
+};
+
+// Reads a whole pack file into memory
+class PackReader {
+private:
+    vector<char> data;
+    PackFooter footer;
+
+public:
+    bool open(const string& path) {
+        ifstream file(path, ios::binary | ios::ate);
+        if (!file) {
+            cerr << "Error: Unable to open pack file " << path << endl;
+            return false;
+        }
+        streamoff size = file.tellg();
+        if (size < static_cast<streamoff>(sizeof(PackFooter))) {
+            cerr << "Error: " << path << " is not a pack file" << endl;
+            return false;
+        }
+        data.resize(static_cast<size_t>(size));
+        file.seekg(0);
+        if (!file.read(data.data(), size) || file.gcount() != size) {
+            cerr << "Error: Unable to read pack file " << path << endl;
+            return false;
+        }
+
+        memcpy(&footer, data.data() + data.size() - sizeof(footer), sizeof(footer));
+        if (!isValidPackFooter(footer, data.size())) {
+            cerr << "Error: " << path << " is not a valid pack file" << endl;
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t nodeCount() const {
+        return footer.nodeCount;
+    }
+
+    uint32_t rootIndex() const {
+        return footer.rootIndex;
+    }
+
+    string hashMethod() const {
+        return string(footer.hashMethod, strnlen(footer.hashMethod, sizeof(footer.hashMethod)));
+    }
+
+    PackRecord record(uint64_t index) const {
+        PackRecord result;
+        memcpy(&result, data.data() + footer.recordsOffset + index * sizeof(PackRecord), sizeof(result));
+        return result;
+    }
+
+    bool keyInBounds(const PackRecord& record) const {
+        return record.keyOffset <= footer.keysSize && record.keyLength <= footer.keysSize - record.keyOffset;
+    }
+
+    string_view key(const PackRecord& record) const {
+        return string_view(data.data() + footer.keysOffset + record.keyOffset, record.keyLength);
+    }
+
+    // Record index of the i-th smallest key
+    uint32_t inOrder(uint64_t position) const {
+        uint32_t index;
+        memcpy(&index, data.data() + footer.indexOffset + position * sizeof(uint32_t), sizeof(index));
+        return index;
+    }
+
+    // Walks the records in order from the root and checks that the keys strictly increase
+    // and that the index lists the same records. Only for records already checked to form a
+    // tree (every child has a lower index, one parent, and keys in bounds), so the walk ends.
+    bool keysInOrder() const {
+        if (footer.nodeCount == 0) return true;
+        vector<uint32_t> stack;
+        uint32_t current = footer.rootIndex;
+        uint64_t position = 0;
+        string_view previous;
+        while (current != PACK_NO_NODE || !stack.empty()) {
+            while (current != PACK_NO_NODE) {
+                stack.push_back(current);
+                current = record(current).left;
+            }
+            uint32_t index = stack.back();
+            stack.pop_back();
+            PackRecord node = record(index);
+            string_view nodeKey = key(node);
+            if ((position > 0 && nodeKey <= previous) || position >= footer.nodeCount || inOrder(position) != index) {
+                return false;
+            }
+            previous = nodeKey;
+            position++;
+            current = node.right;
+        }
+        return position == footer.nodeCount;
+    }
+};
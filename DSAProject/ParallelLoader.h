@@ -0,0 +1,216 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <string_view>
+#include <queue>
+#include <algorithm>
+#include <iterator>
+#include <filesystem>
+#include <fstream>
+#include <cstdint>
+#include <memory>
+#include "CSVReader.h"
+#include "RowStore.h"
+#include "ThreadPool.h"
+using namespace std;
+
+// Sorts and dedups keys for buildFromSorted, skipping the sort when they are already ordered
+inline void prepareSortedKeys(vector<string>& keys) {
+    if (!is_sorted(keys.begin(), keys.end())) {
+        sort(keys.begin(), keys.end());
+    }
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+}
+
+// Merges sorted runs into one sorted run, dropping keys that appear in more than one run.
+// Strings are moved out of the runs, so they are left in a valid but unspecified state.
+inline vector<string> mergeSortedRuns(vector<vector<string>>& runs) {
+    size_t total = 0;
+    for (const vector<string>& run : runs) {
+        total += run.size();
+    }
+
+    vector<string> merged;
+    merged.reserve(total);
+
+    // (run index, position in run), smallest current key on top
+    typedef pair<size_t, size_t> Cursor;
+    auto greater = [&runs](const Cursor& a, const Cursor& b) {
+        return runs[a.first][a.second] > runs[b.first][b.second];
+    };
+    priority_queue<Cursor, vector<Cursor>, decltype(greater)> heap(greater);
+    for (size_t i = 0; i < runs.size(); i++) {
+        if (!runs[i].empty()) heap.push(Cursor(i, 0));
+    }
+
+    while (!heap.empty()) {
+        Cursor top = heap.top();
+        heap.pop();
+        string& key = runs[top.first][top.second];
+        if (merged.empty() || merged.back() != key) {
+            merged.push_back(move(key));
+        }
+        if (top.second + 1 < runs[top.first].size()) {
+            heap.push(Cursor(top.first, top.second + 1));
+        }
+    }
+    return merged;
+}
+
+// Merges two sorted, duplicate-free runs into one, the same way. When every key of first is
+// below every key of second (sorted input read in order) the runs are just joined.
+inline vector<string> mergeSortedRuns(vector<string>&& first, vector<string>&& second) {
+    if (first.empty() || second.empty() || first.back() < second.front()) {
+        if (first.empty()) return move(second);
+        first.insert(first.end(), make_move_iterator(second.begin()), make_move_iterator(second.end()));
+        return move(first);
+    }
+    vector<string> merged;
+    merged.reserve(first.size() + second.size());
+    size_t i = 0, j = 0;
+    while (i < first.size() || j < second.size()) {
+        bool takeFirst = j == second.size() || (i < first.size() && first[i] < second[j]);
+        string& key = takeFirst ? first[i++] : second[j++];
+        if (merged.empty() || merged.back() != key) {
+            merged.push_back(move(key));
+        }
+    }
+    return merged;
+}
+
+// Number of quote characters in [begin, end) of a file
+inline uint64_t countQuotes(const string& fileName, uint64_t begin, uint64_t end) {
+    ifstream file(fileName, ios::binary);
+    if (!file || !file.seekg(static_cast<streamoff>(begin))) return 0;
+    vector<char> block(1 << 20);
+    uint64_t quotes = 0;
+    while (begin < end) {
+        file.read(block.data(), static_cast<streamsize>(min<uint64_t>(block.size(), end - begin)));
+        size_t got = static_cast<size_t>(file.gcount());
+        if (got == 0) break;
+        quotes += static_cast<uint64_t>(count(block.begin(), block.begin() + got, '"'));
+        begin += got;
+    }
+    return quotes;
+}
+
+// Offset of the first row starting at or after offset (which must be past the header), or
+// the file size if none does. inQuotes tells whether an odd number of quotes comes before
+// offset: as in CSVReader::completeRowsLength, a newline ends a row only after an even
+// number of quotes, so a line break inside a quoted field is never taken for a row end.
+inline uint64_t nextRowStart(const string& fileName, uint64_t offset, bool inQuotes, uint64_t fileSize) {
+    ifstream file(fileName, ios::binary);
+    if (!file || !file.seekg(static_cast<streamoff>(offset - 1))) return fileSize;
+    vector<char> block(1 << 16);
+    uint64_t position = offset - 1; // file offset of block[0]
+    bool first = true;
+    while (true) {
+        file.read(block.data(), static_cast<streamsize>(block.size()));
+        size_t got = static_cast<size_t>(file.gcount());
+        if (got == 0) return fileSize;
+        for (size_t i = 0; i < got; i++) {
+            // the byte before offset is only looked at for a newline: its quote is counted
+            if (block[i] == '"' && !first) {
+                inQuotes = !inQuotes;
+            }
+            else if (block[i] == '\n' && !inQuotes) {
+                return position + i + 1;
+            }
+            first = false;
+        }
+        position += got;
+    }
+}
+
+// Extracts several columns from [dataBegin, end of file) on the thread pool in one pass and
+// returns each column's keys sorted and deduplicated, in the order of columns. The range is
+// cut into a few chunks per thread so uneven rows don't leave threads idle. A cut can land
+// inside a quoted field that holds a line break, so the quotes of every chunk are counted
+// first and each worker moves its start to the next newline outside quotes, the row
+// boundaries the sequential reader sees. Each chunk is sorted by its worker and the runs
+// are k-way merged column by column. With rows, every row
+// also goes to it in the same pass, keyed by the first column: each chunk sorts its rows
+// within its share of the memory budget, and the chunks' runs are handed over in file order.
+inline vector<vector<string>> loadSortedColumns(const string& fileName, uint64_t dataBegin, const vector<size_t>& columns,
+    ThreadPool& pool, size_t chunksPerThread = 4, RowSorter* rows = nullptr)
+{
+    const uint64_t minChunkSize = 1 << 20;
+
+    error_code error;
+    uint64_t fileSize = filesystem::file_size(fileName, error);
+    if (error || fileSize <= dataBegin) {
+        return vector<vector<string>>(columns.size());
+    }
+
+    uint64_t dataSize = fileSize - dataBegin;
+    uint64_t chunkCount = max<uint64_t>(1, pool.size() * chunksPerThread);
+    if (dataSize / chunkCount < minChunkSize) {
+        chunkCount = max<uint64_t>(1, dataSize / minChunkSize);
+    }
+    uint64_t chunkSize = dataSize / chunkCount;
+
+    // Quotes before each cut; a chunk's rows end where the next chunk's first row starts
+    vector<uint64_t> quotesBefore(chunkCount, 0);
+    for (uint64_t i = 0; i + 1 < chunkCount; i++) {
+        uint64_t begin = dataBegin + i * chunkSize;
+        pool.submit([&fileName, &quotesBefore, i, begin, chunkSize] {
+            quotesBefore[i + 1] = countQuotes(fileName, begin, begin + chunkSize);
+        });
+    }
+    pool.wait();
+    for (uint64_t i = 1; i < chunkCount; i++) {
+        quotesBefore[i] += quotesBefore[i - 1];
+    }
+
+    vector<vector<vector<string>>> runs(columns.size(), vector<vector<string>>(chunkCount)); // [column][chunk]
+    vector<unique_ptr<RowSorter>> rowRuns(chunkCount);
+    for (uint64_t i = 0; i < chunkCount; i++) {
+        uint64_t cut = dataBegin + i * chunkSize;
+        uint64_t end = (i + 1 == chunkCount) ? fileSize : cut + chunkSize;
+        bool inQuotes = quotesBefore[i] % 2 != 0;
+        if (rows) {
+            rowRuns[i].reset(new RowSorter(rows->prefix() + "." + to_string(i), rows->memoryBudget() / chunkCount));
+        }
+
+        pool.submit([&fileName, &runs, &rowRuns, &columns, i, cut, end, inQuotes, fileSize] {
+            uint64_t begin = i == 0 ? cut : nextRowStart(fileName, cut, inQuotes, fileSize);
+            CSVReader reader(1 << 20);
+            if (!reader.open(fileName, begin, end)) return;
+
+            RowSorter* chunkRows = rowRuns[i].get();
+            string scratch;
+            string_view row, key;
+            while (reader.nextRow(row)) {
+                for (size_t slot = 0; slot < columns.size(); slot++) {
+                    bool found = CSVReader::extractField(row, columns[slot], key, scratch);
+                    if (found) runs[slot][i].emplace_back(key);
+                    if (slot == 0 && chunkRows) chunkRows->add(found ? key : string_view(), row);
+                }
+            }
+            for (size_t slot = 0; slot < columns.size(); slot++) {
+                vector<string>& keys = runs[slot][i];
+                sort(keys.begin(), keys.end());
+                keys.erase(unique(keys.begin(), keys.end()), keys.end());
+            }
+        });
+    }
+    pool.wait();
+
+    if (rows) {
+        for (unique_ptr<RowSorter>& chunkRows : rowRuns) {
+            rows->append(*chunkRows);
+        }
+    }
+    vector<vector<string>> keys(columns.size());
+    for (size_t slot = 0; slot < columns.size(); slot++) {
+        keys[slot] = mergeSortedRuns(runs[slot]);
+    }
+    return keys;
+}
+
+// The same for one column
+inline vector<string> loadSortedColumn(const string& fileName, uint64_t dataBegin, size_t columnIndex,
+    ThreadPool& pool, size_t chunksPerThread = 4, RowSorter* rows = nullptr)
+{
+    return move(loadSortedColumns(fileName, dataBegin, vector<size_t>(1, columnIndex), pool, chunksPerThread, rows)[0]);
+}
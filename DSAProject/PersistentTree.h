@@ -0,0 +1,655 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include "Hash.h"
+#include "NodeArena.h"
+using namespace std;
+
+// Node shared between the versions of a persistent tree. height is used by the AVL variant
+// and red by the red-black one.
+struct PersistentNode {
+    string key;
+    HashDigest hashValue;
+    PersistentNode* left;
+    PersistentNode* right;
+    uint32_t refCount; // links to this node: parent nodes, the working root and commits
+    int height;
+    bool red;
+    bool dirty;        // hashValue is stale; if set, so is every ancestor's
+
+    PersistentNode(string k)
+        : key(move(k)), hashValue(), left(nullptr), right(nullptr), refCount(1), height(1), red(true), dirty(true) {}
+};
+
+// Versions, sharing and hashing common to PersistentAVLTree and PersistentRBTree.
+//
+// commit() freezes the working tree as a new version in O(1): it only takes a reference to
+// the root. Later changes copy a node only if someone else still links to it (refCount > 1),
+// so a change copies its root-to-leaf path once and every other subtree stays shared with
+// the older versions. A node with a single link is only reachable through the path being
+// changed and is edited in place. Nodes are freed as soon as the last version using them
+// is dropped.
+template <typename Hasher = InstructorHash>
+class PersistentTreeBase {
+public:
+    typedef PersistentNode Node;
+    typedef Hasher HasherType;
+
+protected:
+    struct Version {
+        Node* root;
+        size_t count;
+        bool dropped;
+    };
+
+    NodeArena<Node> nodes;
+    Hasher hasher;
+    Node* root = nullptr; // working tree
+    size_t count = 0;
+    vector<Version> commits;
+    vector<size_t> droppedIds; // slots in commits free for the next commit
+
+    Node* create(string_view key) {
+        return nodes.create(string(key));
+    }
+
+    static Node* retain(Node* node) {
+        if (node) node->refCount++;
+        return node;
+    }
+
+    // Drops one link to node, freeing whatever is no longer used by any version
+    void release(Node* node) {
+        vector<Node*> stack;
+        if (node) stack.push_back(node);
+        while (!stack.empty()) {
+            node = stack.back();
+            stack.pop_back();
+            if (--node->refCount > 0) continue;
+            if (node->left) stack.push_back(node->left);
+            if (node->right) stack.push_back(node->right);
+            nodes.destroy(node);
+        }
+    }
+
+    // Returns a node that can be changed in place for the link that holds node: node itself
+    // if that link is its only one, otherwise a copy that takes over the link. Either way the
+    // node is about to change, so its hash is marked stale. Callers go top-down from the root,
+    // so every ancestor of the result has been through here too.
+    Node* own(Node* node) {
+        if (!node) return nullptr;
+        if (node->refCount > 1) {
+            Node* copy = nodes.create(node->key);
+            copy->hashValue = node->hashValue;
+            copy->left = retain(node->left);
+            copy->right = retain(node->right);
+            copy->height = node->height;
+            copy->red = node->red;
+            node->refCount--; // the link now goes to the copy; someone else still holds node
+            node = copy;
+        }
+        node->dirty = true;
+        return node;
+    }
+
+    static bool isRed(const Node* node) {
+        return node && node->red;
+    }
+
+    static int height(const Node* node) {
+        return node ? node->height : 0;
+    }
+
+    static void updateHeight(Node* node) {
+        node->height = 1 + max(height(node->left), height(node->right));
+    }
+
+    // Post-order rehash of the dirty nodes only; shared subtrees are never dirty
+    void rehashDirty(Node* node) {
+        if (!node || !node->dirty) return;
+
+        rehashDirty(node->left);
+        rehashDirty(node->right);
+        hasher.hashNode(node->key,
+            node->left ? &node->left->hashValue : nullptr,
+            node->right ? &node->right->hashValue : nullptr,
+            node->hashValue);
+        node->dirty = false;
+    }
+
+    // Balanced subtree of keys[lo, hi) colored like RBTree's bulk load (red only on the last,
+    // incomplete level), so it is valid for both variants
+    Node* buildBalanced(vector<string>& keys, size_t lo, size_t hi, int depth, int redDepth) {
+        if (lo >= hi) return nullptr;
+
+        size_t mid = lo + (hi - lo) / 2;
+        Node* node = nodes.create(move(keys[mid]));
+        node->red = depth == redDepth && depth > 0;
+        node->left = buildBalanced(keys, lo, mid, depth + 1, redDepth);
+        node->right = buildBalanced(keys, mid + 1, hi, depth + 1, redDepth);
+        updateHeight(node);
+        return node;
+    }
+
+    const Version* findCommit(size_t id) const {
+        if (id >= commits.size() || commits[id].dropped) {
+            cerr << "Error: No commit " << id << endl;
+            return nullptr;
+        }
+        return &commits[id];
+    }
+
+public:
+    PersistentTreeBase() {}
+
+    ~PersistentTreeBase() {
+        release(root);
+        for (const Version& version : commits) {
+            release(version.root);
+        }
+        nodes.release();
+    }
+
+    PersistentTreeBase(const PersistentTreeBase&) = delete;
+    PersistentTreeBase& operator=(const PersistentTreeBase&) = delete;
+
+    // Replaces the working tree with one built from sorted, duplicate-free keys in O(n)
+    void buildFromSorted(vector<string>&& keys) {
+        release(root);
+        int redDepth = 0;
+        while ((size_t(2) << redDepth) - 1 < keys.size()) {
+            redDepth++;
+        }
+        root = buildBalanced(keys, 0, keys.size(), 0, redDepth);
+        count = keys.size();
+        keys.clear();
+        flushHashes();
+    }
+
+    // Freezes the working tree as a new version and returns its id. O(1) apart from
+    // rehashing what changed since the last commit. The id of a dropped commit is reused, so
+    // a writer that keeps committing and dropping keeps commits as long as it has live ones.
+    size_t commit() {
+        flushHashes();
+        Version version{ retain(root), count, false };
+        if (!droppedIds.empty()) {
+            size_t id = droppedIds.back();
+            droppedIds.pop_back();
+            commits[id] = version;
+            return id;
+        }
+        commits.push_back(version);
+        return commits.size() - 1;
+    }
+
+    // Makes a commit the working tree again, in O(1); nothing is copied until it changes
+    bool checkout(size_t id) {
+        const Version* version = findCommit(id);
+        if (!version) return false;
+        Node* previous = root;
+        root = retain(version->root);
+        count = version->count;
+        release(previous);
+        return true;
+    }
+
+    // Forgets a commit; the nodes only it used are freed, and a later commit may get its id
+    bool dropCommit(size_t id) {
+        if (!findCommit(id)) return false;
+        release(commits[id].root);
+        commits[id] = Version{ nullptr, 0, true };
+        droppedIds.push_back(id);
+        return true;
+    }
+
+    // Commits not dropped
+    size_t commitCount() const {
+        return commits.size() - droppedIds.size();
+    }
+
+    HashDigest getCommitDigest(size_t id) const {
+        const Version* version = findCommit(id);
+        return version && version->root ? version->root->hashValue : HashDigest();
+    }
+
+    // Root and key count of a commit, for readers that walk a version on their own. A commit
+    // never changes, so it can be read while the working tree changes, until it is dropped.
+    const Node* getCommitRoot(size_t id) const {
+        const Version* version = findCommit(id);
+        return version ? version->root : nullptr;
+    }
+
+    size_t getCommitSize(size_t id) const {
+        const Version* version = findCommit(id);
+        return version ? version->count : 0;
+    }
+
+    void flushHashes() {
+        rehashDirty(root);
+    }
+
+    string getRootHash() {
+        return Hasher::toString(getRootDigest());
+    }
+
+    HashDigest getRootDigest() {
+        flushHashes();
+        return root ? root->hashValue : HashDigest();
+    }
+
+    const HashStats& getHashStats() const {
+        return hasher.getStats();
+    }
+
+    bool contains(string_view key) const {
+        return contains(root, key);
+    }
+
+    // Lookup in the version rooted at node
+    static bool contains(const Node* node, string_view key) {
+        while (node) {
+            if (key == node->key) return true;
+            node = key < node->key ? node->left : node->right;
+        }
+        return false;
+    }
+
+    // Calls fn(key) for every key of the working tree in order
+    template <typename Fn>
+    void forEachKey(Fn fn) const {
+        vector<const Node*> stack;
+        const Node* node = root;
+        while (node || !stack.empty()) {
+            while (node) {
+                stack.push_back(node);
+                node = node->left;
+            }
+            node = stack.back();
+            stack.pop_back();
+            fn(string_view(node->key));
+            node = node->right;
+        }
+    }
+
+    // Keys in the working tree
+    size_t size() const {
+        return count;
+    }
+
+    // Nodes alive across all versions
+    size_t nodeCount() const {
+        return nodes.size();
+    }
+};
+
+// Persistent AVL tree: the same rebalancing as AVLTree, so the same operations give the
+// same shape and Merkle root hash
+template <typename Hasher = InstructorHash>
+class PersistentAVLTree : public PersistentTreeBase<Hasher> {
+private:
+    typedef PersistentNode Node;
+    using PersistentTreeBase<Hasher>::own;
+    using PersistentTreeBase<Hasher>::create;
+    using PersistentTreeBase<Hasher>::release;
+    using PersistentTreeBase<Hasher>::height;
+    using PersistentTreeBase<Hasher>::updateHeight;
+    using PersistentTreeBase<Hasher>::root;
+    using PersistentTreeBase<Hasher>::count;
+
+    static int getBalance(const Node* node) {
+        return node ? height(node->left) - height(node->right) : 0;
+    }
+
+    // Rotations take an owned node and own the child that moves up
+    Node* rightRotate(Node* y) {
+        Node* x = y->left = own(y->left);
+        y->left = x->right;
+        x->right = y;
+        updateHeight(y);
+        updateHeight(x);
+        return x;
+    }
+
+    Node* leftRotate(Node* x) {
+        Node* y = x->right = own(x->right);
+        x->right = y->left;
+        y->left = x;
+        updateHeight(x);
+        updateHeight(y);
+        return y;
+    }
+
+    Node* rebalance(Node* node) {
+        updateHeight(node);
+        int balance = getBalance(node);
+        if (balance > 1) {
+            if (getBalance(node->left) < 0) {
+                node->left = own(node->left);
+                node->left = leftRotate(node->left);
+            }
+            return rightRotate(node);
+        }
+        if (balance < -1) {
+            if (getBalance(node->right) > 0) {
+                node->right = own(node->right);
+                node->right = rightRotate(node->right);
+            }
+            return leftRotate(node);
+        }
+        return node;
+    }
+
+    // The key must not be in the subtree yet
+    Node* insertNode(Node* node, string_view key) {
+        if (!node) return create(key);
+
+        node = own(node);
+        if (key < node->key) {
+            node->left = insertNode(node->left, key);
+        }
+        else {
+            node->right = insertNode(node->right, key);
+        }
+        return rebalance(node);
+    }
+
+    // Unlinks the smallest node of a subtree; the caller takes over its link
+    Node* detachMin(Node* node, Node*& minNode) {
+        node = own(node);
+        if (!node->left) {
+            minNode = node;
+            Node* right = node->right;
+            node->right = nullptr;
+            return right;
+        }
+        node->left = detachMin(node->left, minNode);
+        return rebalance(node);
+    }
+
+    // The key must be in the subtree
+    Node* removeNode(Node* node, string_view key) {
+        node = own(node);
+        if (key < node->key) {
+            node->left = removeNode(node->left, key);
+        }
+        else if (key > node->key) {
+            node->right = removeNode(node->right, key);
+        }
+        else {
+            Node* replacement;
+            if (!node->left || !node->right) {
+                replacement = node->left ? node->left : node->right;
+                node->left = node->right = nullptr;
+                release(node);
+                return replacement;
+            }
+            // Two children: the in-order successor takes the node's place
+            node->right = detachMin(node->right, replacement);
+            replacement->left = node->left;
+            replacement->right = node->right;
+            node->left = node->right = nullptr;
+            release(node);
+            node = replacement;
+        }
+        return rebalance(node);
+    }
+
+public:
+    // Returns false if the key was already there. Checked first, so nothing is copied then.
+    bool insert(string_view key) {
+        if (this->contains(key)) return false;
+        root = insertNode(root, key);
+        count++;
+        return true;
+    }
+
+    // Returns false if the key wasn't in the tree
+    bool remove(string_view key) {
+        if (!this->contains(key)) return false;
+        root = removeNode(root, key);
+        count--;
+        return true;
+    }
+};
+
+// Persistent red-black tree: RBTree's insert and delete fixups, run over an explicit path
+// instead of parent links (a shared node has no single parent), so the same operations give
+// the same shape, colors and Merkle root hash as RBTree<string>
+template <typename Hasher = InstructorHash>
+class PersistentRBTree : public PersistentTreeBase<Hasher> {
+private:
+    typedef PersistentNode Node;
+    using PersistentTreeBase<Hasher>::own;
+    using PersistentTreeBase<Hasher>::create;
+    using PersistentTreeBase<Hasher>::release;
+    using PersistentTreeBase<Hasher>::isRed;
+    using PersistentTreeBase<Hasher>::root;
+    using PersistentTreeBase<Hasher>::count;
+
+    vector<Node*> path; // owned nodes from the root down, reused by insert and remove
+
+    // Rotations take an owned node and return the owned node that replaces it
+    Node* rotateLeft(Node* x) {
+        Node* y = x->right = own(x->right);
+        x->right = y->left;
+        y->left = x;
+        return y;
+    }
+
+    Node* rotateRight(Node* x) {
+        Node* y = x->left = own(x->left);
+        x->left = y->right;
+        y->right = x;
+        return y;
+    }
+
+    void replaceChild(Node* parent, Node* oldChild, Node* newChild) {
+        if (!parent) {
+            root = newChild;
+        }
+        else if (parent->left == oldChild) {
+            parent->left = newChild;
+        }
+        else {
+            parent->right = newChild;
+        }
+    }
+
+    // Restores the red-black properties after removing a black node whose place (the left or
+    // right link of path.back()) now holds x, possibly null
+    void fixRemoval(Node* x, bool xLeft) {
+        while (!path.empty() && !isRed(x)) {
+            Node* parent = path.back();
+            Node* grand = path.size() >= 2 ? path[path.size() - 2] : nullptr;
+            if (xLeft) {
+                Node* w = parent->right = own(parent->right);
+                if (w->red) {
+                    w->red = false;
+                    parent->red = true;
+                    replaceChild(grand, parent, rotateLeft(parent));
+                    path.insert(path.end() - 1, w);
+                    grand = w;
+                    w = parent->right = own(parent->right);
+                }
+                if (!isRed(w->left) && !isRed(w->right)) {
+                    w->red = true;
+                    x = parent;
+                    path.pop_back();
+                    xLeft = grand && grand->left == x;
+                    continue;
+                }
+                if (!isRed(w->right)) {
+                    w->left = own(w->left);
+                    w->left->red = false;
+                    w->red = true;
+                    w = parent->right = rotateRight(w);
+                }
+                w->red = parent->red;
+                parent->red = false;
+                w->right = own(w->right);
+                w->right->red = false;
+                replaceChild(grand, parent, rotateLeft(parent));
+            }
+            else {
+                Node* w = parent->left = own(parent->left);
+                if (w->red) {
+                    w->red = false;
+                    parent->red = true;
+                    replaceChild(grand, parent, rotateRight(parent));
+                    path.insert(path.end() - 1, w);
+                    grand = w;
+                    w = parent->left = own(parent->left);
+                }
+                if (!isRed(w->left) && !isRed(w->right)) {
+                    w->red = true;
+                    x = parent;
+                    path.pop_back();
+                    xLeft = grand && grand->left == x;
+                    continue;
+                }
+                if (!isRed(w->left)) {
+                    w->right = own(w->right);
+                    w->right->red = false;
+                    w->red = true;
+                    w = parent->left = rotateLeft(w);
+                }
+                w->red = parent->red;
+                parent->red = false;
+                w->left = own(w->left);
+                w->left->red = false;
+                replaceChild(grand, parent, rotateRight(parent));
+            }
+            path.clear(); // done: x is now the root
+            x = nullptr;
+        }
+
+        // A red x absorbs the missing black
+        if (isRed(x)) {
+            if (path.empty()) {
+                root = own(root);
+                root->red = false;
+            }
+            else {
+                Node*& link = xLeft ? path.back()->left : path.back()->right;
+                link = own(link);
+                link->red = false;
+            }
+        }
+        if (root) root->red = false;
+    }
+
+public:
+    // Returns false if the key was already there. Checked first, so nothing is copied then.
+    bool insert(string_view key) {
+        if (this->contains(key)) return false;
+        count++;
+        if (!root) {
+            root = create(key);
+            root->red = false;
+            return true;
+        }
+
+        path.clear();
+        Node* current = root = own(root);
+        path.push_back(current);
+        while (true) {
+            Node*& link = key < current->key ? current->left : current->right;
+            if (!link) {
+                link = create(key);
+                path.push_back(link);
+                break;
+            }
+            current = link = own(link);
+            path.push_back(current);
+        }
+
+        // Red-black fixup, walking back up the recorded path
+        size_t k = path.size() - 1;
+        while (k >= 2 && path[k - 1]->red) {
+            Node* parent = path[k - 1];
+            Node* grand = path[k - 2];
+            Node* greatGrand = k >= 3 ? path[k - 3] : nullptr;
+            if (parent == grand->left) {
+                if (isRed(grand->right)) {
+                    Node* uncle = grand->right = own(grand->right);
+                    parent->red = false;
+                    uncle->red = false;
+                    grand->red = true;
+                    k -= 2;
+                    continue;
+                }
+                if (path[k] == parent->right) {
+                    parent = rotateLeft(parent);
+                    grand->left = parent;
+                }
+                parent->red = false;
+                grand->red = true;
+                replaceChild(greatGrand, grand, rotateRight(grand));
+            }
+            else {
+                if (isRed(grand->left)) {
+                    Node* uncle = grand->left = own(grand->left);
+                    parent->red = false;
+                    uncle->red = false;
+                    grand->red = true;
+                    k -= 2;
+                    continue;
+                }
+                if (path[k] == parent->left) {
+                    parent = rotateRight(parent);
+                    grand->right = parent;
+                }
+                parent->red = false;
+                grand->red = true;
+                replaceChild(greatGrand, grand, rotateLeft(grand));
+            }
+            break;
+        }
+        root->red = false;
+        return true;
+    }
+
+    // Returns false if the key wasn't in the tree
+    bool remove(string_view key) {
+        if (!this->contains(key)) return false;
+        count--;
+
+        path.clear();
+        Node* current = root = own(root);
+        path.push_back(current);
+        while (key != current->key) {
+            Node*& link = key < current->key ? current->left : current->right;
+            current = link = own(link);
+            path.push_back(current);
+        }
+
+        // Two children: the successor's key moves here and the successor's node goes instead
+        if (current->left && current->right) {
+            Node* successor = current->right = own(current->right);
+            path.push_back(successor);
+            while (successor->left) {
+                successor = successor->left = own(successor->left);
+                path.push_back(successor);
+            }
+            swap(current->key, successor->key);
+        }
+
+        Node* target = path.back();
+        path.pop_back();
+        Node* child = target->left ? target->left : target->right;
+        Node* parent = path.empty() ? nullptr : path.back();
+        bool childLeft = parent && parent->left == target;
+        replaceChild(parent, target, child);
+        bool removedBlack = !target->red;
+        target->left = target->right = nullptr; // child's link moved to the parent
+        release(target);
+
+        if (removedBlack) {
+            fixRemoval(child, childLeft);
+        }
+        return true;
+    }
+};
@@ -1,27 +1,115 @@
+#pragma once
 #include <iostream>
+#include <string>
+#include <vector>
+#include <type_traits>
+#include "Hash.h"
+#include "PackFile.h"
+#include "NodeArena.h"
+#include "KeyRange.h"
+#include "Instrumentation.h"
 using namespace std;
 
-// Node structure for the Red-Black Tree
+// Node structure for the Red-Black Tree, with a Merkle hash per node like AVLNode
+template <typename Key>
 struct RBNode {
-    int value;
+    Key value;
+    HashDigest hashValue;
     bool color; // Red = true, Black = false
+    bool dirty; // hashValue is stale; if set, so is every ancestor's
     RBNode* leftChild;
     RBNode* rightChild;
     RBNode* parentNode;
 
-    RBNode(int value)
-        : value(value), color(true), leftChild(nullptr), rightChild(nullptr), parentNode(nullptr) {}
+    RBNode(Key value)
+        : value(move(value)), hashValue(), color(true), dirty(true), leftChild(nullptr), rightChild(nullptr), parentNode(nullptr) {}
 };
 
-// Red-Black Tree class
+// Red-Black Tree class. Key is int or string; Hasher is the Merkle hash strategy (see Hash.h)
+// and Allocator hands out the nodes: NodeArena or HeapNodeAllocator (see NodeArena.h).
+//
+// Every structural change marks the nodes whose subtree changed as dirty: the inserted or
+// removed node's ancestors and both nodes of each rotation. The dirty nodes always form a
+// subtree at the root, and they are rehashed bottom-up after each insert or delete (or once,
+// in flushHashes, with deferred hashing), so an operation costs O(log n) hashes.
+template <typename Key = int, typename Hasher = InstructorHash, typename Allocator = NodeArena<RBNode<Key>>>
 class RBTree {
+public:
+    typedef RBNode<Key> Node;
+    typedef Hasher HasherType;
+
 private:
-    RBNode* root;
-    RBNode* sentinel;
+    Node* root;
+    Node* sentinel;
+    Allocator nodes; // Owns every node, including the sentinel
+    Hasher hasher;
+    bool deferredHashing = false;
+    uint64_t rotationCount = 0;
+
+    // Marks node and all of its ancestors dirty. The whole path is walked even when some
+    // nodes are already dirty, since a delete can move a dirty node under clean ancestors.
+    void markPathDirty(Node* node) {
+        while (node != nullptr && node != sentinel) {
+            node->dirty = true;
+            node = node->parentNode;
+        }
+    }
+
+    // Post-order rehash of the dirty nodes only; clean subtrees are skipped whole
+    void rehashDirty(Node* node) {
+        if (node == sentinel || !node->dirty) {
+            return;
+        }
+        rehashDirty(node->leftChild);
+        rehashDirty(node->rightChild);
+        hasher.hashNode(packKey(node->value),
+            node->leftChild != sentinel ? &node->leftChild->hashValue : nullptr,
+            node->rightChild != sentinel ? &node->rightChild->hashValue : nullptr,
+            node->hashValue);
+        node->dirty = false;
+    }
+
+    // Hashes after an insert or delete, unless they are deferred
+    void updateHashes() {
+        if (!deferredHashing) {
+            flushHashes();
+        }
+    }
+
+    // Builds a perfectly balanced subtree from keys[lo, hi). Nodes on the deepest level are
+    // red and the rest black, which gives every path the same number of black nodes.
+    Node* buildBalanced(vector<Key>& keys, size_t lo, size_t hi, int depth, int redDepth, Node* parent) {
+        if (lo >= hi) {
+            return sentinel;
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        Node* node = nodes.create(move(keys[mid]));
+        node->color = depth == redDepth && depth > 0;
+        node->parentNode = parent;
+        node->leftChild = buildBalanced(keys, lo, mid, depth + 1, redDepth, node);
+        node->rightChild = buildBalanced(keys, mid + 1, hi, depth + 1, redDepth, node);
+        return node;
+    }
+
+    // Returns every node of a subtree to the allocator
+    void destroySubtree(Node* node) {
+        vector<Node*> stack;
+        if (node != sentinel) {
+            stack.push_back(node);
+        }
+        while (!stack.empty()) {
+            node = stack.back();
+            stack.pop_back();
+            if (node->leftChild != sentinel) stack.push_back(node->leftChild);
+            if (node->rightChild != sentinel) stack.push_back(node->rightChild);
+            nodes.destroy(node);
+        }
+    }
 
     // Rotate left function
-    void rotateLeft(RBNode* node) {
-        RBNode* temp = node->rightChild;
+    void rotateLeft(Node* node) {
+        rotationCount++;
+        Node* temp = node->rightChild;
         node->rightChild = temp->leftChild;
         if (temp->leftChild != sentinel) {
             temp->leftChild->parentNode = node;
@@ -38,11 +126,14 @@ private:
         }
         temp->leftChild = node;
         node->parentNode = temp;
+        node->dirty = true;
+        temp->dirty = true;
     }
 
     // Rotate right function
-    void rotateRight(RBNode* node) {
-        RBNode* temp = node->leftChild;
+    void rotateRight(Node* node) {
+        rotationCount++;
+        Node* temp = node->leftChild;
         node->leftChild = temp->rightChild;
         if (temp->rightChild != sentinel) {
             temp->rightChild->parentNode = node;
@@ -59,13 +150,15 @@ private:
         }
         temp->rightChild = node;
         node->parentNode = temp;
+        node->dirty = true;
+        temp->dirty = true;
     }
 
     // Balance the Red-Black Tree after inserting a node
-    void fixInsertion(RBNode* node) {
+    void fixInsertion(Node* node) {
         while (node != root && node->parentNode->color == true) {
             if (node->parentNode == node->parentNode->parentNode->leftChild) {
-                RBNode* uncle = node->parentNode->parentNode->rightChild;
+                Node* uncle = node->parentNode->parentNode->rightChild;
                 if (uncle->color == true) {
                     node->parentNode->color = false;
                     uncle->color = false;
@@ -83,7 +176,7 @@ private:
                 }
             }
             else {
-                RBNode* uncle = node->parentNode->parentNode->leftChild;
+                Node* uncle = node->parentNode->parentNode->leftChild;
                 if (uncle->color == true) {
                     node->parentNode->color = false;
                     uncle->color = false;
@@ -104,37 +197,39 @@ private:
         root->color = false;
     }
 
-    // Inorder traversal
-    void inorderTraversal(RBNode* node) {
-        if (node != sentinel) {
-            inorderTraversal(node->leftChild);
-            cout << node->value << " ";
-            inorderTraversal(node->rightChild);
+
+    // Writes a subtree to the pack in post-order and returns its record index
+    uint32_t writePackNode(PackWriter& pack, Node* node) {
+        if (node == sentinel) {
+            return PACK_NO_NODE;
         }
+        uint32_t left = writePackNode(pack, node->leftChild);
+        size_t slot = pack.reserveIndexSlot();
+        uint32_t right = writePackNode(pack, node->rightChild);
+        uint32_t index = pack.addNode(packKey(node->value), node->hashValue, left, right, 0, node->color ? 1 : 0);
+        pack.fillIndexSlot(slot, index);
+        return index;
     }
 
     // Search helper function
-    RBNode* searchNode(RBNode* node, int value) {
-        if (node == sentinel || node->value == value) {
-            return node;
+    Node* searchNode(Node* node, const Key& value) const {
+        while (node != sentinel && !(node->value == value)) {
+            node = value < node->value ? node->leftChild : node->rightChild;
         }
-        if (value < node->value) {
-            return searchNode(node->leftChild, value);
-        }
-        return searchNode(node->rightChild, value);
+        return node;
     }
  
 
     // Delete function to remove a value from the Red-Black Tree
-    void removeValue(int value) {
-        RBNode* z = searchValue(value);  // Find the node to delete
+    bool removeValue(const Key& value) {
+        Node* z = searchValue(value);  // Find the node to delete
         if (z == sentinel) {
-            cout << "Value not found in the tree." << endl;
-            return;
+            if (verboseLogging) cout << "Value not found in the tree." << '\n';
+            return false;
         }
 
-        RBNode* y = z;
-        RBNode* x;
+        Node* y = z;
+        Node* x;
         bool yOriginalColor = y->color;
 
         if (z->leftChild == sentinel) {
@@ -165,16 +260,21 @@ private:
             y->color = z->color;
         }
 
+        // Every subtree from x's parent up to the root lost a node
+        markPathDirty(x->parentNode);
+
         // After deletion, we need to fix any violations of the Red-Black properties
         if (yOriginalColor == false) {
             fixDeletion(x);
         }
 
-        delete z;
+        nodes.destroy(z); // the slot is reused by the next insert
+        updateHashes();
+        return true;
     }
 
     // Transplant helper function for node replacement
-    void transplantNodes(RBNode* oldNode, RBNode* newNode) {
+    void transplantNodes(Node* oldNode, Node* newNode) {
         if (oldNode->parentNode == nullptr) {
             root = newNode;
         }
@@ -188,7 +288,7 @@ private:
     }
 
     // Function to find the minimum node in a subtree (used during deletion)
-    RBNode* treeMinimum(RBNode* node) {
+    Node* treeMinimum(Node* node) {
         while (node->leftChild != sentinel) {
             node = node->leftChild;
         }
@@ -196,10 +296,10 @@ private:
     }
 
     // Fix the tree after deletion to restore Red-Black properties
-    void fixDeletion(RBNode* x) {
+    void fixDeletion(Node* x) {
         while (x != root && x->color == false) {
             if (x == x->parentNode->leftChild) {
-                RBNode* sibling = x->parentNode->rightChild;
+                Node* sibling = x->parentNode->rightChild;
                 if (sibling->color == true) {
                     sibling->color = false;
                     x->parentNode->color = true;
@@ -225,7 +325,7 @@ private:
                 }
             }
             else {
-                RBNode* sibling = x->parentNode->leftChild;
+                Node* sibling = x->parentNode->leftChild;
                 if (sibling->color == true) {
                     sibling->color = false;
                     x->parentNode->color = true;
@@ -258,32 +358,49 @@ private:
 public:
     // Constructor
     RBTree() {
-        sentinel = new RBNode(0);
+        sentinel = nodes.create(Key());
         sentinel->color = false;
+        sentinel->dirty = false;
         sentinel->leftChild = sentinel->rightChild = sentinel;
         root = sentinel;
     }
 
-    // Insert function
-    void insertValue(int value) {
-        RBNode* newNode = new RBNode(value);
-        newNode->leftChild = sentinel;
-        newNode->rightChild = sentinel;
+    ~RBTree() {
+        // Arena nodes hold nothing that needs a destructor, so the slabs are simply freed
+        if (!Allocator::BULK_RELEASE || !is_trivially_destructible<Node>::value) {
+            destroySubtree(root);
+            nodes.destroy(sentinel);
+        }
+        nodes.release();
+    }
 
-        RBNode* parentNode = nullptr;
-        RBNode* currentNode = root;
+    // The tree owns its nodes
+    RBTree(const RBTree&) = delete;
+    RBTree& operator=(const RBTree&) = delete;
+
+    // Insert function; returns false (and changes nothing) if the value is already present
+    bool insertValue(const Key& value) {
+        Node* parentNode = nullptr;
+        Node* currentNode = root;
 
         // Standard BST insert
         while (currentNode != sentinel) {
             parentNode = currentNode;
-            if (newNode->value < currentNode->value) {
+            if (value < currentNode->value) {
                 currentNode = currentNode->leftChild;
             }
-            else {
+            else if (currentNode->value < value) {
                 currentNode = currentNode->rightChild;
             }
+            else {
+                return false; // Duplicate keys are not allowed
+            }
         }
 
+        Node* newNode = nodes.create(value);
+        newNode->leftChild = sentinel;
+        newNode->rightChild = sentinel;
+
         newNode->parentNode = parentNode;
 
         if (parentNode == nullptr) {
@@ -296,30 +413,319 @@ public:
             parentNode->rightChild = newNode;
         }
 
+        markPathDirty(parentNode);
+
         if (newNode->parentNode == nullptr) {
             newNode->color = false;
-            return;
         }
+        else if (newNode->parentNode->parentNode != nullptr) {
+            fixInsertion(newNode);
+        }
+        updateHashes();
+        return true;
+    }
 
-        if (newNode->parentNode->parentNode == nullptr) {
-            return;
+    // Bulk load: replaces the tree with one built from sorted, duplicate-free keys in O(n).
+    // The keys are moved into the nodes.
+    void buildFromSorted(vector<Key>&& keys) {
+        clear();
+        int redDepth = 0;
+        while ((size_t(2) << redDepth) - 1 < keys.size()) {
+            redDepth++;
         }
+        root = buildBalanced(keys, 0, keys.size(), 0, redDepth, nullptr);
+        keys.clear();
+        updateHashes();
+    }
+
+    // Removes every node
+    void clear() {
+        destroySubtree(root);
+        root = sentinel;
+    }
 
-        fixInsertion(newNode);
+    // Deferred hashing: inserts and deletes only mark nodes dirty, and the hashes are
+    // recomputed in one pass when the root hash or a save needs them
+    void setDeferredHashing(bool enabled) {
+        deferredHashing = enabled;
+        if (!enabled) flushHashes();
+    }
+
+    void flushHashes() {
+        if (root == sentinel || !root->dirty) return;
+        Stopwatch timer;
+        rehashDirty(root);
+        hasher.addBatchTime(timer.nanoseconds());
+    }
+
+    // Get the hash of the root node (Merkle Root Hash), formatted by the hasher
+    string getRootHash() {
+        return Hasher::toString(getRootDigest());
+    }
+
+    HashDigest getRootDigest() {
+        flushHashes();
+        return root != sentinel ? root->hashValue : HashDigest();
+    }
+
+    const HashStats& getHashStats() const {
+        return hasher.getStats();
+    }
+
+    uint64_t getRotationCount() const {
+        return rotationCount;
+    }
+
+    // Forward in-order iterator. It holds the path to the current node instead of using
+    // recursion, so a scan can be stopped and resumed; any insert or remove invalidates it.
+    // (Stepping with the parent links needs no stack but measured about 4x slower.)
+    class Iterator {
+    private:
+        friend class RBTree;
+        vector<const Node*> stack; // current node on top, then the ancestors still to visit
+        const Node* sentinel;
+
+        void pushLeftSpine(const Node* node) {
+            while (node != sentinel) {
+                stack.push_back(node);
+                node = node->leftChild;
+            }
+        }
+
+        // Positions on the first value >= value by keeping the nodes where the search
+        // turns left, which are exactly the ones an in-order walk still has to visit
+        void seek(const Node* node, const Key& value) {
+            while (node != sentinel) {
+                if (node->value < value) {
+                    node = node->rightChild;
+                }
+                else {
+                    stack.push_back(node);
+                    node = node->leftChild;
+                }
+            }
+        }
+
+    public:
+        Iterator(const Node* root, const Node* treeSentinel) : sentinel(treeSentinel) {
+            pushLeftSpine(root);
+        }
+
+        const Key& operator*() const {
+            return stack.back()->value;
+        }
+
+        const Key* operator->() const {
+            return &stack.back()->value;
+        }
+
+        // Merkle hash of the current node's subtree
+        const HashDigest& hash() const {
+            return stack.back()->hashValue;
+        }
+
+        Iterator& operator++() {
+            const Node* node = stack.back();
+            stack.pop_back();
+            pushLeftSpine(node->rightChild);
+            return *this;
+        }
+
+        bool operator==(const Iterator& other) const {
+            if (stack.empty() || other.stack.empty()) return stack.empty() == other.stack.empty();
+            return stack.back() == other.stack.back();
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return !(*this == other);
+        }
+    };
+
+    Iterator begin() const {
+        return Iterator(root, sentinel);
+    }
+
+    Iterator end() const {
+        return Iterator(sentinel, sentinel);
+    }
+
+    // Calls fn(value) for every value in order
+    template <typename Fn>
+    void forEachKey(Fn fn) const {
+        for (Iterator it = begin(); it != end(); ++it) {
+            fn(*it);
+        }
+    }
+
+    // Iterator at the first value >= value, or end()
+    Iterator lowerBound(const Key& value) const {
+        Iterator it(sentinel, sentinel);
+        it.seek(root, value);
+        return it;
+    }
+
+    // Values in [low, high), streamed in order
+    KeyRange<Iterator, Key> range(const Key& low, const Key& high) const {
+        return KeyRange<Iterator, Key>(lowerBound(low), end(), high, true);
+    }
+
+    // Values beginning with start, streamed in order (string keys only)
+    template <typename K = Key>
+    KeyRange<Iterator, Key> prefix(string_view start) const {
+        static_assert(is_same<K, string>::value, "prefix scans need string keys");
+        string upper;
+        bool bounded = prefixUpperBound(start, upper);
+        return KeyRange<Iterator, Key>(lowerBound(string(start)), end(), move(upper), bounded);
     }
 
     // Inorder traversal
     void inorder() {
-        inorderTraversal(root);
+        for (Iterator it = begin(); it != end(); ++it) {
+            cout << *it << " ";
+        }
     }
 
     // Search function
-    RBNode* searchValue(int value) {
+    Node* searchValue(const Key& value) {
         return searchNode(root, value);
     }
 
-    void remove(int value)
+    bool remove(const Key& value)
     {
-        removeValue(value);
+        return removeValue(value);
+    }
+
+    bool contains(const Key& value) const {
+        const Node* node = root;
+        while (node != sentinel) {
+            if (value < node->value) node = node->leftChild;
+            else if (node->value < value) node = node->rightChild;
+            else return true;
+        }
+        return false;
+    }
+
+    // Number of values in the tree
+    size_t size() const {
+        return nodes.size() - 1;
+    }
+
+    // Pre-order walk over the nodes and their Merkle hashes: fn(key bytes, hash, leftHash,
+    // rightHash), with null for a missing child, returns false to skip the node's subtree
+    template <typename Fn>
+    void visitNodes(Fn fn) {
+        flushHashes();
+        vector<const Node*> stack;
+        if (root != sentinel) stack.push_back(root);
+        while (!stack.empty()) {
+            const Node* node = stack.back();
+            stack.pop_back();
+            if (!fn(packKey(node->value), node->hashValue,
+                node->leftChild != sentinel ? &node->leftChild->hashValue : nullptr,
+                node->rightChild != sentinel ? &node->rightChild->hashValue : nullptr)) {
+                continue;
+            }
+            if (node->rightChild != sentinel) stack.push_back(node->rightChild);
+            if (node->leftChild != sentinel) stack.push_back(node->leftChild);
+        }
+    }
+
+    // Replaces the tree with the one stored by savePack. Hashes and colors are taken from the
+    // file, not recomputed; records come children-first, so every child exists before its parent.
+    bool loadPack(const string& path) {
+        PackReader pack;
+        if (!pack.open(path)) return false;
+        if (pack.hashMethod() != Hasher::name()) {
+            cerr << "Error: " << path << " was written with " << pack.hashMethod() << ", not " << Hasher::name() << endl;
+            return false;
+        }
+
+        // Every record but the root must be the child of exactly one later record, no red node
+        // may have a red child, every path must hold the same number of black nodes, and the
+        // keys must strictly increase in order. That makes the file a real red-black tree, so
+        // every walk over it stays O(log n) deep and later changes find their keys.
+        vector<Node*> loaded(pack.nodeCount());
+        vector<bool> hasParent(pack.nodeCount(), false);
+        vector<uint32_t> blackHeight(pack.nodeCount());
+        auto validChild = [&](uint32_t child, uint64_t parent) {
+            return child == PACK_NO_NODE || (child < parent && !hasParent[child]);
+        };
+        auto childNode = [&](uint32_t child) {
+            return child == PACK_NO_NODE ? sentinel : loaded[child];
+        };
+        auto childBlackHeight = [&](uint32_t child) {
+            return child == PACK_NO_NODE ? 1u : blackHeight[child];
+        };
+        string error;
+        for (uint64_t i = 0; i < pack.nodeCount() && error.empty(); i++) {
+            PackRecord record = pack.record(i);
+            Key value;
+            if (!validChild(record.left, i) || !validChild(record.right, i) || (record.left == record.right && record.left != PACK_NO_NODE) ||
+                !pack.keyInBounds(record) || !unpackKey(pack.key(record), value)) {
+                error = "a corrupt node " + to_string(i);
+                break;
+            }
+            Node* node = nodes.create(move(value));
+            node->hashValue = record.hash;
+            node->color = record.flags != 0;
+            node->dirty = false;
+            node->leftChild = childNode(record.left);
+            node->rightChild = childNode(record.right);
+            if (record.left != PACK_NO_NODE) {
+                hasParent[record.left] = true;
+                node->leftChild->parentNode = node;
+            }
+            if (record.right != PACK_NO_NODE) {
+                hasParent[record.right] = true;
+                node->rightChild->parentNode = node;
+            }
+            loaded[i] = node;
+            blackHeight[i] = childBlackHeight(record.left) + (node->color ? 0 : 1);
+            if (childBlackHeight(record.left) != childBlackHeight(record.right) ||
+                (node->color && (node->leftChild->color || node->rightChild->color))) {
+                error = "an unbalanced node " + to_string(i);
+            }
+        }
+        for (uint64_t i = 0; i < pack.nodeCount() && error.empty(); i++) {
+            if (hasParent[i] == (i == pack.rootIndex())) {
+                error = "a node outside the tree " + to_string(i);
+            }
+        }
+        if (error.empty() && !loaded.empty() && loaded[pack.rootIndex()]->color) {
+            error = "a red root";
+        }
+        if (error.empty() && !pack.keysInOrder()) {
+            error = "keys out of order";
+        }
+        if (!error.empty()) {
+            cerr << "Error: " << path << " has " << error << endl;
+            for (Node* node : loaded) {
+                if (node) nodes.destroy(node);
+            }
+            return false;
+        }
+        clear();
+        if (!loaded.empty()) {
+            root = loaded[pack.rootIndex()];
+            root->parentNode = nullptr;
+        }
+        return true;
+    }
+
+    // Save the tree in the pack format (int keys as packIntKey, color in the record flags)
+    // so it can be opened read-only with MappedTree
+    bool savePack(const string& path) {
+        flushHashes();
+        PackWriter pack;
+        if (!pack.open(path, Hasher::name())) {
+            cerr << "Error: Unable to create pack file " << path << endl;
+            return false;
+        }
+        uint32_t rootIndex = writePackNode(pack, root);
+        if (!pack.finish(rootIndex)) {
+            cerr << "Error: Failed writing pack file " << path << endl;
+            return false;
+        }
+        return true;
     }
 };
\ No newline at end of file
@@ -0,0 +1,843 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <queue>
+#include <filesystem>
+#include <cstring>
+#include <cstdint>
+#include "PackFile.h"
+#include "MappedFile.h"
+#include "LZCodec.h"
+#include "CSVReader.h"
+using namespace std;
+
+// Full rows of a CSV revision, sorted by the tree's key column, so each tree key can be
+// mapped back to the rows it came from.
+//
+//   [chunks][first keys][column names][block entries][chunk entries][footer]
+//
+// Rows are cut into blocks of rowsPerBlock, and each block stores every column as its own
+// chunk: values of one column look alike, so they compress far better than whole rows. A
+// chunk is [varint length][bytes] per value, or with ROW_CHUNK_DICTIONARY the distinct
+// values once followed by a varint code per row; either is then LZ-compressed if that
+// helps (ROW_CHUNK_LZ). A lookup binary-searches the blocks' first keys and decodes only
+// the key chunk of the blocks it lands in, then the other chunks of the rows it returns.
+
+const uint8_t ROW_CHUNK_DICTIONARY = 1;
+const uint8_t ROW_CHUNK_LZ = 2;
+
+struct RowBlockEntry {
+    uint64_t firstKeyOffset; // into the first keys
+    uint32_t firstKeyLength;
+    uint32_t rowCount;
+};
+static_assert(sizeof(RowBlockEntry) == 16, "row block entries must stay 16 bytes");
+
+struct RowChunkEntry {
+    uint64_t offset;
+    uint32_t storedSize;
+    uint32_t rawSize;
+    uint8_t encoding;
+    uint8_t reserved[7];
+};
+static_assert(sizeof(RowChunkEntry) == 24, "row chunk entries must stay 24 bytes");
+
+struct RowFooter {
+    char magic[8];          // "GLROWS1"
+    uint32_t version;
+    uint32_t columnCount;
+    uint32_t keyColumn;
+    uint32_t rowsPerBlock;
+    uint64_t rowCount;
+    uint64_t blockCount;
+    uint64_t keysOffset;
+    uint64_t keysSize;
+    uint64_t namesOffset;
+    uint64_t namesSize;
+    uint64_t blocksOffset;  // block entries, then blockCount * columnCount chunk entries
+};
+static_assert(sizeof(RowFooter) == 80, "row footer must stay 80 bytes");
+
+inline void appendVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Reads a varint at pos; false if it runs past the end
+inline bool readVarint(string_view bytes, size_t& pos, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < bytes.size(); shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(bytes[pos++]);
+        value |= uint64_t(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+// Writes rows in key order. Every row must be added with its key no smaller than the last
+// one's; missing trailing fields are stored empty.
+class RowStoreWriter {
+private:
+    struct ColumnBuffer {
+        string values;       // this block's values back to back
+        vector<uint32_t> ends;
+    };
+
+    BufferedFileWriter out;
+    vector<string> columnNames;
+    size_t keyColumn = 0;
+    uint32_t rowsPerBlock = 0;
+    vector<ColumnBuffer> columns;
+    uint32_t blockRows = 0;
+    uint64_t rowCount = 0;
+    string firstKeys;
+    vector<RowBlockEntry> blocks;
+    vector<RowChunkEntry> chunks;
+    string lastKey;
+    bool outOfOrder = false;
+    uint64_t rawBytes = 0;
+
+    // One column of the current block in its smaller encoding
+    void writeChunk(const ColumnBuffer& column) {
+        string plain;
+        string dictionary;
+        unordered_map<string_view, uint32_t> codes;
+        string rowCodes;
+        uint32_t start = 0;
+        for (uint32_t end : column.ends) {
+            string_view value(column.values.data() + start, end - start);
+            appendVarint(plain, value.size());
+            plain.append(value);
+            auto inserted = codes.emplace(value, static_cast<uint32_t>(codes.size()));
+            if (inserted.second) {
+                appendVarint(dictionary, value.size());
+                dictionary.append(value);
+            }
+            appendVarint(rowCodes, inserted.first->second);
+            start = end;
+        }
+
+        RowChunkEntry chunk;
+        memset(&chunk, 0, sizeof(chunk));
+        string raw;
+        if (codes.size() <= column.ends.size() / 2) {
+            appendVarint(raw, codes.size());
+            raw += dictionary;
+            raw += rowCodes;
+            chunk.encoding = ROW_CHUNK_DICTIONARY;
+        }
+        else {
+            raw.swap(plain);
+        }
+        vector<uint8_t> compressed;
+        lzCompress(reinterpret_cast<const uint8_t*>(raw.data()), raw.size(), compressed);
+        chunk.offset = out.position();
+        chunk.rawSize = static_cast<uint32_t>(raw.size());
+        if (compressed.size() < raw.size() - raw.size() / 8) {
+            chunk.encoding |= ROW_CHUNK_LZ;
+            chunk.storedSize = static_cast<uint32_t>(compressed.size());
+            out.write(compressed.data(), compressed.size());
+        }
+        else {
+            chunk.storedSize = chunk.rawSize;
+            out.write(raw.data(), raw.size());
+        }
+        chunks.push_back(chunk);
+    }
+
+    void flushBlock() {
+        if (blockRows == 0) return;
+        for (ColumnBuffer& column : columns) {
+            writeChunk(column);
+            column.values.clear();
+            column.ends.clear();
+        }
+        blocks.back().rowCount = blockRows;
+        blockRows = 0;
+    }
+
+public:
+    bool open(const string& path, const vector<string>& names, size_t keyColumnIndex, uint32_t blockSize = 1024) {
+        columnNames = names;
+        keyColumn = keyColumnIndex;
+        rowsPerBlock = max<uint32_t>(blockSize, 1);
+        columns.assign(names.size(), ColumnBuffer());
+        blockRows = 0;
+        rowCount = 0;
+        firstKeys.clear();
+        blocks.clear();
+        chunks.clear();
+        lastKey.clear();
+        outOfOrder = false;
+        rawBytes = 0;
+        return keyColumn < names.size() && out.open(path);
+    }
+
+    void addRow(const vector<string_view>& fields) {
+        string_view key = keyColumn < fields.size() ? fields[keyColumn] : string_view();
+        if (rowCount > 0 && key < lastKey) outOfOrder = true;
+        lastKey.assign(key.data(), key.size());
+        if (blockRows == 0) {
+            blocks.push_back(RowBlockEntry{ firstKeys.size(), static_cast<uint32_t>(key.size()), 0 });
+            firstKeys.append(key);
+        }
+        for (size_t c = 0; c < columns.size(); c++) {
+            if (c < fields.size()) {
+                columns[c].values.append(fields[c]);
+                rawBytes += fields[c].size() + 1; // plus the comma or line end it had
+            }
+            columns[c].ends.push_back(static_cast<uint32_t>(columns[c].values.size()));
+        }
+        rowCount++;
+        if (++blockRows == rowsPerBlock) {
+            flushBlock();
+        }
+    }
+
+    bool close() {
+        flushBlock();
+        RowFooter footer;
+        memset(&footer, 0, sizeof(footer));
+        memcpy(footer.magic, "GLROWS1", 8);
+        footer.version = 1;
+        footer.columnCount = static_cast<uint32_t>(columnNames.size());
+        footer.keyColumn = static_cast<uint32_t>(keyColumn);
+        footer.rowsPerBlock = rowsPerBlock;
+        footer.rowCount = rowCount;
+        footer.blockCount = blocks.size();
+
+        footer.keysOffset = out.position();
+        footer.keysSize = firstKeys.size();
+        out.write(firstKeys.data(), firstKeys.size());
+        string names;
+        for (const string& name : columnNames) {
+            appendVarint(names, name.size());
+            names += name;
+        }
+        footer.namesOffset = out.position();
+        footer.namesSize = names.size();
+        out.write(names.data(), names.size());
+        const char padding[8] = {};
+        out.write(padding, (8 - out.position() % 8) % 8); // the tables are read in place
+        footer.blocksOffset = out.position();
+        out.write(blocks.data(), blocks.size() * sizeof(RowBlockEntry));
+        out.write(chunks.data(), chunks.size() * sizeof(RowChunkEntry));
+        out.write(&footer, sizeof(footer));
+        if (!out.close()) {
+            cerr << "Error: Failed writing the row file" << endl;
+            return false;
+        }
+        if (outOfOrder) {
+            cerr << "Error: Rows were not added in key order" << endl;
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t size() const {
+        return rowCount;
+    }
+
+    // The rows as CSV text, roughly: every field plus its separator
+    uint64_t csvBytes() const {
+        return rawBytes;
+    }
+
+    uint64_t fileBytes() const {
+        return out.position();
+    }
+};
+
+// Read side of a row file. The file is mapped and chunks are decoded on first use; the last
+// block decoded is kept, so rows close together in key order cost one decode.
+class RowStore {
+private:
+    // One decoded chunk: where each row's value is in the decompressed bytes (or in the
+    // mapping, for a chunk stored as is)
+    struct Column {
+        string raw;
+        const char* base = nullptr;
+        vector<uint32_t> offsets;
+        vector<uint32_t> lengths;
+        bool decoded = false;
+
+        string_view value(size_t row) const {
+            return string_view(base + offsets[row], lengths[row]);
+        }
+    };
+
+    MappedFile file;
+    RowFooter footer;
+    vector<string> names;
+    const RowBlockEntry* blocks = nullptr;
+    const RowChunkEntry* chunks = nullptr;
+    uint64_t cachedBlock = UINT64_MAX;
+    vector<Column> cached;
+    uint64_t chunksDecoded = 0;
+
+    string_view firstKey(uint64_t block) const {
+        return string_view(file.data() + footer.keysOffset + blocks[block].firstKeyOffset, blocks[block].firstKeyLength);
+    }
+
+    bool decodeChunk(uint64_t block, size_t column, Column& out) {
+        const RowChunkEntry& chunk = chunks[block * footer.columnCount + column];
+        const uint32_t rows = blocks[block].rowCount;
+        if (chunk.offset + chunk.storedSize > footer.keysOffset) return false;
+        string_view bytes(file.data() + chunk.offset, chunk.storedSize);
+        if (chunk.encoding & ROW_CHUNK_LZ) {
+            out.raw.resize(chunk.rawSize);
+            if (!lzDecompress(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size(),
+                reinterpret_cast<uint8_t*>(&out.raw[0]), out.raw.size())) {
+                return false;
+            }
+            bytes = out.raw;
+        }
+        else if (chunk.rawSize != chunk.storedSize) {
+            return false;
+        }
+
+        out.base = bytes.data();
+        out.offsets.resize(rows);
+        out.lengths.resize(rows);
+        size_t pos = 0;
+        uint64_t length;
+        if (chunk.encoding & ROW_CHUNK_DICTIONARY) {
+            uint64_t count;
+            if (!readVarint(bytes, pos, count) || count > bytes.size()) return false;
+            vector<uint32_t> entryOffsets(static_cast<size_t>(count));
+            vector<uint32_t> entryLengths(static_cast<size_t>(count));
+            for (uint64_t i = 0; i < count; i++) {
+                if (!readVarint(bytes, pos, length) || length > bytes.size() - pos) return false;
+                entryOffsets[i] = static_cast<uint32_t>(pos);
+                entryLengths[i] = static_cast<uint32_t>(length);
+                pos += static_cast<size_t>(length);
+            }
+            uint64_t code;
+            for (uint32_t row = 0; row < rows; row++) {
+                if (!readVarint(bytes, pos, code) || code >= count) return false;
+                out.offsets[row] = entryOffsets[static_cast<size_t>(code)];
+                out.lengths[row] = entryLengths[static_cast<size_t>(code)];
+            }
+        }
+        else {
+            for (uint32_t row = 0; row < rows; row++) {
+                if (!readVarint(bytes, pos, length) || length > bytes.size() - pos) return false;
+                out.offsets[row] = static_cast<uint32_t>(pos);
+                out.lengths[row] = static_cast<uint32_t>(length);
+                pos += static_cast<size_t>(length);
+            }
+        }
+        chunksDecoded++;
+        out.decoded = true;
+        return pos == bytes.size();
+    }
+
+    const Column* column(uint64_t block, size_t index) {
+        if (block != cachedBlock) {
+            cachedBlock = block;
+            for (Column& entry : cached) entry.decoded = false;
+        }
+        Column& entry = cached[index];
+        if (!entry.decoded && !decodeChunk(block, index, entry)) {
+            cerr << "Error: Corrupt row chunk in block " << block << endl;
+            cachedBlock = UINT64_MAX;
+            entry.decoded = false;
+            return nullptr;
+        }
+        return &entry;
+    }
+
+public:
+    bool open(const string& path) {
+        names.clear();
+        cachedBlock = UINT64_MAX;
+        if (!file.open(path) || file.size() < sizeof(RowFooter)) {
+            cerr << "Error: Unable to open row file " << path << endl;
+            return false;
+        }
+        memcpy(&footer, file.data() + file.size() - sizeof(RowFooter), sizeof(RowFooter));
+        const uint64_t tableBytes = footer.blockCount * (sizeof(RowBlockEntry) + uint64_t(footer.columnCount) * sizeof(RowChunkEntry));
+        if (memcmp(footer.magic, "GLROWS1", 8) != 0 || footer.version != 1 || footer.columnCount == 0 ||
+            footer.keyColumn >= footer.columnCount || footer.columnCount > file.size() || footer.blockCount > file.size() ||
+            footer.keysOffset + footer.keysSize > footer.namesOffset ||
+            footer.namesOffset + footer.namesSize > footer.blocksOffset || footer.blocksOffset % 8 != 0 ||
+            footer.blocksOffset + tableBytes + sizeof(RowFooter) != file.size()) {
+            cerr << "Error: Corrupt row file " << path << endl;
+            file.close();
+            return false;
+        }
+        blocks = reinterpret_cast<const RowBlockEntry*>(file.data() + footer.blocksOffset);
+        chunks = reinterpret_cast<const RowChunkEntry*>(file.data() + footer.blocksOffset + footer.blockCount * sizeof(RowBlockEntry));
+        string_view nameBytes(file.data() + footer.namesOffset, footer.namesSize);
+        size_t pos = 0;
+        uint64_t length;
+        while (pos < nameBytes.size() && readVarint(nameBytes, pos, length) && length <= nameBytes.size() - pos) {
+            names.emplace_back(nameBytes.substr(pos, static_cast<size_t>(length)));
+            pos += static_cast<size_t>(length);
+        }
+        uint64_t rows = 0;
+        for (uint64_t b = 0; b < footer.blockCount; b++) {
+            rows += blocks[b].rowCount;
+            if (blocks[b].firstKeyOffset + blocks[b].firstKeyLength > footer.keysSize || blocks[b].rowCount == 0) {
+                names.clear();
+            }
+        }
+        if (names.size() != footer.columnCount || rows != footer.rowCount) {
+            cerr << "Error: Corrupt row file " << path << endl;
+            file.close();
+            return false;
+        }
+        cached.assign(footer.columnCount, Column());
+        return true;
+    }
+
+    // Every row whose key column equals key, each as its fields in column order. Rows with
+    // the same key can run across blocks, so the search starts in the block before the
+    // first one that starts at or after key.
+    bool findRows(string_view key, vector<vector<string>>& rows) {
+        rows.clear();
+        uint64_t low = 0, high = footer.blockCount;
+        while (low < high) {
+            uint64_t middle = low + (high - low) / 2;
+            if (firstKey(middle) < key) low = middle + 1;
+            else high = middle;
+        }
+        for (uint64_t block = low == 0 ? 0 : low - 1; block < footer.blockCount && firstKey(block) <= key; block++) {
+            const Column* keys = column(block, footer.keyColumn);
+            if (!keys) return false;
+            const uint32_t count = blocks[block].rowCount;
+            uint32_t first = 0, last = count;
+            while (first < last) {
+                uint32_t middle = first + (last - first) / 2;
+                if (keys->value(middle) < key) first = middle + 1;
+                else last = middle;
+            }
+            uint32_t row = first;
+            for (; row < count && keys->value(row) == key; row++) {
+                rows.emplace_back();
+                for (size_t c = 0; c < footer.columnCount; c++) {
+                    const Column* values = column(block, c);
+                    if (!values) return false;
+                    rows.back().emplace_back(values->value(row));
+                }
+            }
+            if (row < count) break; // the run ended inside this block
+        }
+        return true;
+    }
+
+    const vector<string>& columnNames() const {
+        return names;
+    }
+
+    size_t keyColumn() const {
+        return footer.keyColumn;
+    }
+
+    uint64_t size() const {
+        return footer.rowCount;
+    }
+
+    uint64_t fileBytes() const {
+        return file.size();
+    }
+
+    // Chunks decoded so far; a lookup in the cached block decodes none
+    uint64_t decodeCount() const {
+        return chunksDecoded;
+    }
+};
+
+// Rows as read from a CSV, back to back in text, each with its key as a span of the same
+// text (a key that had to be unescaped is stored after the rows)
+struct CSVRowBlock {
+    struct RowSpan {
+        uint64_t offset;
+        uint64_t keyOffset;
+        uint32_t length;
+        uint32_t keyLength;
+    };
+    string text;
+    vector<RowSpan> spans;
+};
+
+// Adds one CSV row to a row file, split into its fields
+inline void addCSVRow(RowStoreWriter& writer, string_view row, size_t columnCount, vector<string>& fields,
+    vector<string_view>& views, string& scratch) {
+    fields.resize(columnCount);
+    views.clear();
+    string_view field;
+    for (size_t c = 0; c < columnCount && CSVReader::extractField(row, c, field, scratch); c++) {
+        fields[c].assign(field.data(), field.size());
+        views.push_back(fields[c]);
+    }
+    writer.addRow(views);
+}
+
+// Rows held for sorting are spilled to disk past this many bytes
+const size_t ROW_SORT_BUDGET = 64 << 20;
+const size_t ROW_SORT_MIN_RUN = 64 << 10;
+
+// Sorts CSV rows by key for a row file without holding the whole file. Rows are collected up
+// to a memory budget, then sorted and spilled as a run file next to the row file
+// (<prefix>.run<n>); write() merges the runs into the row file and removes them. A file that
+// fits the budget is sorted in memory and never touches the disk twice. Rows with equal keys
+// keep the order they were added in. At most MAX_MERGE_RUNS runs are merged at once, so with
+// more the runs are first merged in groups into longer ones.
+class RowSorter {
+private:
+    typedef CSVRowBlock::RowSpan RowSpan;
+    static const size_t MAX_MERGE_RUNS = 64;
+
+    // Rows sorted by key: spans in key order over text held in memory, or spilled to path as
+    // [key length 4][row length 4][key][row] records
+    struct Run {
+        CSVRowBlock rows;
+        string path;
+    };
+
+    // Walks one run in key order; key and row stay valid until the next advance
+    class RunReader {
+    private:
+        const CSVRowBlock* rows = nullptr;
+        size_t next = 0;
+        ifstream file;
+        vector<char> buffer;
+        size_t start = 0;
+        size_t end = 0;
+
+        // Makes sure length bytes from start are in the buffer; false at the end of the file
+        bool fill(size_t length) {
+            while (end - start < length) {
+                if (start > 0) {
+                    memmove(buffer.data(), buffer.data() + start, end - start);
+                    end -= start;
+                    start = 0;
+                }
+                if (length > buffer.size()) buffer.resize(length);
+                file.read(buffer.data() + end, static_cast<streamsize>(buffer.size() - end));
+                size_t got = static_cast<size_t>(file.gcount());
+                if (got == 0) return false;
+                end += got;
+            }
+            return true;
+        }
+
+    public:
+        string_view key;
+        string_view row;
+
+        bool open(const Run& run) {
+            if (run.path.empty()) {
+                rows = &run.rows;
+                return true;
+            }
+            buffer.resize(256 << 10);
+            file.open(run.path, ios::binary);
+            return static_cast<bool>(file);
+        }
+
+        bool advance() {
+            if (rows) {
+                if (next == rows->spans.size()) return false;
+                const RowSpan& span = rows->spans[next++];
+                key = string_view(rows->text.data() + span.keyOffset, span.keyLength);
+                row = string_view(rows->text.data() + span.offset, span.length);
+                return true;
+            }
+            uint32_t lengths[2];
+            if (!fill(sizeof(lengths))) return false;
+            memcpy(lengths, buffer.data() + start, sizeof(lengths));
+            start += sizeof(lengths);
+            if (!fill(size_t(lengths[0]) + lengths[1])) return false;
+            key = string_view(buffer.data() + start, lengths[0]);
+            row = string_view(buffer.data() + start + lengths[0], lengths[1]);
+            start += size_t(lengths[0]) + lengths[1];
+            return true;
+        }
+    };
+
+    string spillPrefix;
+    size_t budget;
+    CSVRowBlock pending;     // rows not sorted yet, in the order added
+    vector<Run> runs;        // in the order their rows were added
+    size_t heldBytes = 0;    // pending and the runs kept in memory
+    size_t spillCount = 0;
+    uint64_t rowCount = 0;
+    bool failed = false;
+
+    static size_t blockBytes(const CSVRowBlock& block) {
+        return block.text.size() + block.spans.size() * sizeof(RowSpan);
+    }
+
+    static void sortByKey(CSVRowBlock& block) {
+        const string& text = block.text;
+        stable_sort(block.spans.begin(), block.spans.end(), [&text](const RowSpan& a, const RowSpan& b) {
+            return string_view(text.data() + a.keyOffset, a.keyLength) < string_view(text.data() + b.keyOffset, b.keyLength);
+        });
+    }
+
+    // Sorts the pending rows into a run kept in memory
+    void seal() {
+        if (pending.spans.empty()) return;
+        sortByKey(pending);
+        runs.push_back(Run{ move(pending), string() });
+        pending = CSVRowBlock();
+    }
+
+    static void writeRecord(BufferedFileWriter& out, string_view key, string_view row) {
+        uint32_t lengths[2] = { static_cast<uint32_t>(key.size()), static_cast<uint32_t>(row.size()) };
+        out.write(lengths, sizeof(lengths));
+        out.write(key.data(), key.size());
+        out.write(row.data(), row.size());
+    }
+
+    string nextSpillPath() {
+        return spillPrefix + ".run" + to_string(spillCount++);
+    }
+
+    // Writes rows, sorted by key, to a new run file; the caller releases them
+    bool spill(const CSVRowBlock& rows, Run& run) {
+        run.path = nextSpillPath();
+        BufferedFileWriter out;
+        if (!out.open(run.path)) return false;
+        for (const RowSpan& span : rows.spans) {
+            writeRecord(out, string_view(rows.text.data() + span.keyOffset, span.keyLength),
+                string_view(rows.text.data() + span.offset, span.length));
+        }
+        heldBytes -= blockBytes(rows);
+        return out.close();
+    }
+
+    // Calls onRow(key, row) for the rows of runs [first, last) in key order
+    template <typename Fn>
+    bool mergeRuns(size_t first, size_t last, Fn onRow) {
+        vector<RunReader> readers(last - first);
+        for (size_t i = 0; i < readers.size(); i++) {
+            if (!readers[i].open(runs[first + i])) {
+                cerr << "Error: Unable to read " << runs[first + i].path << endl;
+                return false;
+            }
+        }
+
+        // Smallest key on top; equal keys come from the earlier run first
+        auto later = [&readers](size_t a, size_t b) {
+            return readers[b].key < readers[a].key || (readers[a].key == readers[b].key && b < a);
+        };
+        priority_queue<size_t, vector<size_t>, decltype(later)> heap(later);
+        for (size_t i = 0; i < readers.size(); i++) {
+            if (readers[i].advance()) heap.push(i);
+        }
+        while (!heap.empty()) {
+            size_t top = heap.top();
+            heap.pop();
+            onRow(readers[top].key, readers[top].row);
+            if (readers[top].advance()) heap.push(top);
+        }
+        return true;
+    }
+
+    // Merges each group of MAX_MERGE_RUNS neighbouring runs into one spilled run until few
+    // enough are left; neighbours only, so equal keys keep their order
+    bool reduceRuns() {
+        while (runs.size() > MAX_MERGE_RUNS) {
+            vector<Run> merged;
+            for (size_t first = 0; first < runs.size(); first += MAX_MERGE_RUNS) {
+                size_t last = min(runs.size(), first + MAX_MERGE_RUNS);
+                Run run;
+                run.path = nextSpillPath();
+                BufferedFileWriter out;
+                bool written = out.open(run.path) && mergeRuns(first, last, [&out](string_view key, string_view row) {
+                    writeRecord(out, key, row);
+                });
+                written = out.close() && written;
+                merged.push_back(move(run));
+                error_code error;
+                for (size_t i = first; i < last; i++) {
+                    if (!runs[i].path.empty()) filesystem::remove(runs[i].path, error);
+                    heldBytes -= blockBytes(runs[i].rows);
+                    runs[i] = Run();
+                }
+                if (!written) {
+                    cerr << "Error: Unable to write " << merged.back().path << endl;
+                    runs.insert(runs.end(), make_move_iterator(merged.begin()), make_move_iterator(merged.end()));
+                    return false;
+                }
+            }
+            runs = move(merged);
+        }
+        return true;
+    }
+
+    // Past the budget every run held in memory goes to disk. The pending rows are spilled
+    // from their own buffers, which are kept for the next run instead of grown again.
+    void checkBudget() {
+        if (heldBytes < budget || failed) return;
+        for (Run& run : runs) {
+            if (run.path.empty()) {
+                failed = !spill(run.rows, run);
+                run.rows = CSVRowBlock();
+                if (failed) {
+                    cerr << "Error: Unable to write " << run.path << endl;
+                    return;
+                }
+            }
+        }
+        if (!pending.spans.empty()) {
+            sortByKey(pending);
+            runs.push_back(Run());
+            failed = !spill(pending, runs.back());
+            pending.text.clear();
+            pending.spans.clear();
+            if (failed) cerr << "Error: Unable to write " << runs.back().path << endl;
+        }
+    }
+
+    // The pending text is allocated once at about the budget, not doubled past it, and is
+    // reused run after run
+    void reservePending(size_t extra) {
+        if (pending.text.capacity() < pending.text.size() + extra) {
+            pending.text.reserve(max(budget + budget / 8, pending.text.size() + extra));
+        }
+    }
+
+    void removeSpills() {
+        error_code error;
+        for (const Run& run : runs) {
+            if (!run.path.empty()) filesystem::remove(run.path, error);
+        }
+    }
+
+public:
+    explicit RowSorter(const string& prefix, size_t memoryBudget = ROW_SORT_BUDGET)
+        : spillPrefix(prefix), budget(max(memoryBudget, ROW_SORT_MIN_RUN)) {}
+
+    ~RowSorter() {
+        removeSpills();
+    }
+
+    RowSorter(const RowSorter&) = delete;
+    RowSorter& operator=(const RowSorter&) = delete;
+
+    // key may point into row or anywhere else (an unescaped field); both are copied
+    void add(string_view key, string_view row) {
+        reservePending(row.size() + key.size());
+        RowSpan span{ pending.text.size(), pending.text.size(), static_cast<uint32_t>(row.size()), static_cast<uint32_t>(key.size()) };
+        if (key.data() >= row.data() && key.data() + key.size() <= row.data() + row.size()) {
+            span.keyOffset += key.data() - row.data();
+            pending.text.append(row);
+        }
+        else {
+            pending.text.append(row);
+            span.keyOffset = pending.text.size();
+            pending.text.append(key);
+        }
+        pending.spans.push_back(span);
+        heldBytes += row.size() + (span.keyOffset >= span.offset + span.length ? key.size() : 0) + sizeof(RowSpan);
+        rowCount++;
+        checkBudget();
+    }
+
+    // Adds a block of rows already split into spans, as the init pipeline's parsers make them
+    void addBlock(CSVRowBlock&& block) {
+        size_t bytes = blockBytes(block);
+        if (pending.spans.empty()) {
+            pending = move(block);
+        }
+        else {
+            reservePending(block.text.size());
+            uint64_t shift = pending.text.size();
+            pending.text += block.text;
+            for (RowSpan span : block.spans) {
+                span.offset += shift;
+                span.keyOffset += shift;
+                pending.spans.push_back(span);
+            }
+        }
+        heldBytes += bytes;
+        rowCount += block.spans.size();
+        checkBudget();
+    }
+
+    // Takes the rows of a sorter that were read after this one's (a later chunk of the same
+    // file), so rows with equal keys stay in file order
+    void append(RowSorter& later) {
+        seal();
+        later.seal();
+        for (Run& run : later.runs) {
+            runs.push_back(move(run));
+        }
+        later.runs.clear();
+        heldBytes += later.heldBytes;
+        rowCount += later.rowCount;
+        failed = failed || later.failed;
+        later.heldBytes = 0;
+        later.rowCount = 0;
+        checkBudget();
+    }
+
+    // Writes every row to path, sorted by key, then removes the spilled runs
+    bool write(const vector<string>& header, const string& path, size_t keyColumn, RowStoreWriter& writer) {
+        seal();
+        if (failed || !reduceRuns()) return false;
+        if (!writer.open(path, header, keyColumn)) {
+            cerr << "Error: Unable to write " << path << endl;
+            return false;
+        }
+        vector<string> fields;
+        vector<string_view> views;
+        string scratch;
+        bool merged = mergeRuns(0, runs.size(), [&](string_view, string_view row) {
+            addCSVRow(writer, row, header.size(), fields, views, scratch);
+        });
+        removeSpills();
+        runs.clear();
+        heldBytes = 0;
+        return writer.close() && merged;
+    }
+
+    uint64_t size() const {
+        return rowCount;
+    }
+
+    const string& prefix() const {
+        return spillPrefix;
+    }
+
+    size_t memoryBudget() const {
+        return budget;
+    }
+
+    // Runs written to disk so far
+    size_t spilledRuns() const {
+        return spillCount;
+    }
+};
+
+// Writes every row of a CSV file to a row file, sorted by column keyColumn, in one pass;
+// rows past memoryBudget are sorted in runs on disk
+inline bool writeCSVRows(const string& csvPath, const string& path, size_t keyColumn, RowStoreWriter& writer,
+    size_t memoryBudget = ROW_SORT_BUDGET) {
+    CSVReader reader;
+    vector<string> header;
+    if (!reader.open(csvPath) || !reader.readHeader(header)) {
+        cerr << "Error: Unable to read rows from " << csvPath << endl;
+        return false;
+    }
+
+    RowSorter sorter(path, memoryBudget);
+    string scratch;
+    string_view row, field;
+    while (reader.nextRow(row)) {
+        sorter.add(CSVReader::extractField(row, keyColumn, field, scratch) ? field : string_view(), row);
+    }
+    return sorter.write(header, path, keyColumn, writer);
+}
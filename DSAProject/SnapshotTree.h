@@ -0,0 +1,176 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include "PersistentTree.h"
+using namespace std;
+
+// A version of the tree as readers see it: a commit of the persistent tree, which is never
+// changed while it is published
+struct TreeSnapshot {
+    const PersistentNode* root = nullptr;
+    size_t count = 0;
+    size_t commitId = 0;
+    HashDigest rootDigest;
+
+    bool contains(string_view key) const {
+        return PersistentTreeBase<>::contains(root, key);
+    }
+};
+
+// One writer changing a PersistentAVLTree or PersistentRBTree while any number of reader
+// threads look keys up, without locks on either side.
+//
+// The writer edits the working tree, which readers never see, and publish() commits it and
+// swaps the published snapshot pointer in one atomic store; readers see either the old
+// version or the new one, whole. Path copying keeps every commit unchanged by later writes,
+// so a reader can walk its snapshot while the writer carries on.
+//
+// Replaced snapshots are reclaimed by epochs. A reader announces the global epoch before it
+// loads the snapshot pointer and clears it when done; the writer stamps a replaced snapshot
+// with the epoch current when it was unpublished, then advances the epoch. Once no reader
+// announces that epoch or an older one, nobody can still be reading the snapshot, and its
+// commit is dropped (freeing the nodes no newer version shares). A reader that stalls only
+// delays reclamation; it never blocks the writer or other readers.
+template <typename Tree>
+class SnapshotTree {
+public:
+    static const size_t MAX_READERS = 64;
+
+private:
+    struct alignas(64) ReaderSlot {
+        atomic<uint64_t> epoch{ 0 };   // 0 when the reader isn't reading
+        atomic<bool> claimed{ false };
+    };
+
+    struct Retired {
+        TreeSnapshot* snapshot;
+        uint64_t epoch;
+    };
+
+    Tree tree;                               // the writer's
+    alignas(64) atomic<TreeSnapshot*> published{ nullptr };
+    alignas(64) atomic<uint64_t> globalEpoch{ 1 };
+    ReaderSlot readers[MAX_READERS];
+    vector<Retired> retired;                 // the writer's
+    static const TreeSnapshot emptySnapshot;
+
+    void dropSnapshot(TreeSnapshot* snapshot) {
+        tree.dropCommit(snapshot->commitId);
+        delete snapshot;
+    }
+
+public:
+    // A reader thread's registration; each query thread holds its own
+    class Reader {
+    private:
+        SnapshotTree* owner;
+        ReaderSlot* slot = nullptr;
+
+    public:
+        explicit Reader(SnapshotTree& tree) : owner(&tree) {
+            for (ReaderSlot& candidate : tree.readers) {
+                bool expected = false;
+                if (candidate.claimed.compare_exchange_strong(expected, true)) {
+                    slot = &candidate;
+                    return;
+                }
+            }
+            cerr << "Error: More than " << MAX_READERS << " snapshot readers" << endl;
+        }
+
+        ~Reader() {
+            if (slot) slot->claimed.store(false, memory_order_release);
+        }
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        bool registered() const {
+            return slot != nullptr;
+        }
+
+        // Calls fn(const TreeSnapshot&) with the latest published snapshot, which stays valid
+        // until fn returns, and returns what fn returns
+        template <typename Fn>
+        auto read(Fn fn) {
+            if (!slot) return fn(emptySnapshot);
+            // seq_cst orders the announcement before the pointer load, against the
+            // writer's unpublish, epoch advance and slot scan
+            slot->epoch.store(owner->globalEpoch.load());
+            const TreeSnapshot* snapshot = owner->published.load();
+            struct Leave {
+                ReaderSlot* slot;
+                ~Leave() { slot->epoch.store(0, memory_order_release); }
+            } leave{ slot };
+            return fn(snapshot ? *snapshot : emptySnapshot);
+        }
+
+        bool contains(string_view key) {
+            return read([key](const TreeSnapshot& snapshot) { return snapshot.contains(key); });
+        }
+    };
+
+    SnapshotTree() {}
+
+    // Readers must be gone by now
+    ~SnapshotTree() {
+        for (const Retired& item : retired) {
+            dropSnapshot(item.snapshot);
+        }
+        delete published.load();
+    }
+
+    SnapshotTree(const SnapshotTree&) = delete;
+    SnapshotTree& operator=(const SnapshotTree&) = delete;
+
+    // The working tree; only the writer thread may use it
+    Tree& working() {
+        return tree;
+    }
+
+    // Commits the working tree and makes it what readers see, then frees the snapshots no
+    // reader can still be using. Returns the commit id.
+    size_t publish() {
+        size_t id = tree.commit();
+        TreeSnapshot* snapshot = new TreeSnapshot{ tree.getCommitRoot(id), tree.getCommitSize(id), id, tree.getCommitDigest(id) };
+        TreeSnapshot* previous = published.exchange(snapshot);
+        if (previous) {
+            retired.push_back(Retired{ previous, globalEpoch.fetch_add(1) });
+        }
+        reclaim();
+        return id;
+    }
+
+    // Frees the replaced snapshots that every active reader has moved past; returns how many
+    // are still waiting
+    size_t reclaim() {
+        uint64_t oldestReading = UINT64_MAX;
+        for (const ReaderSlot& slot : readers) {
+            uint64_t epoch = slot.epoch.load();
+            if (epoch != 0 && epoch < oldestReading) oldestReading = epoch;
+        }
+        size_t kept = 0;
+        for (const Retired& item : retired) {
+            if (item.epoch < oldestReading) {
+                dropSnapshot(item.snapshot);
+            }
+            else {
+                retired[kept++] = item;
+            }
+        }
+        retired.resize(kept);
+        return kept;
+    }
+
+    // Snapshots replaced but not yet freed
+    size_t pendingCount() const {
+        return retired.size();
+    }
+};
+
+template <typename Tree>
+const TreeSnapshot SnapshotTree<Tree>::emptySnapshot{};
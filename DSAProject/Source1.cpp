@@ -3,297 +3,629 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <string_view>
+#include <cstdlib>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include "CSVReader.h"
+#include "ParallelLoader.h"
+#include "AVLtree.h"
+#include "RBtree.h"
+#include "BTree.h"
+#include "CommitDelta.h"
+#include "MerkleDiff.h"
+#include "ObjectStore.h"
+#include "RowStore.h"
+#include "InitPipeline.h"
+#include "Instrumentation.h"
 using namespace std;
 
-// Instructor Hash Class
-class InstructorHash {
-public:
-    // Compute Instructor Hash for an integer
-    int computeHash(int number) {
-        int hashValue = 1;
-        while (number > 0) {
-            int digit = number % 10; // Extract the last digit
-            hashValue = (hashValue * digit) % 29; // Multiply and take modulo 29
-            number /= 10; // Remove the last digit
+// GitLite Class
+class GitLite {
+private:
+    string fileName;
+    string treeType;
+    string hashMethod;
+    int bTreeOrder = 0;
+    int threadCount = 1; // 1 = stream rows on this thread, 0 = one thread per core
+    bool useObjectStore = false; // also store each commit's nodes in objects/
+    bool pipelined = false;      // init reads, parses, builds and saves rows concurrently
+    string rowFile;              // full rows of the current revision, once saved
+    vector<string> columnNames;
+
+    // Reads the header row; the same reader is then used to stream the data rows
+    bool readCSVColumns(CSVReader& reader)
+    {
+        if (!reader.open(fileName)) {
+            cerr << "Error: Unable to open file " << fileName << endl;
+            return false;
         }
-        return hashValue;
+
+        // Read the first line to extract column names
+        reader.readHeader(columnNames);
+        return true;
     }
 
-    // Compute Instructor Hash for a string
-    int computeHash(const string& str)
+    // One column, or several separated by commas (1,3,4) for one tree each. Returns them
+    // zero-based in the order given without repeats, or none if the input ran out.
+    vector<int> getColumnSelections() {
+        cout << "Available columns in the dataset:" << endl;
+        for (size_t i = 0; i < columnNames.size(); ++i) {
+            cout << i + 1 << ". " << columnNames[i] << endl;
+        }
+
+        while (true) {
+            cout << "Select the column(s) to construct the tree (1-" << columnNames.size() << ", several as 1,3): ";
+            string choice;
+            if (!(cin >> choice)) {
+                return vector<int>();
+            }
+
+            vector<int> columns;
+            bool valid = true;
+            size_t start = 0;
+            while (valid && start <= choice.size()) {
+                size_t comma = choice.find(',', start);
+                if (comma == string::npos) comma = choice.size();
+                string part = choice.substr(start, comma - start);
+                int column = atoi(part.c_str());
+                if (part.empty() || part.find_first_not_of("0123456789") != string::npos
+                    || column < 1 || column > static_cast<int>(columnNames.size())) {
+                    valid = false;
+                }
+                else if (find(columns.begin(), columns.end(), column - 1) == columns.end()) {
+                    columns.push_back(column - 1); // Convert to zero-based index
+                }
+                start = comma + 1;
+            }
+            if (valid) {
+                return columns;
+            }
+        }
+    }
+
+    void initializeTreeStructure()
     {
+        cout << "Choose tree type (AVL/B/Red-Black): ";
+        cin >> treeType;
 
-        //int hashValue = 1;
-        /*
-        for (char c : str) {
-            hashValue = (hashValue * static_cast<int>(c)) % 29; // Multiply ASCII value and take modulo 29
+        if (isBTree() && bTreeOrder == 0) {
+            cout << "Choose B-tree order (max children per node, 3-4096, 0 for " << BTREE_DEFAULT_ORDER << "): ";
+            int order;
+            do
+            {
+                cin >> order;
+                if (order != 0 && (order < 3 || order > 4096))
+                    cout << "Invalid order, try again: ";
+            } while (order != 0 && (order < 3 || order > 4096));
+            bTreeOrder = order == 0 ? BTREE_DEFAULT_ORDER : order;
         }
-        */
-        int hashValue = 1; // Start with an initial hash value of 1
-        for (size_t i = 0; i < str.length(); i++) {
-            int asciiValue = static_cast<int>(str[i]); // Get the ASCII value of the character at index i
-            hashValue = (hashValue * asciiValue) % 29; // Multiply and take modulo 29
+
+        if (isAVL() || isRedBlack() || isBTree()) {
+            cout << "Choose hash method (1. Instructor Hash, 2. SHA-256): ";
+            int hashChoice;
+            do
+            {
+                cin >> hashChoice;
+                if (hashChoice == 1)
+                    hashMethod = "Instructor Hash";
+                else
+                    if (hashChoice == 2)
+                        hashMethod = "SHA-256";
+                    else
+                        cout << "Invalid choice, try again: ";
+            } while (hashChoice != 1 && hashChoice != 2);
         }
-        return hashValue;
     }
-};
-
-//AVL CLASS with additional member: hash value per node
-struct AVLNode
-{
-    string key;        // Key for this node
-    int hashValue;     // Hash value for this node
-    AVLNode* left;
-    AVLNode* right;
-    int height;
-
-    // Constructor
-    AVLNode(string k, int h) : key(k), hashValue(h), left(nullptr), right(nullptr), height(1) {}
-};
 
+    bool isAVL() const {
+        return treeType == "AVL" || treeType == "avl";
+    }
 
-class AVLTree
-{
-private:
-    AVLNode* root; // Root of the tree
-    InstructorHash hasher; // Hashing utility
+    bool isBTree() const {
+        return treeType == "B" || treeType == "b" || treeType == "B-tree" || treeType == "btree";
+    }
 
-    int height(AVLNode* node)
-    {
-        return node ? node->height : 0;
+    bool isRedBlack() const {
+        return treeType == "Red-Black" || treeType == "red-black" || treeType == "RB" || treeType == "rb";
     }
 
-    // Helper function to update the hash for a node
-    void updateHash(AVLNode* node)
+    // Reads the selected columns of every data row in one pass and returns each column's keys
+    // sorted and deduplicated. With rows, the full rows are collected for the row file in the
+    // same pass, keyed by the first column.
+    vector<vector<string>> loadColumnKeys(CSVReader& reader, const vector<size_t>& columns, RowSorter* rows = nullptr)
     {
-        if (!node) return;
-
-        // Leaf node: hash is based on its key
-        if (!node->left && !node->right)
-        {
-            node->hashValue = hasher.computeHash(node->key);
+        vector<vector<string>> keys(columns.size());
+        if (threadCount == 1) {
+            // Stream the selected columns (header was already consumed); exported ID
+            // columns are usually sorted already, in which case no sort is done
+            string scratch;
+            string_view row, key;
+            while (reader.nextRow(row)) {
+                for (size_t slot = 0; slot < columns.size(); slot++) {
+                    bool found = CSVReader::extractField(row, columns[slot], key, scratch);
+                    if (found) keys[slot].emplace_back(key);
+                    if (slot == 0 && rows) rows->add(found ? key : string_view(), row);
+                }
+            }
+            for (vector<string>& columnKeys : keys) {
+                prepareSortedKeys(columnKeys);
+            }
         }
-        // Internal node: hash combines left and right child hashes
-        else
-        {
-            string combined = (node->left ? to_string(node->left->hashValue) : "") +
-                (node->right ? to_string(node->right->hashValue) : "");
-            node->hashValue = hasher.computeHash(combined);
+        else {
+            // Parse chunks of the file in parallel into merged, sorted key lists
+            ThreadPool pool(threadCount);
+            cout << "Parsing with " << pool.size() << " threads..." << endl;
+            keys = loadSortedColumns(fileName, reader.position(), columns, pool, 4, rows);
         }
+        return keys;
     }
 
-    int getBalance(AVLNode* node)
+    vector<string> loadKeys(CSVReader& reader, int columnIndex, RowSorter* rows = nullptr)
     {
-        return node ? height(node->left) - height(node->right) : 0;
+        return move(loadColumnKeys(reader, vector<size_t>(1, columnIndex), rows)[0]);
+    }
+
+    // Binary trees are saved as one pack file, B-trees as 4 KiB pages
+    template <typename Tree>
+    static bool saveTreeFile(Tree& tree, const string& path) {
+        return tree.savePack(path);
+    }
+
+    template <typename Hasher>
+    static bool saveTreeFile(BTree<Hasher>& tree, const string& path) {
+        return tree.savePages(path);
     }
 
-    void updateHeight(AVLNode* node)
+    // Saves every row of the file sorted by the selected column, so each tree key maps back to
+    // its full rows; the rows were collected while the keys were read
+    bool saveRows(const string& path, int columnIndex, RowSorter& rows)
     {
-        node->height = 1 + max(height(node->left), height(node->right));
+        RowStoreWriter writer;
+        if (!rows.write(columnNames, path, columnIndex, writer)) {
+            return false;
+        }
+        rowsSaved(path, writer);
+        return true;
     }
 
-    // rotations; EVERYTIME U DO A ROTATION, YOU WILL ALSO UPDATE THE HASH. HENCE update Hash called for the new subtrees
-    AVLNode* rightRotate(AVLNode* y)
+    void rowsSaved(const string& path, const RowStoreWriter& writer)
     {
-        AVLNode* x = y->left;
-        AVLNode* T2 = x->right;
+        cout << "Rows: " << writer.size() << " rows, " << writer.csvBytes() / 1024 << " KiB of CSV stored in "
+            << writer.fileBytes() / 1024 << " KiB" << endl;
+        rowFile = path;
+    }
 
-        // perform rotation
-        x->right = y;
-        y->left = T2;
+    // Adds the nodes a commit doesn't share with earlier ones to the object store
+    // Returns the bytes it wrote
+    template <typename Tree>
+    uint64_t storeObjects(Tree& tree)
+    {
+        if (!useObjectStore) return 0;
+        if constexpr (is_same<typename Tree::HasherType, Sha256Hasher>::value) {
+            ObjectStore store;
+            ObjectWriteStats stats;
+            if (!store.open("objects") || !store.writeTree(tree, stats)) {
+                return 0;
+            }
+            cout << "Object store: " << stats.objectsWritten << " new objects, " << stats.bytesWritten
+                << " bytes written, " << stats.subtreesShared << " subtrees shared" << endl;
+            return stats.bytesWritten;
+        }
+        else {
+            cerr << "Error: The object store needs the SHA-256 hash method" << endl;
+            return 0;
+        }
+    }
 
-        updateHeight(y);
-        updateHeight(x);
-        updateHash(y);
-        updateHash(x);
+    template <typename Hasher>
+    uint64_t storeObjects(BTree<Hasher>&)
+    {
+        if (useObjectStore) {
+            cerr << "Error: The object store only holds AVL and Red-Black trees" << endl;
+        }
+        return 0;
+    }
 
-        return x;
+    static uint64_t fileBytes(const string& path)
+    {
+        error_code error;
+        uint64_t size = filesystem::file_size(path, error);
+        return error ? 0 : size;
     }
 
-    AVLNode* leftRotate(AVLNode* x) {
-        AVLNode* y = x->right;
-        AVLNode* T2 = y->left;
+    // Times work as the named phase, except for the hashing it triggers, which the trees time
+    // themselves and which goes to the "hash" phase
+    template <typename Tree, typename Work>
+    static void timeTreeWork(RunReport& report, const string& phase, Tree& tree, Work work)
+    {
+        uint64_t hashedBefore = tree.getHashStats().batchNanoseconds;
+        Stopwatch timer;
+        work();
+        uint64_t elapsed = timer.nanoseconds();
+        uint64_t hashed = tree.getHashStats().batchNanoseconds - hashedBefore;
+        report.addPhase(phase, elapsed - min(elapsed, hashed));
+        report.addPhase("hash", hashed);
+    }
 
-        // perform rotation
-        y->left = x;
-        x->right = T2;
+    // Totals the trees keep as they go; a B-tree splits nodes instead of rotating them, and
+    // its pages are counted from the file it was saved to
+    template <typename Hasher, typename Allocator>
+    static void reportTree(RunReport& report, const AVLTree<Hasher, Allocator>& tree, const string&)
+    {
+        report.addCounter("rotations", tree.getRotationCount());
+        report.addCounter("hash_calls", tree.getHashStats().hashesComputed);
+        report.addCounter("nodes_written", tree.getNodeCount());
+    }
 
-        updateHeight(x);
-        updateHeight(y);
-        updateHash(x);
-        updateHash(y);
+    template <typename Hasher, typename Allocator>
+    static void reportTree(RunReport& report, const RBTree<string, Hasher, Allocator>& tree, const string&)
+    {
+        report.addCounter("rotations", tree.getRotationCount());
+        report.addCounter("hash_calls", tree.getHashStats().hashesComputed);
+        report.addCounter("nodes_written", tree.size());
+    }
 
-        return y;
+    template <typename Hasher>
+    static void reportTree(RunReport& report, const BTree<Hasher>& tree, const string& pageFile)
+    {
+        report.addCounter("hash_calls", tree.getHashStats().hashesComputed);
+        report.addCounter("pages_written", fileBytes(pageFile) / BTREE_PAGE_SIZE);
     }
 
-    AVLNode* insertNode(AVLNode* node, const string& key)
+    // Tree is AVLTree, RBTree or BTree with string keys; all of them build from sorted keys
+    template <typename Tree>
+    void buildRepository(Tree& tree, CSVReader& reader, int columnIndex, RunReport& report)
     {
-        if (node == nullptr) {
-            int hash = hasher.computeHash(key); // Compute hash using Instructor Hash
-            cout << "Creating node for key: " << key << ", Hash: " << hash << endl;
-            return new AVLNode(key, hash);
+        // Pipelined, "parse" is the wait for the last keys and "rows" the wait for the row
+        // file after the tree is saved; the stages report what ran underneath
+        InitPipeline pipeline(threadCount);
+        RowSorter rows("repository.rows");
+        vector<string> keys;
+        {
+            RunReport::Phase phase(report, "parse");
+            if (pipelined) {
+                pipeline.start(fileName, reader.position(), columnIndex, columnNames, "repository.rows");
+                keys = pipeline.takeKeys();
+            }
+            else {
+                keys = loadKeys(reader, columnIndex, &rows);
+            }
         }
-
-        if (key < node->key) {
-            node->left = insertNode(node->left, key);
+        if (pipeline.failed()) {
+            pipeline.finish();
+            return;
+        }
+        report.addCounter("keys", keys.size());
+
+        // Build the tree bottom-up instead of inserting one key at a time
+        timeTreeWork(report, "insert", tree, [&]() {
+            tree.buildFromSorted(move(keys));
+        });
+
+        // Save the tree to one file instead of a .txt file per node
+        const string packFile = isBTree() ? "repository.btree" : "repository.pack";
+        bool saved = false;
+        timeTreeWork(report, "save", tree, [&]() {
+            saved = saveTreeFile(tree, packFile);
+        });
+        if (!saved) {
+            return;
         }
-        else if (key > node->key) {
-            node->right = insertNode(node->right, key);
+        {
+            RunReport::Phase phase(report, "rows");
+            if (!pipelined) {
+                saveRows("repository.rows", columnIndex, rows);
+            }
+            else if (pipeline.finish()) {
+                rowsSaved("repository.rows", pipeline.rowWriter());
+            }
         }
-        else {
-            return node; // Duplicate keys are not allowed in the AVL tree
+        if (pipelined) {
+            pipeline.reportStages(report);
         }
 
-        // Update height and hash of this ancestor node
-        updateHeight(node);
-        updateHash(node);
+        // Save root hash in metadata
+        string rootHash = tree.getRootHash();
+        writeMetadata(Tree::HasherType::name(), columnNames[columnIndex], packFile, rootHash, 0);
+        uint64_t objectBytes = storeObjects(tree);
 
-        // Get balance factor
-        int balance = getBalance(node);
+        cout << "Repository initialized successfully with metadata saved." << endl;
+        cout << "Merkle Root Hash: " << rootHash << endl;
 
-        // If the node becomes unbalanced, perform rotations
+        reportTree(report, tree, packFile);
+        report.addCounter("bytes_read", fileBytes(fileName));
+        report.addCounter("bytes_written", fileBytes(packFile) + fileBytes(rowFile) + fileBytes("repository_meta.txt") + objectBytes);
+        report.writeJSON(cout);
+    }
 
-        // Left-Left Case
-        if (balance > 1 && key < node->left->key) {
-            return rightRotate(node);
+    // Chains the column roots, in the order selected, into one hash: each link hashes the
+    // column name with the previous link as its left child and the column root as its right,
+    // so the result changes if any column, its name or the order changes
+    template <typename Hasher>
+    static HashDigest combineRoots(const vector<string>& names, const vector<HashDigest>& roots)
+    {
+        Hasher hasher;
+        HashDigest combined;
+        for (size_t i = 0; i < roots.size(); i++) {
+            HashDigest link;
+            hasher.hashNode(names[i], i > 0 ? &combined : nullptr, &roots[i], link);
+            combined = link;
         }
+        return combined;
+    }
 
-        // Right-Right Case
-        if (balance < -1 && key > node->right->key) {
-            return leftRotate(node);
+    // Several columns: one pass over the file collects the keys of all of them and the rows,
+    // on this thread, with --threads or with --pipeline as for one column; then each column's
+    // tree is built, hashed and saved on a thread of its own. The first column is the primary
+    // one: the row file is sorted by it, and show uses its tree.
+    template <typename Tree, typename MakeTree>
+    void buildColumnRepositories(CSVReader& reader, const vector<int>& columns, RunReport& report, MakeTree makeTree)
+    {
+        const vector<size_t> keyColumns(columns.begin(), columns.end());
+        InitPipeline pipeline(threadCount);
+        RowSorter rows("repository.rows");
+        vector<vector<string>> keys;
+        {
+            RunReport::Phase phase(report, "parse");
+            if (pipelined) {
+                pipeline.start(fileName, reader.position(), keyColumns, columnNames, "repository.rows");
+                keys = pipeline.takeColumnKeys();
+            }
+            else {
+                keys = loadColumnKeys(reader, keyColumns, &rows);
+            }
         }
-
-        // Left-Right Case
-        if (balance > 1 && key > node->left->key) {
-            node->left = leftRotate(node->left);
-            return rightRotate(node);
+        if (pipeline.failed()) {
+            pipeline.finish();
+            return;
         }
 
-        // Right-Left Case
-        if (balance < -1 && key < node->right->key) {
-            node->right = rightRotate(node->right);
-            return leftRotate(node);
+        vector<string> names;
+        vector<unique_ptr<Tree>> trees;
+        vector<string> packFiles;
+        uint64_t keyTotal = 0;
+        for (size_t i = 0; i < columns.size(); i++) {
+            names.push_back(columnNames[columns[i]]);
+            trees.push_back(makeTree());
+            packFiles.push_back("repository_" + to_string(columns[i] + 1) + (isBTree() ? ".btree" : ".pack"));
+            keyTotal += keys[i].size();
         }
 
-        return node;
-    }
+        // Each column's thread times its insert, hash and save into a report of its own,
+        // gathered as "insert (column)" and so on; "build" is the wall time of them all
+        vector<RunReport> columnReports(columns.size(), RunReport("column"));
+        vector<char> saved(columns.size(), 0); // one flag per thread; vector<bool> shares bytes
+        {
+            RunReport::Phase phase(report, "build");
+            ThreadPool pool(columns.size());
+            for (size_t i = 0; i < columns.size(); i++) {
+                pool.submit([&, i] {
+                    Tree& tree = *trees[i];
+                    timeTreeWork(columnReports[i], "insert", tree, [&]() {
+                        tree.buildFromSorted(move(keys[i]));
+                    });
+                    timeTreeWork(columnReports[i], "save", tree, [&]() {
+                        saved[i] = saveTreeFile(tree, packFiles[i]);
+                    });
+                });
+            }
+            pool.wait();
+        }
+        for (size_t i = 0; i < columns.size(); i++) {
+            report.addPhases(columnReports[i], " (" + names[i] + ")");
+        }
+        if (find(saved.begin(), saved.end(), 0) != saved.end()) {
+            return;
+        }
+        {
+            RunReport::Phase phase(report, "rows");
+            if (!pipelined) {
+                saveRows("repository.rows", columns[0], rows);
+            }
+            else if (pipeline.finish()) {
+                rowsSaved("repository.rows", pipeline.rowWriter());
+            }
+        }
+        if (pipelined) {
+            pipeline.reportStages(report);
+        }
 
-    // makes every node a txt file w key hash left right data in it
-    void saveNodeToFile(AVLNode* node)
-    {
-        if (node == nullptr) return;
+        vector<HashDigest> roots;
+        vector<pair<string, string>> fields;
+        string columnList;
+        for (size_t i = 0; i < columns.size(); i++) {
+            roots.push_back(trees[i]->getRootDigest());
+            columnList += (i > 0 ? ", " : "") + names[i];
+        }
+        fields.push_back(make_pair("Columns", columnList));
+        for (size_t i = 0; i < columns.size(); i++) {
+            fields.push_back(make_pair("Column " + names[i] + " Pack File", packFiles[i]));
+            fields.push_back(make_pair("Column " + names[i] + " Root Hash", Tree::HasherType::toString(roots[i])));
+        }
+        string combinedHash = Tree::HasherType::toString(combineRoots<typename Tree::HasherType>(names, roots));
+        fields.push_back(make_pair("Combined Root Hash", combinedHash));
+        writeMetadata(Tree::HasherType::name(), names[0], packFiles[0], Tree::HasherType::toString(roots[0]), 0, fields);
+        uint64_t objectBytes = 0;
+        for (unique_ptr<Tree>& tree : trees) {
+            objectBytes += storeObjects(*tree);
+        }
 
-        string fileName = node->key + ".txt";
-        ofstream file(fileName);
-        if (file) {
-            file << "Key: " << node->key << endl;
-            file << "Hash: " << node->hashValue << endl;
-            file << "Left: " << (node->left ? node->left->key : "NULL") << endl;
-            file << "Right: " << (node->right ? node->right->key : "NULL") << endl;
-            file.close();
-            cout << "Node saved to file: " << fileName << endl;
+        cout << "Repository initialized successfully with metadata saved." << endl;
+        for (size_t i = 0; i < columns.size(); i++) {
+            cout << "Merkle Root Hash (" << names[i] << "): " << Tree::HasherType::toString(roots[i]) << endl;
         }
+        cout << "Combined Root Hash: " << combinedHash << endl;
 
-        //saving left n right subtrees
-        saveNodeToFile(node->left);
-        saveNodeToFile(node->right);
+        uint64_t packBytes = 0;
+        for (size_t i = 0; i < columns.size(); i++) {
+            reportTree(report, *trees[i], packFiles[i]);
+            packBytes += fileBytes(packFiles[i]);
+        }
+        report.addCounter("columns", columns.size());
+        report.addCounter("keys", keyTotal);
+        report.addCounter("bytes_read", fileBytes(fileName));
+        report.addCounter("bytes_written", packBytes + fileBytes(rowFile) + fileBytes("repository_meta.txt") + objectBytes);
+        report.writeJSON(cout);
     }
 
-public:
-    AVLTree() : root(nullptr) {}
-
-    // Insert a key into the AVL tree
-    void insert(const string& key) {
-        root = insertNode(root, key);
+    // One column builds one tree as before; several share a single pass over the file
+    template <typename MakeTree>
+    void buildTrees(CSVReader& reader, const vector<int>& columns, RunReport& report, MakeTree makeTree)
+    {
+        typedef typename decltype(makeTree())::element_type Tree;
+        if (columns.size() == 1) {
+            unique_ptr<Tree> tree = makeTree();
+            buildRepository(*tree, reader, columns[0], report);
+        }
+        else {
+            buildColumnRepositories<Tree>(reader, columns, report, makeTree);
+        }
     }
 
-    // Save the entire tree to .txt files
-    void saveToFiles() {
-        saveNodeToFile(root);
+    // columnFields describe the other trees of a multi-column repository
+    void writeMetadata(const string& hashName, const string& columnName, const string& packFile, const string& rootHash, int commitNumber,
+        const vector<pair<string, string>>& columnFields = {})
+    {
+        ofstream repoFile("repository_meta.txt");
+        repoFile << "File: " << fileName << endl;
+        repoFile << "Tree Type: " << treeType << endl;
+        repoFile << "Hash Method: " << hashName << endl;
+        repoFile << "Selected Column: " << columnName << endl;
+        if (isBTree()) {
+            repoFile << "B-Tree Order: " << bTreeOrder << endl;
+            repoFile << "Page File: " << packFile << endl;
+        }
+        else {
+            repoFile << "Pack File: " << packFile << endl;
+        }
+        if (!rowFile.empty()) {
+            repoFile << "Row File: " << rowFile << endl;
+        }
+        if (commitNumber > 0) {
+            repoFile << "Commit: " << commitNumber << endl;
+        }
+        for (const pair<string, string>& field : columnFields) {
+            repoFile << field.first << ": " << field.second << endl;
+        }
+        repoFile << "Merkle Root Hash: " << rootHash << endl;
     }
 
-    // Get the hash of the root node (Merkle Root Hash)
-    int getRootHash() {
-        return root ? root->hashValue : 0;
+    // Quotes the fields that need it, so the output reads back as the same CSV row
+    static void printCSVRow(const vector<string>& fields)
+    {
+        for (size_t i = 0; i < fields.size(); i++) {
+            if (i > 0) cout << ',';
+            const string& field = fields[i];
+            if (field.find_first_of(",\"\r\n") == string::npos) {
+                cout << field;
+                continue;
+            }
+            cout << '"';
+            for (char c : field) {
+                if (c == '"') cout << '"';
+                cout << c;
+            }
+            cout << '"';
+        }
+        cout << endl;
     }
-};
 
-// GitLite Class
-class GitLite {
-private:
-    string fileName;
-    string treeType;
-    string hashMethod;
-    int bTreeOrder = 0;
-    vector<string> columnNames;
-
-    // Helper function to split a line by commas
-    vector<string> splitLine(const string& line) {
-        vector<string> result;
-        size_t start = 0, end = 0;
-
-        while ((end = line.find(',', start)) != string::npos) {
-            result.push_back(line.substr(start, end - start));
-            start = end + 1;
+    // Reads the "Name: value" lines of repository_meta.txt
+    static bool readMetadata(map<string, string>& fields)
+    {
+        ifstream repoFile("repository_meta.txt");
+        if (!repoFile) {
+            cerr << "Error: No repository found, run init first" << endl;
+            return false;
+        }
+        string line;
+        while (getline(repoFile, line)) {
+            size_t colon = line.find(": ");
+            if (colon != string::npos) {
+                fields[line.substr(0, colon)] = line.substr(colon + 2);
+            }
         }
-        result.push_back(line.substr(start)); // Add the last token
-        return result;
+        return true;
     }
 
-    void readCSVColumns()
+    // Loads the last committed tree, applies only the keys that changed in the new revision
+    // and saves the result as the next commit's pack. Reading and diffing the new file is
+    // O(rows); the tree work and the rehashing are O(changed rows * log n).
+    template <typename Tree>
+    void commitTree(Tree& tree, CSVReader& reader, int columnIndex, const string& previousPack, int commitNumber, RunReport& report)
     {
-        ifstream file(fileName);
-        if (!file) {
-            cerr << "Error: Unable to open file " << fileName << endl;
+        bool loaded = false;
+        timeTreeWork(report, "load", tree, [&]() {
+            loaded = tree.loadPack(previousPack);
+        });
+        if (!loaded) {
+            cerr << "Error: Unable to load " << previousPack << endl;
             return;
         }
 
-        // Read the first line to extract column names
-        string headerLine;
-        if (getline(file, headerLine)) {
-            columnNames = splitLine(headerLine);
+        const string rowPath = "commit_" + to_string(commitNumber) + ".rows";
+        RowSorter rows(rowPath);
+        vector<string> keys;
+        {
+            RunReport::Phase phase(report, "parse");
+            keys = loadKeys(reader, columnIndex, &rows);
         }
-        file.close();
-    }
-
-    int getColumnSelection() {
-        cout << "Available columns in the dataset:" << endl;
-        for (size_t i = 0; i < columnNames.size(); ++i) {
-            cout << i + 1 << ". " << columnNames[i] << endl;
+        report.addCounter("keys", keys.size());
+        KeyDelta delta;
+        {
+            RunReport::Phase phase(report, "diff");
+            delta = diffKeys(tree, keys);
+        }
+        timeTreeWork(report, "insert", tree, [&]() {
+            applyDelta(tree, delta);
+        });
+
+        const string packFile = "commit_" + to_string(commitNumber) + ".pack";
+        bool saved = false;
+        timeTreeWork(report, "save", tree, [&]() {
+            saved = saveTreeFile(tree, packFile);
+        });
+        if (!saved) {
+            return;
         }
+        {
+            RunReport::Phase phase(report, "rows");
+            saveRows(rowPath, columnIndex, rows);
+        }
+        string rootHash = tree.getRootHash();
+        writeMetadata(Tree::HasherType::name(), columnNames[columnIndex], packFile, rootHash, commitNumber);
+        uint64_t objectBytes = storeObjects(tree);
+
+        cout << "Commit " << commitNumber << ": " << delta.added.size() << " keys added, "
+            << delta.removed.size() << " removed" << endl;
+        cout << "Merkle Root Hash: " << rootHash << endl;
+
+        reportTree(report, tree, packFile);
+        report.addCounter("bytes_read", fileBytes(previousPack) + fileBytes(fileName));
+        report.addCounter("bytes_written", fileBytes(packFile) + fileBytes(rowFile) + fileBytes("repository_meta.txt") + objectBytes);
+        report.writeJSON(cout);
+    }
 
-        int choice = 0;
-        do {
-            cout << "Select the column to construct the tree (1-" << columnNames.size() << "): ";
-            cin >> choice;
-        } while (choice < 1 || choice > static_cast<int>(columnNames.size()));
+public:
+    void setThreadCount(int count) {
+        threadCount = count < 0 ? 1 : count;
+    }
 
-        return choice - 1; // Convert to zero-based index
+    void setObjectStore(bool enabled) {
+        useObjectStore = enabled;
     }
 
-    void initializeTreeStructure()
-    {
-        cout << "Choose tree type (AVL/B/Red-Black): ";
-        cin >> treeType;
+    void setPipelined(bool enabled) {
+        pipelined = enabled;
+    }
 
-        if (treeType == "AVL" || treeType == "avl") {
-            cout << "Choose hash method (1. Instructor Hash, 2. SHA-256): ";
-            int hashChoice;
-            do
-            {
-                cin >> hashChoice;
-                if (hashChoice == 1)
-                    hashMethod = "Instructor Hash";
-                else
-                    if (hashChoice == 2)
-                        hashMethod = "SHA-256";
-                    else
-                        cout << "Invalid choice, try again: ";
-            } while (hashChoice != 1 && hashChoice != 2);
-        }
+    // B-tree order from the command line; 0 asks during init
+    void setBTreeOrder(int order) {
+        bTreeOrder = order < 3 || order > 4096 ? 0 : order;
     }
 
-public:
     void initRepository(const string& inputFileName)
     {
         fileName = inputFileName;
@@ -301,7 +633,16 @@ public:
         cout << "Initializing repository with file: " << fileName << endl;
 
         // Step 1: Read column names from the CSV file
-        readCSVColumns();
+        RunReport report("init");
+        CSVReader reader;
+        bool headerRead = false;
+        {
+            RunReport::Phase phase(report, "header read");
+            headerRead = readCSVColumns(reader);
+        }
+        if (!headerRead) {
+            return;
+        }
         if (columnNames.empty())
         {
             cerr << "Error: No columns found in the dataset." << endl;
@@ -311,62 +652,218 @@ public:
         // Step 2: Select the tree structure and hash method
         initializeTreeStructure();
 
-        // Step 3: Allow the user to select a column for the tree
-        int columnIndex = getColumnSelection();
+        // Step 3: Allow the user to select the columns for the trees
+        vector<int> columns = getColumnSelections();
+        if (columns.empty()) {
+            cerr << "Error: No column selected." << endl;
+            return;
+        }
 
         // Step 4: Create the Tree and insert keys 
+        // The hash method picks the tree's Merkle hasher
         //AVL CASE:
-        if (treeType == "AVL" || treeType == "avl") {
-            AVLTree tree;
-            ifstream file(fileName);
-            if (!file) {
-                cerr << "Error: Unable to open file " << fileName << endl;
-                return;
+        if (isAVL()) {
+            if (hashMethod == "SHA-256") {
+                buildTrees(reader, columns, report, [] { return make_unique<AVLTree<Sha256Hasher>>(); });
             }
+            else {
+                buildTrees(reader, columns, report, [] { return make_unique<AVLTree<InstructorHash>>(); });
+            }
+        }
 
-            // Skip header line
-            string line;
-            getline(file, line);
-
-            // Insert keys from the selected column into the tree
-            while (getline(file, line)) {
-                vector<string> row = splitLine(line);
-                if (columnIndex < static_cast<int>(row.size()))
-                {
-                    tree.insert(row[columnIndex]);
-                }
+        //B TREE CASE:
+        else if (isBTree()) {
+            if (hashMethod == "SHA-256") {
+                buildTrees(reader, columns, report, [this] { return make_unique<BTree<Sha256Hasher>>(bTreeOrder); });
             }
+            else {
+                buildTrees(reader, columns, report, [this] { return make_unique<BTree<InstructorHash>>(bTreeOrder); });
+            }
+        }
 
-            //B TREE CASE:
+        //RB TREE CASE:
+        else if (isRedBlack()) {
+            if (hashMethod == "SHA-256") {
+                buildTrees(reader, columns, report, [] { return make_unique<RBTree<string, Sha256Hasher>>(); });
+            }
+            else {
+                buildTrees(reader, columns, report, [] { return make_unique<RBTree<string, InstructorHash>>(); });
+            }
+        }
+        else {
+            cerr << "Error: Unknown tree type " << treeType << endl;
+        }
+    }
 
+    // Commits a new revision of the dataset on top of the repository in this directory
+    void commitRepository(const string& inputFileName)
+    {
+        map<string, string> meta;
+        if (!readMetadata(meta)) {
+            return;
+        }
+        fileName = inputFileName;
+        treeType = meta["Tree Type"];
+        hashMethod = meta["Hash Method"];
+        const string columnName = meta["Selected Column"];
+        const string previousPack = meta["Pack File"];
+        const int commitNumber = atoi(meta["Commit"].c_str()) + 1;
+        if (meta.count("Columns")) {
+            cerr << "Error: Commit is not supported for multi-column repositories" << endl;
+            return;
+        }
 
-            //RB TREE CASE:
+        cout << "Committing file: " << fileName << endl;
 
-            file.close();
+        RunReport report("commit");
+        CSVReader reader;
+        bool headerRead = false;
+        {
+            RunReport::Phase phase(report, "header read");
+            headerRead = readCSVColumns(reader);
+        }
+        if (!headerRead) {
+            return;
+        }
+        int columnIndex = -1;
+        for (size_t i = 0; i < columnNames.size(); i++) {
+            if (columnNames[i] == columnName) {
+                columnIndex = static_cast<int>(i);
+            }
+        }
+        if (columnIndex < 0) {
+            cerr << "Error: Column " << columnName << " not found in " << fileName << endl;
+            return;
+        }
 
-            // Save tree to .txt files
-            tree.saveToFiles();
+        // B-trees have no delete, so only the binary trees can be committed incrementally
+        if (isAVL()) {
+            if (hashMethod == Sha256Hasher::name()) {
+                AVLTree<Sha256Hasher> tree;
+                commitTree(tree, reader, columnIndex, previousPack, commitNumber, report);
+            }
+            else {
+                AVLTree<InstructorHash> tree;
+                commitTree(tree, reader, columnIndex, previousPack, commitNumber, report);
+            }
+        }
+        else if (isRedBlack()) {
+            if (hashMethod == Sha256Hasher::name()) {
+                RBTree<string, Sha256Hasher> tree;
+                commitTree(tree, reader, columnIndex, previousPack, commitNumber, report);
+            }
+            else {
+                RBTree<string, InstructorHash> tree;
+                commitTree(tree, reader, columnIndex, previousPack, commitNumber, report);
+            }
+        }
+        else {
+            cerr << "Error: Commit is not supported for tree type " << treeType << endl;
+        }
+    }
 
-            // Save root hash in metadata
-            int rootHash = tree.getRootHash();
-            ofstream repoFile("repository_meta.txt");
-            repoFile << "File: " << fileName << endl;
-            repoFile << "Tree Type: " << treeType << endl;
-            repoFile << "Hash Method: " << hashMethod << endl;
-            repoFile << "Selected Column: " << columnNames[columnIndex] << endl;
-            repoFile << "Merkle Root Hash: " << rootHash << endl;
-            repoFile.close();
+    // Prints the full rows whose selected column is key, from the last commit's row file
+    void showRows(const string& key)
+    {
+        map<string, string> meta;
+        if (!readMetadata(meta)) {
+            return;
+        }
+        RowStore rows;
+        if (meta["Row File"].empty() || !rows.open(meta["Row File"])) {
+            cerr << "Error: The repository has no row file" << endl;
+            return;
+        }
+        vector<vector<string>> found;
+        if (!rows.findRows(key, found)) {
+            return;
+        }
+        if (found.empty()) {
+            cout << "No rows with " << rows.columnNames()[rows.keyColumn()] << " = " << key << endl;
+            return;
+        }
+        printCSVRow(rows.columnNames());
+        for (const vector<string>& row : found) {
+            printCSVRow(row);
+        }
+    }
 
-            cout << "Repository initialized successfully with metadata saved." << endl;
-            cout << "Merkle Root Hash: " << rootHash << endl;
+    // Prints the keys removed (-) and added (+) between two commits' pack files
+    void diffCommits(const string& fromPack, const string& toPack)
+    {
+        MappedTree from, to;
+        if (!from.open(fromPack) || !to.open(toPack)) {
+            return;
+        }
+        KeyDelta delta;
+        DiffStats stats;
+        if (!diffPacks(from, to, delta, stats)) {
+            return;
         }
+        for (const string& key : delta.removed) {
+            cout << "- " << key << endl;
+        }
+        for (const string& key : delta.added) {
+            cout << "+ " << key << endl;
+        }
+        cout << delta.removed.size() << " removed, " << delta.added.size() << " added ("
+            << stats.nodesVisited << " record reads, " << from.size() + to.size() << " records in both commits)" << endl;
     }
 };
 
-int main() {
+int main(int argc, char* argv[]) {
     GitLite gitLite;
     string fileName;
 
+    string commitFile;
+
+    // Options: --threads N (0 = all cores), --order N (B-tree order),
+    // --objects (also add the tree's new nodes to the objects/ store),
+    // --verbose (log every node inserted and saved),
+    // --pipeline (init reads, parses, builds and writes rows concurrently, with
+    // --threads parsers);
+    // "commit FILE" commits a new revision instead of initializing,
+    // "diff PACK PACK" lists the keys that changed between two commits,
+    // "show KEY" prints the full rows stored for a key
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            gitLite.setThreadCount(atoi(argv[++i]));
+        }
+        else if (arg == "--order" && i + 1 < argc) {
+            gitLite.setBTreeOrder(atoi(argv[++i]));
+        }
+        else if (arg == "--objects") {
+            gitLite.setObjectStore(true);
+        }
+        else if (arg == "--pipeline") {
+            gitLite.setPipelined(true);
+        }
+        else if (arg == "--verbose") {
+            verboseLogging = true;
+        }
+        else if (arg == "commit" && i + 1 < argc) {
+            commitFile = argv[++i];
+        }
+        else if (arg == "show" && i + 1 < argc) {
+            gitLite.showRows(argv[i + 1]);
+            return 0;
+        }
+        else if (arg == "diff" && i + 2 < argc) {
+            gitLite.diffCommits(argv[i + 1], argv[i + 2]);
+            return 0;
+        }
+        else {
+            cerr << "Unknown option: " << arg << endl;
+            return 1;
+        }
+    }
+
+    if (!commitFile.empty()) {
+        gitLite.commitRepository(commitFile);
+        return 0;
+    }
+
     // Event loop for command simulation
     cout << "Enter the name of the CSV file to initialize the repository: ";
     cin >> fileName;
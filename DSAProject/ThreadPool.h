@@ -0,0 +1,85 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+using namespace std;
+
+// Fixed-size pool of worker threads pulling tasks from one shared queue
+class ThreadPool {
+private:
+    vector<thread> workers;
+    queue<function<void()>> tasks;
+    mutex queueMutex;
+    condition_variable taskReady;
+    condition_variable allDone;
+    size_t pending = 0; // submitted but not yet finished
+    bool stopping = false;
+
+    void workerLoop() {
+        while (true) {
+            function<void()> task;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                taskReady.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty()) return;
+                task = move(tasks.front());
+                tasks.pop();
+            }
+
+            task();
+
+            unique_lock<mutex> lock(queueMutex);
+            if (--pending == 0) {
+                allDone.notify_all();
+            }
+        }
+    }
+
+public:
+    // threadCount == 0 means one thread per hardware core
+    explicit ThreadPool(size_t threadCount) {
+        if (threadCount == 0) {
+            threadCount = thread::hardware_concurrency();
+            if (threadCount == 0) threadCount = 1;
+        }
+        for (size_t i = 0; i < threadCount; i++) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            unique_lock<mutex> lock(queueMutex);
+            stopping = true;
+        }
+        taskReady.notify_all();
+        for (thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(function<void()> task) {
+        {
+            unique_lock<mutex> lock(queueMutex);
+            tasks.push(move(task));
+            pending++;
+        }
+        taskReady.notify_one();
+    }
+
+    // Blocks until every submitted task has finished
+    void wait() {
+        unique_lock<mutex> lock(queueMutex);
+        allDone.wait(lock, [this] { return pending == 0; });
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+};